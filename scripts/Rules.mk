@@ -34,7 +34,7 @@ $(SNMPBASE)-stats.txt: $(SNMPBASE).csv.gz
 
 $(SNMPBASE)-flows: $(SNMPBASE).csv.gz
 	-mkdir $(SNMPBASE)-flows
-	zcat $< | $(SNMPDUMP) -i csv -o csv -F -C $(SNMPBASE)-flows -P $(BASE) \
+	$(SNMPDUMP) -i csv -o csv -F -C $(SNMPBASE)-flows -P $(BASE) $< \
 		> $(SNMPBASE)-flows/$(BASE)-unknown.csv
 
 $(SNMPBASE)-flowstats.txt: $(SNMPBASE)-flows
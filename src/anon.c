@@ -630,28 +630,21 @@ anon_pdu(snmp_pdu_t *pdu)
 }
 
 /*
- * Not yet useful function to call the anonymization library.
+ * Look up the transformations for the transport addresses and ports.
  */
 
-void
-snmp_anon_apply(snmp_packet_t *pkt)
+static void
+anon_transport_transforms(anon_tf_t **addr_tfp, anon_tf_t **port_tfp)
 {
-    anon_tf_t *tfp = NULL;
     SmiType *smiType;
 
-    if (! pkt) {
-	return;
-    }
-    
     smiType = smiGetType(NULL, "IpAddress");
     if (! smiType) {
 	fprintf(stderr,
 		"%s: libsmi failed to locate the type 'IpAddress'\n",
 		progname);
     }
-    tfp = smiType ? anon_find_transform(NULL, smiType) : NULL;
-    anon_ipaddr(tfp, &pkt->src_addr);
-    anon_ipaddr(tfp, &pkt->dst_addr);
+    *addr_tfp = smiType ? anon_find_transform(NULL, smiType) : NULL;
 
     smiType = smiGetType(NULL, "InetPortNumber");
     if (! smiType) {
@@ -659,11 +652,57 @@ snmp_anon_apply(snmp_packet_t *pkt)
 		"%s: libsmi failed to locate the type 'InetPortNumber'\n",
 		progname);
     }
-    tfp = smiType ? anon_find_transform(NULL, smiType) : NULL;
-    anon_uint32(tfp, &pkt->src_port);
-    anon_uint32(tfp, &pkt->dst_port);
+    *port_tfp = smiType ? anon_find_transform(NULL, smiType) : NULL;
+}
+
+static void
+anon_packet(anon_tf_t *addr_tfp, anon_tf_t *port_tfp, snmp_packet_t *pkt)
+{
+    anon_ipaddr(addr_tfp, &pkt->src_addr);
+    anon_ipaddr(addr_tfp, &pkt->dst_addr);
+
+    anon_uint32(port_tfp, &pkt->src_port);
+    anon_uint32(port_tfp, &pkt->dst_port);
 
     /* time_sec, time_usec */
 
     anon_pdu(&pkt->snmp.scoped_pdu.pdu);
 }
+
+/*
+ * Not yet useful function to call the anonymization library.
+ */
+
+void
+snmp_anon_apply(snmp_packet_t *pkt)
+{
+    anon_tf_t *addr_tfp = NULL, *port_tfp = NULL;
+
+    if (! pkt) {
+	return;
+    }
+
+    anon_transport_transforms(&addr_tfp, &port_tfp);
+    anon_packet(addr_tfp, port_tfp, pkt);
+}
+
+/*
+ * Anonymize a batch of packets. The transformations for the transport
+ * addresses and ports are looked up once per batch.
+ */
+
+void
+snmp_anon_apply_batch(snmp_packet_t **pkts, size_t n)
+{
+    anon_tf_t *addr_tfp = NULL, *port_tfp = NULL;
+    size_t i;
+
+    if (! n) {
+	return;
+    }
+
+    anon_transport_transforms(&addr_tfp, &port_tfp);
+    for (i = 0; i < n; i++) {
+	anon_packet(addr_tfp, port_tfp, pkts[i]);
+    }
+}
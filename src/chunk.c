@@ -0,0 +1,308 @@
+/*
+ * chunk.c --
+ *
+ * Read a text input file (CSV or XML) through a memory mapping, cut
+ * it into chunks at record boundaries and parse the chunks on several
+ * threads. The decoded messages are passed on in file order.
+ *
+ * Copyright (c) 2006 Juergen Schoenwaelder
+ *
+ * $Id$
+ */
+
+#include "config.h"
+#include "snmp.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+
+/*
+ * The file is cut into chunks of about CHUNK_SIZE bytes. The worker
+ * threads cut and parse chunks as long as no more than CHUNK_AHEAD
+ * chunks per thread wait for delivery, which bounds the memory used
+ * by decoded messages. The calling thread delivers the chunks in
+ * order and releases the pages of a chunk once it is done with it.
+ * The chunk size can be set at build time or with the environment
+ * variable SNMPDUMP_CHUNK_SIZE, which is mostly useful to test the
+ * record boundaries with very small chunks.
+ */
+
+#ifndef CHUNK_SIZE
+#define CHUNK_SIZE	(4 * 1024 * 1024)
+#endif
+#define CHUNK_AHEAD	2
+
+typedef struct _chunk {
+    char		*data;
+    size_t		len;
+    snmp_packet_t	*pkts;		/* decoded messages */
+    size_t		count;
+    size_t		size;		/* size of the pkts array */
+    int			done;
+} chunk_t;
+
+typedef struct _chunk_reader {
+    const snmp_chunk_format_t *format;
+    char		*base;
+    char		*end;
+    char		*next;		/* start of the next chunk */
+    size_t		size;		/* chunk size */
+    chunk_t		*ring;
+    unsigned		window;		/* number of chunks in the ring */
+    unsigned long	cut;		/* chunks cut so far */
+    unsigned long	delivered;	/* chunks delivered so far */
+    pthread_mutex_t	lock;
+    pthread_cond_t	cond;
+} chunk_reader_t;
+
+/*
+ * The callback of the parse functions. The chunk takes over the
+ * memory of the message.
+ */
+
+static void
+chunk_collect(snmp_packet_t *pkt, void *user_data)
+{
+    chunk_t *c = (chunk_t *) user_data;
+
+    if (c->count == c->size) {
+	c->size = c->size ? 2 * c->size : 1024;
+	c->pkts = realloc(c->pkts, c->size * sizeof(snmp_packet_t));
+	if (! c->pkts) {
+	    abort();
+	}
+    }
+    c->pkts[c->count++] = *pkt;
+}
+
+static void*
+chunk_main(void *arg)
+{
+    chunk_reader_t *r = (chunk_reader_t *) arg;
+    chunk_t *c;
+    char *p;
+
+    pthread_mutex_lock(&r->lock);
+    while (1) {
+	while (r->next < r->end && r->cut - r->delivered >= r->window) {
+	    pthread_cond_wait(&r->cond, &r->lock);
+	}
+	if (r->next == r->end) {
+	    break;
+	}
+
+	/* cut the next chunk at the first record boundary */
+	c = &r->ring[r->cut++ % r->window];
+	c->data = r->next;
+	p = (size_t) (r->end - r->next) > r->size
+	    ? r->format->split(r->next + r->size, r->end) : r->end;
+	c->len = p - c->data;
+	r->next = p;
+	pthread_mutex_unlock(&r->lock);
+
+	r->format->parse(c->data, c->len, c->data - r->base,
+			 chunk_collect, c);
+
+	pthread_mutex_lock(&r->lock);
+	c->done = 1;
+	pthread_cond_broadcast(&r->cond);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+/*
+ * Return the chunk size, taken from the environment if it is set to
+ * a valid number of bytes.
+ */
+
+static size_t
+chunk_size(void)
+{
+    const char *s = getenv("SNMPDUMP_CHUNK_SIZE");
+    unsigned long ul;
+    char *end;
+
+    if (s) {
+	ul = strtoul(s, &end, 10);
+	if (*s && ! *end && ul > 0) {
+	    return ul;
+	}
+	fprintf(stderr, "%s: ignoring invalid chunk size: %s\n",
+		progname, s);
+    }
+    return CHUNK_SIZE;
+}
+
+/*
+ * Pass the messages of a chunk to the callbacks and release them.
+ */
+
+static void
+chunk_deliver(chunk_reader_t *r, chunk_t *c, snmp_callback func,
+	      snmp_batch_callback batch_func, void *user_data)
+{
+    snmp_packet_t *pkts[SNMP_BATCH_SIZE];
+    size_t i, j, n;
+
+    if (batch_func) {
+	for (i = 0; i < c->count; i += n) {
+	    n = c->count - i;
+	    if (n > SNMP_BATCH_SIZE) {
+		n = SNMP_BATCH_SIZE;
+	    }
+	    for (j = 0; j < n; j++) {
+		pkts[j] = &c->pkts[i + j];
+	    }
+	    batch_func(pkts, n, user_data);
+	}
+    } else if (func) {
+	for (i = 0; i < c->count; i++) {
+	    func(&c->pkts[i], user_data);
+	}
+    }
+    for (i = 0; i < c->count; i++) {
+	r->format->release(&c->pkts[i]);
+    }
+    c->count = 0;
+}
+
+/*
+ * Read a file in chunks using jobs threads. Returns -1 without having
+ * read anything if the file cannot be mapped, for example because it
+ * is compressed or not a regular file. The mapping is private and
+ * writable since the parse functions terminate tokens in place.
+ */
+
+int
+snmp_chunk_read_file(const char *file, unsigned jobs,
+		     const snmp_chunk_format_t *format,
+		     snmp_callback func, snmp_batch_callback batch_func,
+		     void *user_data)
+{
+    chunk_reader_t _r, *r = &_r;
+    pthread_t *threads;
+    struct stat st;
+    chunk_t *c;
+    char *released, *p;
+    size_t size, page;
+    unsigned long i;
+    unsigned t;
+    int fd, rc, last;
+
+    assert(file && format && jobs > 0);
+
+    fd = open(file, O_RDONLY);
+    if (fd == -1) {
+	return -1;
+    }
+    if (fstat(fd, &st) == -1 || ! S_ISREG(st.st_mode) || st.st_size == 0) {
+	close(fd);
+	return -1;
+    }
+    size = st.st_size;
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+	return -1;
+    }
+    if (snmp_zio_compressed(p, size)) {
+	munmap(p, size);
+	return -1;
+    }
+
+    memset(r, 0, sizeof(*r));
+    r->format = format;
+    r->base = r->next = p;
+    r->end = p + size;
+    r->size = chunk_size();
+    r->window = CHUNK_AHEAD * jobs;
+    r->ring = calloc(r->window, sizeof(chunk_t));
+    threads = calloc(jobs, sizeof(pthread_t));
+    if (! r->ring || ! threads) {
+	abort();
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+
+    (void) madvise(r->base, size, MADV_SEQUENTIAL);
+
+    for (t = 0; t < jobs; t++) {
+	rc = pthread_create(&threads[t], NULL, chunk_main, r);
+	if (rc) {
+	    fprintf(stderr, "%s: failed to create thread: %s\n",
+		    progname, strerror(rc));
+	    exit(1);
+	}
+    }
+
+    page = sysconf(_SC_PAGESIZE);
+    released = r->base;
+    for (i = 0; ; i++) {
+	c = &r->ring[i % r->window];
+	pthread_mutex_lock(&r->lock);
+	while ((i == r->cut && r->next < r->end)
+	       || (i < r->cut && ! c->done)) {
+	    pthread_cond_wait(&r->cond, &r->lock);
+	}
+	last = (i == r->cut);
+	pthread_mutex_unlock(&r->lock);
+	if (last) {
+	    break;
+	}
+
+	chunk_deliver(r, c, func, batch_func, user_data);
+
+	/* drop the pages (and our private copies) behind us */
+	p = r->base + ((c->data + c->len - r->base) / page) * page;
+	if (p > released) {
+	    (void) madvise(released, p - released, MADV_DONTNEED);
+	    released = p;
+	}
+
+	pthread_mutex_lock(&r->lock);
+	c->done = 0;
+	r->delivered++;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+    }
+
+    for (t = 0; t < jobs; t++) {
+	pthread_join(threads[t], NULL);
+    }
+    for (t = 0; t < r->window; t++) {
+	free(r->ring[t].pkts);
+    }
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->cond);
+    free(threads);
+    free(r->ring);
+    munmap(r->base, size);
+    return 0;
+}
+
+#else
+
+int
+snmp_chunk_read_file(const char *file, unsigned jobs,
+		     const snmp_chunk_format_t *format,
+		     snmp_callback func, snmp_batch_callback batch_func,
+		     void *user_data)
+{
+    return -1;
+}
+
+#endif
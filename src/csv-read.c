@@ -24,6 +24,9 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+static snmp_decode_t skip = SNMP_DECODE_ALL;	/* fields we do not decode */
+static unsigned jobs = 1;		/* threads parsing a file */
+
 static inline void*
 xmalloc(size_t size)
 {
@@ -38,24 +41,25 @@ xmalloc(size_t size)
 }
 
 /*
- * tokenizes s using delim, modifies s
- * return also empty strings for successive token, as opposed to strtok
+ * Return the next field of a line and move *s behind it. The line ends
+ * with a NUL at end. The comma is located with memchr(), which the C
+ * library implements with vector instructions. Once the line is
+ * exhausted, empty fields are returned.
  */
-static  char*
-mytok(char **s, char* delim)
-{
-    char *c;
-    char* str;
-    str = *s;
 
-    if (! *s) return NULL; /* end of string s */
+static inline char*
+csv_field(char **s, char *end)
+{
+    char *f = *s, *c;
 
-    for(c=*s;**s && !strchr(delim, **s);(*s)++);
-    if (**s) {
-	**s = '\0';
-	(*s)++;
+    c = memchr(f, ',', end - f);
+    if (c) {
+	*c = '\0';
+	*s = c + 1;
+    } else {
+	*s = end;
     }
-    return c;
+    return f;
 }
 
 /*
@@ -80,12 +84,10 @@ snmp_free(snmp_packet_t *pkt)
 	    }
 	    break;
 	case SNMP_TYPE_OCTS:
-	    if (varbind->value.octs.value) {
-		free(varbind->value.octs.value);
-	    }
-	    break;
 	case SNMP_TYPE_OPAQUE:
-	    if (varbind->value.octs.value) {
+	    /* octet strings usually point into the input buffer */
+	    if (varbind->value.octs.value
+		&& varbind->value.octs.attr.flags & SNMP_FLAG_DYNAMIC) {
 		free(varbind->value.octs.value);
 	    }
 	    break;
@@ -98,13 +100,36 @@ snmp_free(snmp_packet_t *pkt)
     }
 }
 
+/*
+ * Convert the decimal digits at the start of s. Returns a pointer
+ * behind the digits or NULL if there are none. Like the casts of the
+ * strtoul() results we used before, values wrap around if they are
+ * too large.
+ */
+
+static inline char*
+csv_scan_uint32(char *s, uint32_t *value)
+{
+    uint32_t v = 0;
+    char *p;
+
+    for (p = s; (unsigned) (*p - '0') < 10; p++) {
+	v = v * 10 + (*p - '0');
+    }
+    *value = v;
+    return (p == s) ? NULL : p;
+}
+
 static void
 csv_read_int32(char *s, snmp_int32_t *v)
 {
+    uint32_t u;
     char *end;
+    int neg = (*s == '-');
 
-    v->value = (int32_t) strtol(s, &end, 10);
-    if (*end == '\0' && *s != '\0') {
+    end = csv_scan_uint32(s + neg, &u);
+    v->value = (int32_t) (neg ? 0 - u : u);
+    if (end && *end == '\0') {
 	v->attr.flags |= SNMP_FLAG_VALUE;
     }
 }
@@ -114,8 +139,8 @@ csv_read_uint32(char *s, snmp_uint32_t *v)
 {
     char *end;
 
-    v->value = (uint32_t) strtoul(s, &end, 10);
-    if (*end == '\0' && *s != '\0') {
+    end = csv_scan_uint32(s, &v->value);
+    if (end && *end == '\0') {
 	v->attr.flags |= SNMP_FLAG_VALUE;
     }
 }
@@ -123,20 +148,44 @@ csv_read_uint32(char *s, snmp_uint32_t *v)
 static void
 csv_read_uint64(char *s, snmp_uint64_t *v)
 {
-    char *end;
+    uint64_t u = 0;
+    char *p;
 
-    v->value = (uint64_t) strtoull(s, &end, 10);
-    if (*end == '\0' && *s != '\0') {
+    for (p = s; (unsigned) (*p - '0') < 10; p++) {
+	u = u * 10 + (*p - '0');
+    }
+    v->value = u;
+    if (*p == '\0' && p != s) {
 	v->attr.flags |= SNMP_FLAG_VALUE;
     }
 }
 
+/*
+ * Convert a dotted-quad IPv4 address. Like inet_pton(), we do not
+ * accept leading zeros.
+ */
+
 static void
 csv_read_ipaddr(char *s, snmp_ipaddr_t *v)
 {
-    if (inet_pton(AF_INET, s, &(v->value)) > 0) {
-	v->attr.flags |= SNMP_FLAG_VALUE;
+    unsigned char a[4];
+    uint32_t n;
+    char *p = s, *q;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+	q = csv_scan_uint32(p, &n);
+	if (! q || q - p > 3 || n > 255 || (*p == '0' && q - p > 1)) {
+	    return;
+	}
+	if (*q != (i < 3 ? '.' : '\0')) {
+	    return;
+	}
+	a[i] = n;
+	p = q + 1;
     }
+    memcpy(&v->value, a, sizeof(a));
+    v->attr.flags |= SNMP_FLAG_VALUE;
 }
 
 static void
@@ -210,250 +259,233 @@ csv_read_oid(char *s, snmp_oid_t *v) {
 	v->value = xmalloc(sizeof(uint32_t)*count);
 	v->len = count;
 
-	v->value[0] = (uint32_t) strtoul((const char *) s, &end, 10);
-	if (*end == '\0' || *end == '.') {
-	    if (!(v->value[0] >= 0 && v->value[0] <= 2)) {
-		fprintf(stderr, "%s: warning: oid first value %d should be"
-			"in  0..2\n", progname, v->value[0]);
+	for (i = 0; i < count; i++) {
+	    end = csv_scan_uint32(s, &v->value[i]);
+	    if (! end || *end != (i < count - 1 ? '.' : '\0')) {
+		return;
 	    }
+	    s = end + 1;
 	}
-	for(i=1;i<count && *end == '.';i++) {
-	    s = end+1;
-	    v->value[i] = (uint32_t) strtoul((const char *) s, &end, 10);
-	}
-	
-	if (*end == '\0' && *s != '\0') {
-	    v->attr.flags |= SNMP_FLAG_VALUE;
+	if (v->value[0] > 2) {
+	    fprintf(stderr, "%s: warning: oid first value %d should be"
+		    "in  0..2\n", progname, v->value[0]);
 	}
+	v->attr.flags |= SNMP_FLAG_VALUE;
     }
 }
 
-/* helper function for dehexify */
-static int
-char_to_i(char c){
-    int n = c;
-    if (n >= '0' && n <= '9') {
-	n -= '0';
-    } else if (n >= 'a' && n <= 'f') {
-	n -= 'a' - 10;
-    } else if (n >= 'A' && n <= 'F') {
-	n -= 'A' - 10;
-    } else {
-	n = -1;
+/*
+ * Convert the pairs of hex digits of an octet string in place. The
+ * value points into the input buffer and is only valid as long as
+ * the buffer is, see csv_own_octs().
+ */
+
+static void
+csv_read_octs(char* s, snmp_octs_t* v)
+{
+    unsigned char *buffer = (unsigned char *) s;
+    size_t len = strlen(s);
+
+    /* octet string implies pairs of hex numbers */
+    if (len == 0 || len % 2 || snmp_hex_decode(buffer, s, len / 2) < 0) {
+	return;
     }
-    return n;
+    v->value = buffer;
+    v->len = len / 2;
+    v->attr.flags |= SNMP_FLAG_VALUE;
 }
 
 /*
- * convert octet string into string (i.e. csv -> pcap)
- * fills in length
- * returned buffer is NOT null-terminated and may contain \0 at any position
- * user has to deallocate returned buffer
+ * Give the octet strings of a message their own memory when the
+ * buffer they point into goes away before the message is released.
  */
-static unsigned char*
-dehexify(const char *str, unsigned *length) {
-    static size_t size = 0; /* buffer size, i.e. length of output 
-			     * which is strlen(str)/2
-			     */
-    static unsigned char *buffer = NULL;
-    int i;
-    int tmp, tmp2;
-    
-    if (strlen(str)%2 != 0 || strlen(str) == 0) {
-	/* octet string implies pairs of hex numbers */
-	return NULL;
-    }
-    size = strlen(str)/2;
-    assert(size);
-    buffer = xmalloc(size);
-    for (i = 0; i < size; i++) {
-	tmp = char_to_i(str[2*i]);
-	tmp2 = char_to_i(str[2*i+1]);
-	if (tmp < 0 || tmp2 < 0) {
-	    /* encountered invalid character */
-	    free(buffer);
-	    return NULL;
-	}
-	buffer[i] = tmp*16 + tmp2;
-    }
-    *length = size;
-    return buffer;
-}
 
 static void
-csv_read_octs(char* s, snmp_octs_t* v)
+csv_own_octs(snmp_packet_t *pkt)
 {
-    v->value = dehexify(s, &v->len);
-    if (v->value) v->attr.flags |= SNMP_FLAG_VALUE;
+    snmp_varbind_t *vb;
+    unsigned char *value;
+
+    for (vb = pkt->snmp.scoped_pdu.pdu.varbindings.varbind;
+	 vb; vb = vb->next) {
+	if ((vb->type == SNMP_TYPE_OCTS || vb->type == SNMP_TYPE_OPAQUE)
+	    && vb->value.octs.value) {
+	    value = xmalloc(vb->value.octs.len);
+	    memcpy(value, vb->value.octs.value, vb->value.octs.len);
+	    vb->value.octs.value = value;
+	    vb->value.octs.attr.flags |= SNMP_FLAG_DYNAMIC;
+	}
+    }
 }
 
 static void
-csv_read_varbind(char **s, snmp_varbind_t *v)
+csv_read_varbind(char **s, char *end, snmp_varbind_t *v)
 {
     char *oid;
     char *type;
     char *value;
     
     //fprintf(stdout, "s: %s\n", *s);
-    oid = mytok(s, ",");
-    if (! oid) return;
-    csv_read_oid(oid, &v->name);
-
-    type = mytok(s, ",");
-    if (! type) return;
-    value = mytok(s, ",");
-    if (! value) return;
+    oid = csv_field(s, end);
+    if (! (skip & SNMP_SKIP_NAMES)) {
+	csv_read_oid(oid, &v->name);
+    }
+
+    type = csv_field(s, end);
+    value = csv_field(s, end);
     //fprintf(stdout, "varbind: %s,%s,%s\n", oid, type, value);
     if (strcmp(type, "null") == 0) {
 	v->type = SNMP_TYPE_NULL;
-	v->attr.flags |= SNMP_FLAG_VALUE;
     } else if (strcmp(type, "integer32") == 0) {
 	v->type = SNMP_TYPE_INT32;
-	v->attr.flags |= SNMP_FLAG_VALUE;
-	csv_read_int32(value, &v->value.i32);
     } else if (strcmp(type, "unsigned32") == 0) {
 	v->type = SNMP_TYPE_UINT32;
-	v->attr.flags |= SNMP_FLAG_VALUE;
-	csv_read_uint32(value, &v->value.u32);
     } else if (strcmp(type, "counter32") == 0) {
 	v->type = SNMP_TYPE_COUNTER32;
-	v->attr.flags |= SNMP_FLAG_VALUE;
-	csv_read_uint32(value, &v->value.u32);
     } else if (strcmp(type, "timeticks") == 0) {
 	v->type = SNMP_TYPE_TIMETICKS;
-	v->attr.flags |= SNMP_FLAG_VALUE;
-	csv_read_uint32(value, &v->value.u32);
     } else if (strcmp(type, "counter64") == 0
 	|| strcmp(type, "unsigned64") == 0) {
 	v->type = SNMP_TYPE_COUNTER64;
-	v->attr.flags |= SNMP_FLAG_VALUE;
-	csv_read_uint64(value, &v->value.u64);
     } else if (strcmp(type, "ipaddress") == 0) {
 	v->type = SNMP_TYPE_IPADDR;
-	v->attr.flags |= SNMP_FLAG_VALUE;
-	csv_read_ipaddr(value, &v->value.ip);
     } else if (strcmp(type, "octet-string") == 0) {
 	v->type = SNMP_TYPE_OCTS;
-	v->attr.flags |= SNMP_FLAG_VALUE;
-	csv_read_octs(value, &v->value.octs);
     } else if (strcmp(type, "object-identifier") == 0) {
 	v->type = SNMP_TYPE_OID;
-	v->attr.flags |= SNMP_FLAG_VALUE;
-	csv_read_oid(value, &v->value.oid);
     } else if (strcmp(type, "opaque") == 0) {
 	v->type = SNMP_TYPE_OPAQUE;
-	v->attr.flags |= SNMP_FLAG_VALUE;
-	csv_read_octs(value, &v->value.octs);
     } else if (strcmp(type, "no-such-object") == 0) {
 	v->type = SNMP_TYPE_NO_SUCH_OBJ;
-	v->attr.flags |= SNMP_FLAG_VALUE;
     } else if (strcmp(type, "no-such-instance") == 0) {
 	v->type = SNMP_TYPE_NO_SUCH_INST;
-	v->attr.flags |= SNMP_FLAG_VALUE;
     } else if (strcmp(type, "end-of-mib-view") == 0) {
 	v->type = SNMP_TYPE_END_MIB_VIEW;
-	v->attr.flags |= SNMP_FLAG_VALUE;
     } else if (*type == '\0') {
 	v->attr.flags &= ~SNMP_FLAG_VALUE;
+	return;
     } else {
 	fprintf(stderr, "%s: unknown varbind type: '%s'\n", progname, type);
+	return;
+    }
+    v->attr.flags |= SNMP_FLAG_VALUE;
+
+    if (snmp_skip_value(skip, v->type)) {
+	return;
+    }
+
+    switch (v->type) {
+    case SNMP_TYPE_INT32:
+	csv_read_int32(value, &v->value.i32);
+	break;
+    case SNMP_TYPE_UINT32:
+    case SNMP_TYPE_COUNTER32:
+    case SNMP_TYPE_TIMETICKS:
+	csv_read_uint32(value, &v->value.u32);
+	break;
+    case SNMP_TYPE_COUNTER64:
+	csv_read_uint64(value, &v->value.u64);
+	break;
+    case SNMP_TYPE_IPADDR:
+	csv_read_ipaddr(value, &v->value.ip);
+	break;
+    case SNMP_TYPE_OCTS:
+    case SNMP_TYPE_OPAQUE:
+	csv_read_octs(value, &v->value.octs);
+	break;
+    case SNMP_TYPE_OID:
+	csv_read_oid(value, &v->value.oid);
+	break;
+    default:
+	break;
     }
 }
 
-static void
-parse(char *line, snmp_callback func, void *user_data)
+/*
+ * Parse a CSV record, which ends with a NUL at end, into the given
+ * packet. Returns 1 if the packet was filled in and must be released
+ * with snmp_free() and 0 if the record was ignored. Octet string
+ * values point into the line.
+ */
+
+static int
+parse(char *line, char *end, snmp_packet_t *pkt)
 {
-    snmp_packet_t _pkt, *pkt = &_pkt;
     char *token;
     snmp_int32_t i32;
-    int len;
-    char *end;
     int varbind_count;
     int i;
-    char *c;
 
     memset(pkt, 0, sizeof(snmp_packet_t));
 
-    /* cut string at first newline (marks the end of a CSV record */
-    for (c=line; *c; c++) {
-	if (*c == '\n') {
-	    *c = '\0';
-	    break;
-	}
-    }
-
-    
     /* xxx won't work if there is no time stamp in the input */
 
-    if (2 != sscanf(line, "%u.%u,%n",
-		    &pkt->time_sec.value, &pkt->time_usec.value, &len)) {
+    token = csv_scan_uint32(line, &pkt->time_sec.value);
+    if (token && *token == '.') {
+	token = csv_scan_uint32(token + 1, &pkt->time_usec.value);
+    } else {
+	token = NULL;
+    }
+    if (! token) {
 	fprintf(stderr, "%s: parsing time stamp failed - ignoring line\n",
 		progname);
-	return;
+	return 0;
     }
     pkt->time_sec.attr.flags |= SNMP_FLAG_VALUE;
     pkt->time_usec.attr.flags |= SNMP_FLAG_VALUE;
-    line += len;
+    line = (*token == ',') ? token + 1 : token;
 
-    token = mytok(&line, ",");
-    if (! token) goto cleanup;
+    token = csv_field(&line, end);
     csv_read_ipaddr(token, &pkt->src_addr);
     if (! pkt->src_addr.attr.flags & SNMP_FLAG_VALUE) {
 	csv_read_ip6addr(token, &pkt->src_addr6);
     }
     
-    token = mytok(&line, ",");
-    if (! token) goto cleanup;
+    token = csv_field(&line, end);
     csv_read_uint32(token, &pkt->src_port);
     
-    token = mytok(&line, ",");
-    if (! token) goto cleanup;
+    token = csv_field(&line, end);
     csv_read_ipaddr(token, &pkt->dst_addr);
     if (! pkt->dst_addr.attr.flags & SNMP_FLAG_VALUE) {
 	csv_read_ip6addr(token, &pkt->dst_addr6);
     }
     
-    token = mytok(&line, ",");
-    if (! token) goto cleanup;
+    token = csv_field(&line, end);
     csv_read_uint32(token, &pkt->dst_port);
 
-    token = mytok(&line, ",");
-    if (! token) goto cleanup;
-    pkt->snmp.attr.blen = strtol(token, &end, 10);
-    if (*end == '\0' && *token != '\0') {
+    token = csv_field(&line, end);
+    i32.attr.flags = 0;
+    csv_read_int32(token, &i32);
+    pkt->snmp.attr.blen = i32.value;
+    if (i32.attr.flags & SNMP_FLAG_VALUE) {
 	pkt->snmp.attr.flags |= SNMP_FLAG_BLEN;
     }
 
     pkt->attr.flags |= SNMP_FLAG_VALUE;
 
-    token = mytok(&line, ",");
-    if (! token) goto cleanup;
+    token = csv_field(&line, end);
     csv_read_int32(token, &pkt->snmp.version);
     if (pkt->snmp.version.attr.flags & SNMP_FLAG_VALUE) {
 	pkt->snmp.attr.flags |= SNMP_FLAG_VALUE;
     }
 
-    token = mytok(&line, ",");
-    if (! token) goto cleanup;
+    token = csv_field(&line, end);
     csv_read_type(token, &pkt->snmp.scoped_pdu.pdu);
     if (pkt->snmp.scoped_pdu.pdu.attr.flags & SNMP_FLAG_VALUE) {
 	pkt->snmp.attr.flags |= SNMP_FLAG_VALUE;
     }
 
-    token = mytok(&line, ",");
-    if (! token) goto cleanup;
+    token = csv_field(&line, end);
     csv_read_int32(token, &pkt->snmp.scoped_pdu.pdu.req_id);
 
-    token = mytok(&line, ",");
-    if (! token) goto cleanup;
+    token = csv_field(&line, end);
     csv_read_int32(token, &pkt->snmp.scoped_pdu.pdu.err_status);
 
-    token = mytok(&line, ",");
-    if (! token) goto cleanup;
+    token = csv_field(&line, end);
     csv_read_int32(token, &pkt->snmp.scoped_pdu.pdu.err_index);
     
-    token = mytok(&line, ",");
-    if (! token) goto cleanup;
+    token = csv_field(&line, end);
+    i32.attr.flags = 0;
     csv_read_int32(token, &i32);
     varbind_count = i32.value;
     if (!(i32.attr.flags & SNMP_FLAG_VALUE)) {
@@ -465,6 +497,9 @@ parse(char *line, snmp_callback func, void *user_data)
     varbindlist = &pkt->snmp.scoped_pdu.pdu.varbindings;
     
     varbindlist->attr.flags |= SNMP_FLAG_VALUE; /* even if zero varbinds */
+    if (skip & SNMP_SKIP_VARBINDS) {
+	varbind_count = 0;
+    }
     
     for (i=0; i<varbind_count; i++) {
 	p = xmalloc(sizeof(snmp_varbind_t));
@@ -474,15 +509,164 @@ parse(char *line, snmp_callback func, void *user_data)
 	    q->next = p;
 	}
 	q = p;
-	csv_read_varbind(&line, p);
+	csv_read_varbind(&line, end, p);
     }
 
-    if (func) {
-	func(pkt, user_data);
+    return 1;
+}
+
+/*
+ * Set how much of a message is decoded by subsequent calls of the
+ * reader functions.
+ */
+
+void
+snmp_csv_set_decode(snmp_decode_t decode)
+{
+    skip = decode;
+}
+
+/*
+ * Parse files in chunks using the given number of threads.
+ */
+
+void
+snmp_csv_set_jobs(unsigned n)
+{
+    jobs = n;
+}
+
+/*
+ * The chunk reader functions. Records end at a newline, which is
+ * replaced by the terminating NUL. The last record of a file may not
+ * have a newline and is copied since there is no room for the NUL.
+ * The mapping stays valid until the messages have been delivered.
+ */
+
+static char*
+csv_chunk_split(char *p, char *end)
+{
+    char *nl;
+
+    nl = memchr(p, '\n', end - p);
+    return nl ? nl + 1 : end;
+}
+
+static void
+csv_chunk_parse(char *data, size_t len, size_t offset,
+		snmp_callback func, void *user_data)
+{
+    char *p, *end, *nl, *line;
+    snmp_packet_t pkt;
+
+    for (p = data, end = data + len; p < end; p = nl + 1) {
+	nl = memchr(p, '\n', end - p);
+	if (nl) {
+	    *nl = '\0';
+	    if (parse(p, nl, &pkt)) {
+		func(&pkt, user_data);
+	    }
+	} else {
+	    line = xmalloc(end - p + 1);
+	    memcpy(line, p, end - p);
+	    if (parse(line, line + (end - p), &pkt)) {
+		csv_own_octs(&pkt);
+		func(&pkt, user_data);
+	    }
+	    free(line);
+	    break;
+	}
+    }
+}
+
+static const snmp_chunk_format_t csv_chunk_format = {
+    csv_chunk_split, csv_chunk_parse, snmp_free
+};
+
+/*
+ * The stream readers read the input in large blocks and hand out the
+ * lines in place. Lines are not limited in length; the buffer grows
+ * if a line does not fit.
+ */
+
+#define CSV_CHUNK	(1024 * 1024)
+
+typedef struct _csv_input {
+    FILE	*stream;
+    char	*buf;
+    size_t	size;		/* size of the buffer */
+    size_t	len;		/* number of bytes in the buffer */
+    size_t	pos;		/* start of the next line */
+    int		eof;
+} csv_input_t;
+
+static void
+csv_input_init(csv_input_t *in, FILE *stream)
+{
+    memset(in, 0, sizeof(*in));
+    in->stream = stream;
+    in->size = CSV_CHUNK;
+    in->buf = xmalloc(in->size);
+}
+
+/*
+ * Move the incomplete line at the end of the buffer to the front and
+ * append more input. One byte is kept free to terminate a last line
+ * without a newline. Returns 0 once all lines have been handed out.
+ * Lines handed out before are invalid afterwards.
+ */
+
+static int
+csv_fill(csv_input_t *in)
+{
+    size_t n;
+
+    if (in->eof) {
+	return 0;
+    }
+    if (in->pos) {
+	memmove(in->buf, in->buf + in->pos, in->len - in->pos);
+	in->len -= in->pos;
+	in->pos = 0;
+    }
+    if (in->len > in->size / 2) {
+	in->size *= 2;
+	in->buf = realloc(in->buf, in->size);
+	if (! in->buf) {
+	    abort();
+	}
     }
+    n = fread(in->buf + in->len, 1, in->size - in->len - 1, in->stream);
+    if (n == 0) {
+	in->eof = 1;
+	return in->len > 0;
+    }
+    in->len += n;
+    return 1;
+}
 
-    cleanup:
-    snmp_free(pkt);
+/*
+ * Return the next complete line in the buffer and set *end to the NUL
+ * which replaces its newline. Returns NULL if the buffer has to be
+ * refilled.
+ */
+
+static inline char*
+csv_line(csv_input_t *in, char **end)
+{
+    char *line = in->buf + in->pos, *nl;
+
+    nl = memchr(line, '\n', in->len - in->pos);
+    if (! nl) {
+	if (! in->eof || in->pos == in->len) {
+	    return NULL;
+	}
+	nl = in->buf + in->len;
+    }
+    *nl = '\0';
+    in->pos = nl - in->buf + (nl < in->buf + in->len);
+    *end = nl;
+    return line;
 }
 
 void
@@ -492,10 +676,13 @@ snmp_csv_read_file(const char *file, snmp_callback func, void *user_data)
 
     assert(file);
 
-    stream = fopen(file, "r");
+    if (jobs > 1 && snmp_chunk_read_file(file, jobs, &csv_chunk_format,
+					 func, NULL, user_data) == 0) {
+	return;
+    }
+
+    stream = snmp_zio_open(file);
     if (! stream) {
-	fprintf(stderr, "%s: failed to open CSV file '%s': %s\n",
-		progname, file, strerror(errno));
 	return;
     }
 
@@ -507,12 +694,90 @@ snmp_csv_read_file(const char *file, snmp_callback func, void *user_data)
 void
 snmp_csv_read_stream(FILE *stream, snmp_callback func, void *user_data)
 {
-    char buffer[123456];
+    csv_input_t in;
+    snmp_packet_t pkt;
+    char *line, *end;
 
     assert(stream);
 
-    while (fgets(buffer, sizeof(buffer), stream)) {
-	parse(buffer, func, user_data);
+    csv_input_init(&in, stream);
+    while (csv_fill(&in)) {
+	while ((line = csv_line(&in, &end))) {
+	    if (parse(line, end, &pkt)) {
+		if (func) {
+		    func(&pkt, user_data);
+		}
+		snmp_free(&pkt);
+	    }
+	}
     }
+    free(in.buf);
+}
+
+void
+snmp_csv_read_file_batch(const char *file,
+			 snmp_batch_callback func, void *user_data)
+{
+    FILE *stream;
+
+    assert(file);
+
+    if (jobs > 1 && snmp_chunk_read_file(file, jobs, &csv_chunk_format,
+					 NULL, func, user_data) == 0) {
+	return;
+    }
+
+    stream = snmp_zio_open(file);
+    if (! stream) {
+	return;
+    }
+
+    snmp_csv_read_stream_batch(stream, func, user_data);
+
+    fclose(stream);
+}
+
+void
+snmp_csv_read_stream_batch(FILE *stream,
+			   snmp_batch_callback func, void *user_data)
+{
+    csv_input_t in;
+    snmp_packet_t *batch, *pkts[SNMP_BATCH_SIZE];
+    char *line, *end;
+    size_t i, n = 0;
+
+    assert(stream);
+
+    batch = xmalloc(SNMP_BATCH_SIZE * sizeof(snmp_packet_t));
+
+    /*
+     * The messages point into the buffer, so the batch is passed on
+     * before the buffer is refilled, even if it is not full yet.
+     */
+
+    csv_input_init(&in, stream);
+    while (csv_fill(&in)) {
+	do {
+	    line = csv_line(&in, &end);
+	    if (line && parse(line, end, &batch[n])) {
+		n++;
+	    }
+	    if (n == SNMP_BATCH_SIZE || (! line && n)) {
+		for (i = 0; i < n; i++) {
+		    pkts[i] = &batch[i];
+		}
+		if (func) {
+		    func(pkts, n, user_data);
+		}
+		for (i = 0; i < n; i++) {
+		    snmp_free(&batch[i]);
+		}
+		n = 0;
+	    }
+	} while (line);
+    }
+
+    free(in.buf);
+    free(batch);
 }
 
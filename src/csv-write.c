@@ -93,13 +93,9 @@ csv_write_ip6addr(FILE *stream, snmp_ip6addr_t *v)
 static void
 csv_write_octs(FILE *stream, snmp_octs_t *v)
 {
-    int i;
-    
     if (v->attr.flags & SNMP_FLAG_VALUE) {
 	fprintf(stream, "%c", sep);
-	for (i = 0; i < v->len; i++) {
-	    fprintf(stream, "%.2x", v->value[i]);
-	}
+	snmp_hex_write(stream, v->value, v->len);
     } else {
 	fprintf(stream, "%c", sep);
     }
@@ -316,6 +312,20 @@ snmp_csv_write_stream_pkt(FILE *stream, snmp_packet_t *pkt)
     fprintf(stream, "\n");
 }
 
+/*
+ * Write a batch of packets.
+ */
+
+void
+snmp_csv_write_stream_pkts(FILE *stream, snmp_packet_t **pkts, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+	snmp_csv_write_stream_pkt(stream, pkts[i]);
+    }
+}
+
 void
 snmp_csv_write_stream_new(FILE *stream)
 {
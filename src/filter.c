@@ -78,7 +78,7 @@
 #define FLT_MAX			57
 
 struct _snmp_filter {
-    char hide[FLT_MAX];
+    char hide[FLT_MAX + 1];
 };
 
 static struct {
@@ -343,6 +343,9 @@ filter_pdu(snmp_filter_t *filter, snmp_pdu_t *pdu)
 	    filter_octs(filter, FLT_OCTET_STRING, &vb->value.octs);
 	    filter_octs(filter, FLT_VALUE, &vb->value.octs);
 	    break;
+	case SNMP_TYPE_OPAQUE:
+	    filter_octs(filter, FLT_VALUE, &vb->value.octs);
+	    break;
 	case SNMP_TYPE_OID:
 	    filter_oid(filter, FLT_OBJECT_IDENTIFIER, &vb->value.oid);
 	    filter_oid(filter, FLT_VALUE, &vb->value.oid);
@@ -423,6 +426,63 @@ snmp_filter_apply(snmp_filter_t *filter, snmp_packet_t *pkt)
     filter_pdu(filter, &pkt->snmp.scoped_pdu.pdu);
 }
 
+/*
+ * Apply the filter to a batch of packets.
+ */
+
+void
+snmp_filter_apply_batch(snmp_filter_t *filter, snmp_packet_t **pkts, size_t n)
+{
+    size_t i;
+
+    if (! filter) {
+	return;
+    }
+
+    for (i = 0; i < n; i++) {
+	snmp_filter_apply(filter, pkts[i]);
+    }
+}
+
+/*
+ * Tell the readers how much of a message survives the filter. There
+ * is no point in decoding fields that are hidden anyway.
+ */
+
+snmp_decode_t
+snmp_filter_decode(snmp_filter_t *filter)
+{
+    snmp_decode_t skip = SNMP_DECODE_ALL;
+
+    if (! filter) {
+	return 0;
+    }
+
+    if (filter->hide[FLT_VARBINDLIST]) {
+	skip |= SNMP_DECODE_PDU;
+    }
+    if (filter->hide[FLT_NAME]) {
+	skip |= SNMP_SKIP_NAMES;
+    }
+    if (filter->hide[FLT_VARBIND] || filter->hide[FLT_VALUE]) {
+	skip |= SNMP_DECODE_NAMES;
+    }
+    if (filter->hide[FLT_OCTET_STRING]) {
+	skip |= SNMP_SKIP_OCTS;
+    }
+    if (filter->hide[FLT_OBJECT_IDENTIFIER]) {
+	skip |= SNMP_SKIP_OIDS;
+    }
+    if (filter->hide[FLT_COMMUNITY]) {
+	skip |= SNMP_SKIP_COMMUNITY;
+    }
+    if (filter->hide[FLT_ENTERPRISE]) {
+	skip |= SNMP_SKIP_ENTERPRISE;
+    }
+
+    return skip;
+}
+
 void
 snmp_filter_delete(snmp_filter_t *filter)
 {
@@ -18,6 +18,7 @@
 #include <string.h>
 #include <inttypes.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -69,52 +70,230 @@ typedef struct _snmp_flow_elem {
 } snmp_flow_elem;
 #endif
 
+/*
+ * Every flow or slice writes its packets into a file of its own. The
+ * output is first collected in a memory buffer and written to the
+ * file in large chunks. The files that are currently open are kept
+ * on a doubly linked LRU list so that we can close the least recently
+ * used file in constant time when we run out of file descriptors.
+ */
+
+typedef struct _snmp_file {
+    char		*name;
+    const char		*kind;		/* "flow" or "slice" */
+    uint64_t		cnt;
+    FILE		*stream;
+    struct _snmp_file	*lru_prev;
+    struct _snmp_file	*lru_next;
+    char		*buf;
+    size_t		buf_len;
+    size_t		buf_size;
+    unsigned long	heap_pos;	/* 0 if not on the buffer heap */
+} snmp_file_t;
+
 typedef struct _snmp_flow {
     unsigned		id;
     int			type;
-    char		*name;
+    snmp_file_t		file;
     snmp_ipaddr_t       src_addr;
     snmp_ip6addr_t      src_addr6;
     snmp_uint32_t	src_port;
     snmp_ipaddr_t       dst_addr;
     snmp_ip6addr_t      dst_addr6;
     snmp_uint32_t	dst_port;
-    uint64_t		cnt;
-    FILE		*stream;
+    uint32_t		hash;
     struct _snmp_flow	*next;
 } snmp_flow_t;
 
-static snmp_flow_t *flow_list = NULL;
+static __thread snmp_flow_t *flow_list = NULL;
+
+/*
+ * Flows are indexed by an open addressing hash table (linear probing)
+ * keyed on the flow type, the address family and the addresses of
+ * the two endpoints. Every slot caches the hash value so that most
+ * collisions are resolved without touching the flow itself. The
+ * table is never more than half full. The flow_list is kept since we
+ * need to visit all flows when we are done.
+ */
+
+typedef struct _snmp_flow_slot {
+    uint32_t		hash;
+    snmp_flow_t		*flow;
+} snmp_flow_slot_t;
+
+static __thread snmp_flow_slot_t *flow_table = NULL;
+static __thread uint32_t flow_table_size = 0;
+static __thread uint32_t flow_table_used = 0;
+
+#define FLOW_TABLE_MIN_SIZE	1024
+
+/*
+ * Keys identifying the addresses and ports of two endpoints plus an
+ * id (a request id or a slice type). IPv4 addresses are stored in
+ * the first four bytes of the address fields.
+ */
+
+typedef struct _snmp_key {
+    int32_t		id;
+    uint32_t		src_port;
+    uint32_t		dst_port;
+    int32_t		family;
+    unsigned char	src_addr[16];
+    unsigned char	dst_addr[16];
+} snmp_key_t;
+
+/*
+ * Slices are linked by comparing varbind names only. We therefore do
+ * not keep copies of complete packets but only a compact list of the
+ * varbind names. The list and the sub-identifiers of all names live
+ * in a single memory block.
+ */
+
+typedef struct _snmp_names {
+    unsigned		len;
+    uint32_t		sig;		/* sum of the name hashes */
+    uint64_t		mask;		/* bloom mask of the name hashes */
+    snmp_oid_t		name[];
+} snmp_names_t;
+
+/*
+ * Slices are indexed by two chained hash tables. The first table is
+ * keyed on the slice type and the addresses and ports of the two
+ * endpoints. The second table is keyed on the same data plus the
+ * signature of the varbind names (an order independent hash) and
+ * only used for get, set, trap and inform slices. New slices are
+ * added to the front of the chains, so the most recently created
+ * matching slice is found first. Chains are doubly linked so that
+ * retired slices can be removed in constant time.
+ */
+
+#define SLICE_TABLE_ENDPOINTS	0
+#define SLICE_TABLE_NAMES	1
+
+typedef struct _snmp_slice_link {
+    uint32_t		hash;
+    struct _snmp_slice	*next;
+    struct _snmp_slice	*prev;
+} snmp_slice_link_t;
+
+typedef struct _snmp_slice_table {
+    struct _snmp_slice	**chains;
+    uint32_t		size;
+    uint32_t		used;
+} snmp_slice_table_t;
+
+#define SLICE_TABLE_MIN_SIZE	1024
 
 typedef struct _snmp_slice {
     unsigned		id;
     int                 type;
-    char                *name;
+    snmp_file_t		file;
     snmp_ipaddr_t       src_addr;
     snmp_ip6addr_t      src_addr6;
     snmp_uint32_t	src_port;
     snmp_ipaddr_t       dst_addr;
     snmp_ip6addr_t      dst_addr6;
     snmp_uint32_t	dst_port;
-    uint64_t		cnt;
-    FILE		*stream;
-    struct _snmp_slice	*next;
-    snmp_packet_t	*pkt;
-    snmp_packet_t	*last_response;
+    struct _snmp_slice	*next;		/* activity list */
+    struct _snmp_slice	*prev;
+    uint32_t		last_sec;	/* time of the last packet */
+    snmp_names_t	*names;
+    snmp_names_t	*last_response;
+    snmp_key_t		key;
+    int			linked;		/* tables the slice is linked in */
+    snmp_slice_link_t	link[2];
 } snmp_slice_t;
 
-static snmp_slice_t *slice_list = NULL;
+static __thread snmp_slice_table_t slice_tables[2];
+
+/*
+ * All slices are kept on a list ordered by the time of their last
+ * packet. Slices that have been idle for longer than the slice
+ * timeout are retired from the head of the list.
+ */
+
+static __thread snmp_slice_t *slice_head = NULL;
+static __thread snmp_slice_t *slice_tail = NULL;
+static __thread uint32_t snmp_slice_timeout = 0;
+
+/*
+ * The request cache does not keep copies of the requests. Matching a
+ * response only needs the request id and the addresses and ports of
+ * the two endpoints (the key) plus the PDU type of the request.
+ */
 
 typedef struct _snmp_cache_elem {
-    snmp_packet_t *pkt;
+    snmp_key_t key;
+    uint32_t hash;
+    int pdu_type;		/* 0 if the request had no PDU */
     struct _snmp_cache_elem *next;
-    struct _snmp_cache_elem *kids;
+    struct _snmp_cache_elem *hnext;
+    struct _snmp_cache_elem *hprev;
 } snmp_cache_elem_t;
 
-static snmp_cache_elem_t *snmp_cache_list = NULL;
+/*
+ * Cached packets are kept in a time ordered ring of buckets, one
+ * bucket for every second of the cache window. Each bucket holds the
+ * packets seen during that second in arrival order. Expiring old
+ * packets thus only touches the buckets that fall out of the window
+ * and the packets they contain. The ring can be limited to a maximum
+ * number of packets, in which case the oldest packets are dropped
+ * first.
+ */
+
+typedef struct _snmp_cache_bucket {
+    snmp_cache_elem_t *head;
+    snmp_cache_elem_t *tail;
+} snmp_cache_bucket_t;
+
+static __thread snmp_cache_bucket_t *snmp_cache_ring = NULL;
+static __thread uint32_t snmp_cache_ring_size = 0;
+static __thread uint32_t snmp_cache_first = 0;	/* second of the oldest bucket */
+static __thread uint32_t snmp_cache_last = 0;	/* second of the newest bucket */
+static __thread unsigned long snmp_cache_count = 0;
+
+static __thread uint32_t snmp_cache_window = SNMP_CACHE_WINDOW;
+static __thread unsigned long snmp_cache_limit = 0;
 
-static unsigned flow_id = 0;
-static unsigned slice_id = 0;
+/*
+ * Cached packets are also indexed by a chained hash table keyed on
+ * the request id and the addresses and ports of the two endpoints.
+ * Chains are doubly linked so that expired packets can be removed
+ * in constant time. New packets are added to the front of a chain,
+ * so the most recently seen matching packet is found first.
+ */
+
+static __thread snmp_cache_elem_t **snmp_cache_table = NULL;
+static __thread uint32_t snmp_cache_table_size = 0;
+static __thread uint32_t snmp_cache_table_used = 0;
+
+#define CACHE_TABLE_MIN_SIZE	4096
+
+static __thread uint64_t snmp_cache_matched = 0;
+static __thread uint64_t snmp_cache_unmatched = 0;
+
+static __thread unsigned flow_id = 0;
+static __thread unsigned slice_id = 0;
+
+/*
+ * With -j, packets are distributed over a number of shards, each
+ * running in a thread of its own. All the state above is thread
+ * local so that every shard has its own flows, slices and request
+ * cache. Shard k of n assigns the ids k, k + n, k + 2n, ... so that
+ * ids do not depend on thread scheduling.
+ */
+
+static __thread unsigned shard_id = 0;
+static __thread unsigned shard_count = 1;
+
+/*
+ * Shared between shards: the lock protecting the main output stream
+ * and the statistics.
+ */
+
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t snmp_cache_matched_total = 0;
+static uint64_t snmp_cache_unmatched_total = 0;
 
 static inline void*
 xmalloc(size_t size)
@@ -311,40 +490,135 @@ snmp_oid_equal(snmp_oid_t *a, snmp_oid_t *b)
 }
 
 /*
- * Compare two varbind lists whether they contain the same varbind
- * names. Note that we allow the positions of the names to be
- * different!
+ * Simple FNV-1a hash function used to index flows and other things.
+ */
+
+#define SNMP_HASH_INIT	2166136261U
+
+static inline uint32_t
+snmp_hash_bytes(uint32_t hash, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    while (len-- > 0) {
+	hash ^= *p++;
+	hash *= 16777619U;
+    }
+    return hash;
+}
+
+/*
+ * Compute the signature of a list of names: the number of names, the
+ * sum of the hashes of all names (which does not depend on the order
+ * of the names), and a 64 bit bloom mask. If a list a contains all
+ * names of a list b, then the bloom mask of b is a subset of the
+ * bloom mask of a.
+ */
+
+static inline void
+snmp_names_sig_add(snmp_oid_t *oid,
+		   unsigned *len, uint32_t *sig, uint64_t *mask)
+{
+    uint32_t hash;
+
+    hash = snmp_hash_bytes(SNMP_HASH_INIT, oid->value,
+			   oid->len * sizeof(uint32_t));
+    (*len)++;
+    *sig += hash;
+    *mask |= (uint64_t) 1 << (hash & 63);
+}
+
+static void
+snmp_names_sig(snmp_packet_t *pkt,
+	       unsigned *len, uint32_t *sig, uint64_t *mask)
+{
+    snmp_varbind_t *vb;
+
+    *len = 0, *sig = 0, *mask = 0;
+    for (vb = pkt->snmp.scoped_pdu.pdu.varbindings.varbind; vb; vb = vb->next) {
+	snmp_names_sig_add(&vb->name, len, sig, mask);
+    }
+}
+
+/*
+ * Create a compact list of the varbind names of a packet. Only names
+ * that have a value are retained. The list is allocated in a single
+ * block and must be released with free() by the caller.
+ */
+
+static snmp_names_t*
+snmp_names_new(snmp_packet_t *pkt)
+{
+    snmp_names_t *names;
+    snmp_varbind_t *vb;
+    snmp_var_bindings_t *vbl;
+    unsigned i, k = 0, n = 0, subids = 0;
+    uint32_t *value;
+
+    vbl = &pkt->snmp.scoped_pdu.pdu.varbindings;
+    for (vb = vbl->varbind; vb; vb = vb->next) {
+	if (vb->name.attr.flags & SNMP_FLAG_VALUE) {
+	    n++;
+	    subids += vb->name.len;
+	}
+    }
+
+    names = xmalloc(sizeof(snmp_names_t) + n * sizeof(snmp_oid_t)
+		    + subids * sizeof(uint32_t));
+    value = (uint32_t *) &names->name[n];
+    for (vb = vbl->varbind; vb; vb = vb->next) {
+	if (vb->name.attr.flags & SNMP_FLAG_VALUE) {
+	    snmp_oid_t *oid = &names->name[names->len++];
+	    oid->value = value;
+	    oid->len = vb->name.len;
+	    oid->attr.flags = SNMP_FLAG_VALUE;
+	    memcpy(value, vb->name.value, vb->name.len * sizeof(uint32_t));
+	    value += vb->name.len;
+	}
+    }
+
+    for (i = 0; i < names->len; i++) {
+	snmp_names_sig_add(&names->name[i], &k, &names->sig, &names->mask);
+    }
+
+    return names;
+}
+
+/*
+ * Compare the varbind list of a packet with a list of names whether
+ * they contain the same varbind names. Note that we allow the
+ * positions of the names to be different!
  */
 
 static int
-snmp_vbl_cmp_names(snmp_packet_t *a, snmp_packet_t *b)
+snmp_vbl_cmp_names(snmp_packet_t *a, snmp_names_t *b)
 {
-    snmp_varbind_t *vb1, *vb2;
-    snmp_var_bindings_t *vbl1, *vbl2;
+    snmp_varbind_t *vb1;
+    snmp_var_bindings_t *vbl1;
+    unsigned i;
 
     if (!a || !b) {
 	return 0;
     }
 
     vbl1 = &a->snmp.scoped_pdu.pdu.varbindings;
-    vbl2 = &b->snmp.scoped_pdu.pdu.varbindings;
 
     for (vb1 = vbl1->varbind; vb1; vb1 = vb1->next) {
-	for (vb2 = vbl2->varbind; vb2; vb2 = vb2->next) {
-	    if (vb2->attr.flags & SNMP_FLAG_USER) {
+	for (i = 0; i < b->len; i++) {
+	    if (b->name[i].attr.flags & SNMP_FLAG_USER) {
 		continue;
 	    }
-	    if (snmp_oid_equal(&vb1->name, &vb2->name)) {
-		vb2->attr.flags |= SNMP_FLAG_USER;
+	    if (snmp_oid_equal(&vb1->name, &b->name[i])) {
+		b->name[i].attr.flags |= SNMP_FLAG_USER;
 		break;
 	    }
 	}
-	if (! vb2) break;
+	if (i == b->len) break;
     }
 
     /* clear the user flags in the name attr.flags */
-    for (vb2 = vbl2->varbind; vb2; vb2 = vb2->next) {
-	vb2->attr.flags &= ~SNMP_FLAG_USER;
+    for (i = 0; i < b->len; i++) {
+	b->name[i].attr.flags &= ~SNMP_FLAG_USER;
     }
 
     if (vb1) {
@@ -356,30 +630,27 @@ snmp_vbl_cmp_names(snmp_packet_t *a, snmp_packet_t *b)
 
 
 /*
- * Compare two varbind lists whether they contain at least one
- * identical names. Note that we allow the positions of the names to
- * be different!
+ * Compare the varbind list of a packet with a list of names whether
+ * they contain at least one identical name. Note that we allow the
+ * positions of the names to be different!
  */
 
 static int
-snmp_vbl_lnk_names(snmp_packet_t *a, snmp_packet_t *b)
+snmp_vbl_lnk_names(snmp_packet_t *a, snmp_names_t *b)
 {
-    snmp_varbind_t *vb1, *vb2;
-    snmp_var_bindings_t *vbl1, *vbl2;
+    snmp_varbind_t *vb1;
+    snmp_var_bindings_t *vbl1;
+    unsigned i;
 
-    if (!a && !b) {
+    if (!a || !b) {
 	return 0;
     }
 
     vbl1 = &a->snmp.scoped_pdu.pdu.varbindings;
-    vbl2 = &b->snmp.scoped_pdu.pdu.varbindings;
 
     for (vb1 = vbl1->varbind; vb1; vb1 = vb1->next) {
-	for (vb2 = vbl2->varbind; vb2; vb2 = vb2->next) {
-	    if (vb2->attr.flags & SNMP_FLAG_USER) {
-		continue;
-	    }
-	    if (snmp_oid_equal(&vb1->name, &vb2->name)) {
+	for (i = 0; i < b->len; i++) {
+	    if (snmp_oid_equal(&vb1->name, &b->name[i])) {
 		return 1;
 	    }
 	}
@@ -419,67 +690,284 @@ snmp_timestamp_compare(uint32_t a_sec, uint32_t a_usec,
 }
 
 /*
- * Add a new packet to the cache of recently seen packets.
+ * Compute the key of a packet and its hash value. The key covers the
+ * given id and the source and destination addresses and ports. The
+ * function returns 0 if the packet lacks any of these. IPv4 addresses
+ * take precedence over IPv6 addresses. The reverse flag swaps source
+ * and destination so that responses produce the same key as the
+ * requests they answer.
  */
 
-static snmp_cache_elem_t*
-snmp_cache_add(snmp_cache_elem_t *list, snmp_packet_t *pkt)
+static int
+snmp_key(snmp_packet_t *pkt, int reverse, int32_t id,
+	 snmp_key_t *key, uint32_t *hash)
 {
-    snmp_cache_elem_t *p;
+    snmp_uint32_t *src_port, *dst_port;
 
-    p = xmalloc(sizeof(snmp_cache_elem_t));
-    p->pkt = snmp_pkt_copy(pkt);
-    p->next = list;
-    return p;
+    src_port = reverse ? &pkt->dst_port : &pkt->src_port;
+    dst_port = reverse ? &pkt->src_port : &pkt->dst_port;
+    if (! (src_port->attr.flags & SNMP_FLAG_VALUE)
+	|| ! (dst_port->attr.flags & SNMP_FLAG_VALUE)) {
+	return 0;
+    }
+
+    memset(key, 0, sizeof(*key));
+    key->id = id;
+    key->src_port = src_port->value;
+    key->dst_port = dst_port->value;
+
+    if (pkt->src_addr.attr.flags & SNMP_FLAG_VALUE
+	&& pkt->dst_addr.attr.flags & SNMP_FLAG_VALUE) {
+	key->family = AF_INET;
+	memcpy(key->src_addr, reverse
+	       ? &pkt->dst_addr.value : &pkt->src_addr.value, 4);
+	memcpy(key->dst_addr, reverse
+	       ? &pkt->src_addr.value : &pkt->dst_addr.value, 4);
+    } else if (pkt->src_addr6.attr.flags & SNMP_FLAG_VALUE
+	       && pkt->dst_addr6.attr.flags & SNMP_FLAG_VALUE) {
+	key->family = AF_INET6;
+	memcpy(key->src_addr, reverse
+	       ? &pkt->dst_addr6.value : &pkt->src_addr6.value, 16);
+	memcpy(key->dst_addr, reverse
+	       ? &pkt->src_addr6.value : &pkt->dst_addr6.value, 16);
+    } else {
+	return 0;
+    }
+
+    *hash = snmp_hash_bytes(SNMP_HASH_INIT, key, sizeof(*key));
+    return 1;
 }
 
 /*
- * Remove all elements from the cache list that are older than the
- * given time stamp. Since we add new packets at the front of the
- * list, we basically have to traverse the list until we find old
- * packets and then we can discard the tail. Perhaps a smarter data
- * structure should be used to scale to very bursty SNMP traces...
+ * Compute the key of a cached packet. Packets without a request id
+ * can never be matched.
  */
 
-static snmp_cache_elem_t*
-snmp_cache_expire(snmp_cache_elem_t *list,
-		  uint32_t ts_sec, uint32_t ts_usec)
+static inline int
+snmp_cache_key(snmp_packet_t *pkt, int reverse,
+	       snmp_key_t *key, uint32_t *hash)
+{
+    if (! (pkt->snmp.scoped_pdu.pdu.req_id.attr.flags & SNMP_FLAG_VALUE)) {
+	return 0;
+    }
+
+    return snmp_key(pkt, reverse, pkt->snmp.scoped_pdu.pdu.req_id.value,
+		    key, hash);
+}
+
+/*
+ * Link a cache element into the cache hash table. The table doubles
+ * in size when the number of elements exceeds the number of chains.
+ * Doubling splits every chain into two chains and we preserve the
+ * order of the elements while doing so.
+ */
+
+static void
+snmp_cache_link(snmp_cache_elem_t *p)
 {
-    snmp_cache_elem_t *p = list, *l = NULL, *x;
+    uint32_t i, idx;
     
-    while (p) {
-	if (snmp_timestamp_compare(p->pkt->time_sec.value,
-				   p->pkt->time_usec.value,
-				   ts_sec, ts_usec) < 0) {
-	    x = p;
-	    if (l) {
-		l->next = p->next;
-	    } else {
-		list = p->next;
+    if (snmp_cache_table_used + 1 > snmp_cache_table_size) {
+	snmp_cache_elem_t **old = snmp_cache_table;
+	uint32_t old_size = snmp_cache_table_size;
+	snmp_cache_elem_t *x, *n, *tail[2];
+
+	snmp_cache_table_size = old_size ? 2 * old_size : CACHE_TABLE_MIN_SIZE;
+	snmp_cache_table = xmalloc(snmp_cache_table_size
+				   * sizeof(snmp_cache_elem_t *));
+	for (i = 0; i < old_size; i++) {
+	    tail[0] = tail[1] = NULL;
+	    for (x = old[i]; x; x = n) {
+		n = x->hnext;
+		idx = x->hash & (snmp_cache_table_size - 1);
+		x->hnext = NULL;
+		x->hprev = tail[idx != i];
+		if (x->hprev) {
+		    x->hprev->hnext = x;
+		} else {
+		    snmp_cache_table[idx] = x;
+		}
+		tail[idx != i] = x;
 	    }
-	    p = p->next;
-	    if (x->pkt) {
-		snmp_pkt_delete(x->pkt);
-		x->pkt = NULL;
+	}
+	free(old);
+    }
+
+    idx = p->hash & (snmp_cache_table_size - 1);
+    p->hprev = NULL;
+    p->hnext = snmp_cache_table[idx];
+    if (p->hnext) {
+	p->hnext->hprev = p;
+    }
+    snmp_cache_table[idx] = p;
+    snmp_cache_table_used++;
+}
+
+/*
+ * Unlink a cache element from the cache hash table.
+ */
+
+static void
+snmp_cache_unlink(snmp_cache_elem_t *p)
+{
+    if (p->hprev) {
+	p->hprev->hnext = p->hnext;
+    } else {
+	snmp_cache_table[p->hash & (snmp_cache_table_size - 1)] = p->hnext;
+    }
+    if (p->hnext) {
+	p->hnext->hprev = p->hprev;
+    }
+    p->hnext = p->hprev = NULL;
+    snmp_cache_table_used--;
+}
+
+/*
+ * Release a cache element after it has been taken off the ring.
+ */
+
+static void
+snmp_cache_free(snmp_cache_elem_t *p)
+{
+    snmp_cache_unlink(p);
+    free(p);
+    snmp_cache_count--;
+}
+
+/*
+ * Remove all elements from the cache that are older than the cache
+ * window relative to the time stamp ts_sec. The work done is
+ * proportional to the number of expired elements plus the number
+ * of seconds the window moved forward (bounded by the ring size).
+ */
+
+static void
+snmp_cache_expire(uint32_t ts_sec)
+{
+    snmp_cache_bucket_t *b;
+    snmp_cache_elem_t *p, *q;
+
+    if (ts_sec < snmp_cache_first) {
+	return;
+    }
+
+    while (snmp_cache_count
+	   && ts_sec - snmp_cache_first > snmp_cache_window) {
+	b = &snmp_cache_ring[snmp_cache_first & (snmp_cache_ring_size - 1)];
+	for (p = b->head; p; p = q) {
+	    q = p->next;
+	    snmp_cache_free(p);
+	}
+	b->head = b->tail = NULL;
+	if (snmp_cache_first == snmp_cache_last) {
+	    break;
+	}
+	snmp_cache_first++;
+    }
+}
+
+/*
+ * Drop the oldest element from the cache. This is used to enforce
+ * the cache limit.
+ */
+
+static void
+snmp_cache_drop_oldest()
+{
+    snmp_cache_bucket_t *b;
+    snmp_cache_elem_t *p;
+
+    while (snmp_cache_count) {
+	b = &snmp_cache_ring[snmp_cache_first & (snmp_cache_ring_size - 1)];
+	if (b->head) {
+	    p = b->head;
+	    b->head = p->next;
+	    if (! b->head) {
+		b->tail = NULL;
 	    }
-	    free(x);
-	} else {
-	    l = p; p = p->next;
+	    snmp_cache_free(p);
+	    return;
+	}
+	if (snmp_cache_first == snmp_cache_last) {
+	    break;
 	}
+	snmp_cache_first++;
+    }
+}
+
+/*
+ * Add a new packet to the cache of recently seen packets. Packets
+ * that are older than the oldest bucket (time stamps are not always
+ * monotonic in traces) are added to the oldest bucket. Packets that
+ * do not have a complete key can never be matched and are therefore
+ * not cached at all.
+ */
+
+static void
+snmp_cache_add(snmp_packet_t *pkt)
+{
+    snmp_cache_elem_t *p;
+    snmp_cache_bucket_t *b;
+    snmp_key_t key;
+    uint32_t hash;
+    uint32_t ts_sec = pkt->time_sec.value;
+
+    if (! snmp_cache_key(pkt, 0, &key, &hash)) {
+	return;
+    }
+
+    if (! snmp_cache_ring) {
+	for (snmp_cache_ring_size = 1;
+	     snmp_cache_ring_size <= snmp_cache_window + 1;
+	     snmp_cache_ring_size <<= 1) ;
+	snmp_cache_ring = xmalloc(snmp_cache_ring_size
+				  * sizeof(snmp_cache_bucket_t));
+    }
+
+    snmp_cache_expire(ts_sec);
+
+    if (! snmp_cache_count) {
+	snmp_cache_first = snmp_cache_last = ts_sec;
+    } else if (ts_sec < snmp_cache_first) {
+	ts_sec = snmp_cache_first;
+    } else if (ts_sec > snmp_cache_last) {
+	snmp_cache_last = ts_sec;
     }
 
-    return list;
+    p = xmalloc(sizeof(snmp_cache_elem_t));
+    p->key = key;
+    p->hash = hash;
+    if (pkt->snmp.scoped_pdu.pdu.attr.flags & SNMP_FLAG_VALUE) {
+	p->pdu_type = pkt->snmp.scoped_pdu.pdu.type;
+    }
+    snmp_cache_link(p);
+
+    b = &snmp_cache_ring[ts_sec & (snmp_cache_ring_size - 1)];
+    if (b->tail) {
+	b->tail->next = p;
+    } else {
+	b->head = p;
+    }
+    b->tail = p;
+    snmp_cache_count++;
+
+    while (snmp_cache_limit && snmp_cache_count > snmp_cache_limit) {
+	snmp_cache_drop_oldest();
+    }
 }
 
 /*
  * For a given packet pkt, find a suitable matching packet in the
- * cache.
+ * cache. Since the hash key covers all fields we compare, we only
+ * have to look at the elements of a single hash chain.
  */
 
 static snmp_cache_elem_t*
-snmp_cache_find(snmp_cache_elem_t *list, snmp_packet_t *pkt)
+snmp_cache_find(snmp_packet_t *pkt)
 {
     snmp_cache_elem_t *p;
+    snmp_key_t key;
+    uint32_t hash;
 
     /*
      * Some agents (most notably older NET-SNMP agents) may send
@@ -487,23 +975,13 @@ snmp_cache_find(snmp_cache_elem_t *list, snmp_packet_t *pkt)
      * devices. Should we relax the rules here???
      */
 
-    for (p = list; p; p = p->next) {
-	if (snmp_int32_equal(&p->pkt->snmp.scoped_pdu.pdu.req_id,
-			     &pkt->snmp.scoped_pdu.pdu.req_id)
-	    
-	    /* xxx what about ipv6 addresses ??? */
-	    
-	    /* xxx if I comment out the first ip address check, things
-	     * behave very strange; we loose packets in unknown (kind
-	     * of expected, but they do not show up elsewhere and in
-	     * addition I saw an empty line in the unknown file and I
-	     * have no clue where this is coming from; furthermore
-	     * runtime seems to increase significantly xxx */
-	    
-	    && snmp_ipaddr_equal(&p->pkt->dst_addr, &pkt->src_addr)
-	    && snmp_uint32_equal(&p->pkt->dst_port, &pkt->src_port)
-	    && snmp_ipaddr_equal(&p->pkt->src_addr, &pkt->dst_addr)
-  	    && snmp_uint32_equal(&p->pkt->src_port, &pkt->dst_port)) {
+    if (! snmp_cache_table || ! snmp_cache_key(pkt, 1, &key, &hash)) {
+	return NULL;
+    }
+
+    for (p = snmp_cache_table[hash & (snmp_cache_table_size - 1)];
+	 p; p = p->hnext) {
+	if (p->hash == hash && memcmp(&p->key, &key, sizeof(key)) == 0) {
 	    return p;
 	}
     }
@@ -511,16 +989,59 @@ snmp_cache_find(snmp_cache_elem_t *list, snmp_packet_t *pkt)
     return NULL;
 }
 
+/*
+ * Throw away all cached packets and add the number of matched and
+ * unmatched responses to the totals.
+ */
+
+static void
+snmp_cache_done()
+{
+    uint32_t i;
+    snmp_cache_elem_t *p, *q;
+
+    for (i = 0; i < snmp_cache_ring_size; i++) {
+	for (p = snmp_cache_ring[i].head; p; p = q) {
+	    q = p->next;
+	    free(p);
+	}
+    }
+    free(snmp_cache_ring);
+    snmp_cache_ring = NULL;
+    snmp_cache_ring_size = 0;
+    snmp_cache_count = 0;
+
+    free(snmp_cache_table);
+    snmp_cache_table = NULL;
+    snmp_cache_table_size = 0;
+    snmp_cache_table_used = 0;
+
+    pthread_mutex_lock(&output_lock);
+    snmp_cache_matched_total += snmp_cache_matched;
+    snmp_cache_unmatched_total += snmp_cache_unmatched;
+    pthread_mutex_unlock(&output_lock);
+    snmp_cache_matched = snmp_cache_unmatched = 0;
+}
+
+/*
+ * Report how many responses could be matched to cached requests.
+ */
+
+static void
+snmp_cache_report(void)
+{
+    fprintf(stderr, "%s: %" PRIu64 " responses matched, "
+	    "%" PRIu64 " responses unmatched\n", progname,
+	    snmp_cache_matched_total, snmp_cache_unmatched_total);
+    snmp_cache_matched_total = snmp_cache_unmatched_total = 0;
+}
+
 static inline int
-snmp_flow_type(snmp_packet_t *pkt)
+snmp_pdu_flow_type(int pdu_type)
 {
     int type = SNMP_FLOW_NONE;
-    
-    if (! pkt->snmp.scoped_pdu.pdu.attr.flags & SNMP_FLAG_VALUE) {
-	return SNMP_FLOW_NONE;
-    }
 
-    switch (pkt->snmp.scoped_pdu.pdu.type) {
+    switch (pdu_type) {
     case SNMP_PDU_GET:
     case SNMP_PDU_GETNEXT:
     case SNMP_PDU_GETBULK:
@@ -544,15 +1065,11 @@ snmp_flow_type(snmp_packet_t *pkt)
 }
 
 static inline int
-snmp_slice_type(snmp_packet_t *pkt)
+snmp_pdu_slice_type(int pdu_type)
 {
     int type = SNMP_SLICE_NONE;
-    
-    if (! pkt->snmp.scoped_pdu.pdu.attr.flags & SNMP_FLAG_VALUE) {
-	return SNMP_SLICE_NONE;
-    }
 
-    switch (pkt->snmp.scoped_pdu.pdu.type) {
+    switch (pdu_type) {
     case SNMP_PDU_GET:
 	type = SNMP_SLICE_GET;
 	break;
@@ -583,23 +1100,176 @@ snmp_slice_type(snmp_packet_t *pkt)
     return type;
 }
 
-/*
- * Find a flow, potentially creating new flows if a flow does not yet
- * exist.
- */
+static inline int
+snmp_flow_type(snmp_packet_t *pkt)
+{
+    if (! pkt->snmp.scoped_pdu.pdu.attr.flags & SNMP_FLAG_VALUE) {
+	return SNMP_FLOW_NONE;
+    }
 
-static snmp_flow_t*
-snmp_flow_find(snmp_packet_t *pkt)
+    return snmp_pdu_flow_type(pkt->snmp.scoped_pdu.pdu.type);
+}
+
+static inline int
+snmp_slice_type(snmp_packet_t *pkt)
 {
-    snmp_flow_t *p;
-    snmp_cache_elem_t *e;
-    int flow_type;
-    int reverse = 0;
+    if (! pkt->snmp.scoped_pdu.pdu.attr.flags & SNMP_FLAG_VALUE) {
+	return SNMP_SLICE_NONE;
+    }
 
-    flow_type = snmp_flow_type(pkt);
+    return snmp_pdu_slice_type(pkt->snmp.scoped_pdu.pdu.type);
+}
 
-    /*
-     * If we have a report or a response, we try to find the
+/*
+ * Compute the hash key of a flow given the addresses of the two flow
+ * endpoints. IPv4 addresses take precedence over IPv6 addresses. The
+ * function returns 0 if the endpoints do not have usable addresses;
+ * such flows can never be found again and are thus not indexed.
+ */
+
+static int
+snmp_flow_key(int type,
+	      snmp_ipaddr_t *src, snmp_ip6addr_t *src6,
+	      snmp_ipaddr_t *dst, snmp_ip6addr_t *dst6, uint32_t *hash)
+{
+    int family;
+    
+    if (src->attr.flags & SNMP_FLAG_VALUE
+	&& dst->attr.flags & SNMP_FLAG_VALUE) {
+	family = AF_INET;
+	*hash = snmp_hash_bytes(SNMP_HASH_INIT, &type, sizeof(type));
+	*hash = snmp_hash_bytes(*hash, &family, sizeof(family));
+	*hash = snmp_hash_bytes(*hash, &src->value, 4);
+	*hash = snmp_hash_bytes(*hash, &dst->value, 4);
+	return 1;
+    }
+
+    if (src6->attr.flags & SNMP_FLAG_VALUE
+	&& dst6->attr.flags & SNMP_FLAG_VALUE) {
+	family = AF_INET6;
+	*hash = snmp_hash_bytes(SNMP_HASH_INIT, &type, sizeof(type));
+	*hash = snmp_hash_bytes(*hash, &family, sizeof(family));
+	*hash = snmp_hash_bytes(*hash, &src6->value, 16);
+	*hash = snmp_hash_bytes(*hash, &dst6->value, 16);
+	return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Test whether a packet belongs to a given flow. The reverse flag
+ * indicates that the packet travels from the command responder to
+ * the command generator.
+ */
+
+static inline int
+snmp_flow_match(snmp_flow_t *p, int type, snmp_packet_t *pkt, int reverse)
+{
+    if (p->type != type) {
+	return 0;
+    }
+    
+    if (snmp_ipaddr_equal(&p->src_addr,
+			  reverse ? &pkt->dst_addr : &pkt->src_addr)
+	&& snmp_ipaddr_equal(&p->dst_addr,
+			     reverse ? &pkt->src_addr : &pkt->dst_addr)) {
+	return 1;
+    }
+
+    if (snmp_ip6addr_equal(&p->src_addr6,
+			   reverse ? &pkt->dst_addr6 : &pkt->src_addr6)
+	&& snmp_ip6addr_equal(&p->dst_addr6,
+			      reverse ? &pkt->src_addr6 : &pkt->dst_addr6)) {
+	return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Lookup a flow in the flow hash table.
+ */
+
+static snmp_flow_t*
+flow_table_lookup(uint32_t hash, int type, snmp_packet_t *pkt, int reverse)
+{
+    uint32_t i, mask;
+
+    if (! flow_table) {
+	return NULL;
+    }
+
+    mask = flow_table_size - 1;
+    for (i = hash & mask; flow_table[i].flow; i = (i + 1) & mask) {
+	if (flow_table[i].hash == hash
+	    && snmp_flow_match(flow_table[i].flow, type, pkt, reverse)) {
+	    return flow_table[i].flow;
+	}
+    }
+
+    return NULL;
+}
+
+/*
+ * Insert a flow into the flow hash table. The table is doubled in
+ * size whenever it would become more than half full.
+ */
+
+static void
+flow_table_insert(snmp_flow_t *flow)
+{
+    uint32_t i, j, mask;
+
+    if (2 * (flow_table_used + 1) > flow_table_size) {
+	snmp_flow_slot_t *old = flow_table;
+	uint32_t old_size = flow_table_size;
+
+	flow_table_size = old_size ? 2 * old_size : FLOW_TABLE_MIN_SIZE;
+	flow_table = xmalloc(flow_table_size * sizeof(snmp_flow_slot_t));
+	mask = flow_table_size - 1;
+	for (j = 0; j < old_size; j++) {
+	    if (! old[j].flow) continue;
+	    for (i = old[j].hash & mask; flow_table[i].flow; i = (i + 1) & mask) ;
+	    flow_table[i] = old[j];
+	}
+	free(old);
+    }
+
+    mask = flow_table_size - 1;
+    for (i = flow->hash & mask; flow_table[i].flow; i = (i + 1) & mask) ;
+    flow_table[i].hash = flow->hash;
+    flow_table[i].flow = flow;
+    flow_table_used++;
+}
+
+static void
+flow_table_reset()
+{
+    free(flow_table);
+    flow_table = NULL;
+    flow_table_size = 0;
+    flow_table_used = 0;
+}
+
+/*
+ * Find a flow, potentially creating new flows if a flow does not yet
+ * exist.
+ */
+
+static snmp_flow_t*
+snmp_flow_find(snmp_packet_t *pkt)
+{
+    snmp_flow_t *p;
+    snmp_cache_elem_t *e;
+    int flow_type;
+    int reverse = 0;
+    uint32_t hash;
+
+    flow_type = snmp_flow_type(pkt);
+
+    /*
+     * If we have a report or a response, we try to find the
      * corresponding request in the list of recently seen requests. If
      * we find the request, we can set the flow type. If we are
      * unsuccessful, we return that we were unable to identify the
@@ -607,11 +1277,16 @@ snmp_flow_find(snmp_packet_t *pkt)
      */
 
     if (flow_type == SNMP_FLOW_NONE) {
-	e = snmp_cache_find(snmp_cache_list, pkt);
-	if (e && e->pkt->snmp.scoped_pdu.pdu.attr.flags & SNMP_FLAG_VALUE) {
-	    flow_type = snmp_flow_type(e->pkt);
+	e = snmp_cache_find(pkt);
+	if (e && e->pdu_type) {
+	    flow_type = snmp_pdu_flow_type(e->pdu_type);
 	    reverse = 1;
 	}
+	if (flow_type == SNMP_FLOW_NONE) {
+	    snmp_cache_unmatched++;
+	} else {
+	    snmp_cache_matched++;
+	}
     }
 
     if (flow_type == SNMP_FLOW_NONE) {
@@ -623,26 +1298,23 @@ snmp_flow_find(snmp_packet_t *pkt)
      * one if there is no appropriate flow entry yet.
      */
 
-    for (p = flow_list; p; p = p->next) {
-	if (p->type == flow_type
-	    && snmp_ipaddr_equal(&p->src_addr,
-				 reverse ? &pkt->dst_addr : &pkt->src_addr)
-	    && snmp_ipaddr_equal(&p->dst_addr,
-				 reverse ? &pkt->src_addr : &pkt->dst_addr)) {
-	    break;
+    p = NULL;
+    if (reverse) {
+	if (snmp_flow_key(flow_type, &pkt->dst_addr, &pkt->dst_addr6,
+			  &pkt->src_addr, &pkt->src_addr6, &hash)) {
+	    p = flow_table_lookup(hash, flow_type, pkt, reverse);
 	}
-	if (p->type == flow_type
-	    && snmp_ip6addr_equal(&p->src_addr6,
-				  reverse ? &pkt->dst_addr6 : &pkt->src_addr6)
-	    && snmp_ip6addr_equal(&p->dst_addr6,
-				  reverse ? &pkt->src_addr6 : &pkt->dst_addr6)) {
-	    break;
+    } else {
+	if (snmp_flow_key(flow_type, &pkt->src_addr, &pkt->src_addr6,
+			  &pkt->dst_addr, &pkt->dst_addr6, &hash)) {
+	    p = flow_table_lookup(hash, flow_type, pkt, reverse);
 	}
     }
 
     if (! p) {
 	p = xmalloc(sizeof(snmp_flow_t));
-	p->id = flow_id++;
+	p->id = flow_id;
+	flow_id += shard_count;
 	p->type = flow_type;
 	if (pkt->src_addr.attr.flags & SNMP_FLAG_VALUE
 	    && pkt->dst_addr.attr.flags & SNMP_FLAG_VALUE) {
@@ -656,14 +1328,214 @@ snmp_flow_find(snmp_packet_t *pkt)
 	}
 	memcpy(&p->src_port, &pkt->src_port, sizeof(p->src_port));
 	memcpy(&p->dst_port, &pkt->dst_port, sizeof(p->dst_port));
-	p->name = snmp_flow_name(p);
+	p->file.name = snmp_flow_name(p);
+	p->file.kind = "flow";
 	p->next = flow_list;
 	flow_list = p;
+	if (snmp_flow_key(p->type, &p->src_addr, &p->src_addr6,
+			  &p->dst_addr, &p->dst_addr6, &p->hash)) {
+	    flow_table_insert(p);
+	}
     }
     
     return p;
 }
 
+/*
+ * Link a slice into one of the slice hash tables. The table doubles
+ * in size when the number of slices exceeds the number of chains.
+ * Doubling splits every chain into two chains and we preserve the
+ * order of the slices while doing so.
+ */
+
+static void
+slice_table_link(int t, snmp_slice_t *p, uint32_t hash)
+{
+    snmp_slice_table_t *table = &slice_tables[t];
+    uint32_t i, idx;
+
+    if (table->used + 1 > table->size) {
+	snmp_slice_t **old = table->chains;
+	uint32_t old_size = table->size;
+	snmp_slice_t *x, *n, *tail[2];
+
+	table->size = old_size ? 2 * old_size : SLICE_TABLE_MIN_SIZE;
+	table->chains = xmalloc(table->size * sizeof(snmp_slice_t *));
+	for (i = 0; i < old_size; i++) {
+	    tail[0] = tail[1] = NULL;
+	    for (x = old[i]; x; x = n) {
+		n = x->link[t].next;
+		idx = x->link[t].hash & (table->size - 1);
+		x->link[t].next = NULL;
+		x->link[t].prev = tail[idx != i];
+		if (x->link[t].prev) {
+		    x->link[t].prev->link[t].next = x;
+		} else {
+		    table->chains[idx] = x;
+		}
+		tail[idx != i] = x;
+	    }
+	}
+	free(old);
+    }
+
+    idx = hash & (table->size - 1);
+    p->link[t].hash = hash;
+    p->link[t].prev = NULL;
+    p->link[t].next = table->chains[idx];
+    if (p->link[t].next) {
+	p->link[t].next->link[t].prev = p;
+    }
+    table->chains[idx] = p;
+    table->used++;
+    p->linked |= (1 << t);
+}
+
+static void
+slice_table_unlink(int t, snmp_slice_t *p)
+{
+    snmp_slice_table_t *table = &slice_tables[t];
+
+    if (! (p->linked & (1 << t))) {
+	return;
+    }
+    if (p->link[t].prev) {
+	p->link[t].prev->link[t].next = p->link[t].next;
+    } else {
+	table->chains[p->link[t].hash & (table->size - 1)] = p->link[t].next;
+    }
+    if (p->link[t].next) {
+	p->link[t].next->link[t].prev = p->link[t].prev;
+    }
+    p->link[t].next = p->link[t].prev = NULL;
+    table->used--;
+    p->linked &= ~(1 << t);
+}
+
+static void
+slice_table_reset()
+{
+    int t;
+
+    for (t = 0; t < 2; t++) {
+	free(slice_tables[t].chains);
+	memset(&slice_tables[t], 0, sizeof(snmp_slice_table_t));
+    }
+}
+
+static inline int
+snmp_slice_by_names(int type)
+{
+    return (type == SNMP_SLICE_GET || type == SNMP_SLICE_SET
+	    || type == SNMP_SLICE_TRAP || type == SNMP_SLICE_INFORM);
+}
+
+/*
+ * Hash value of a slice in the names table.
+ */
+
+static inline uint32_t
+snmp_slice_names_hash(uint32_t hash, uint32_t sig)
+{
+    return snmp_hash_bytes(hash, &sig, sizeof(sig));
+}
+
+/*
+ * Lookup the slice a packet belongs to. Responses belong to the most
+ * recently created slice between the endpoints. Get, set, trap and
+ * inform requests belong to a slice with the same varbind names, or
+ * failing that, to the most recently created slice whose first packet
+ * contains all the varbind names. Getnext and getbulk requests belong
+ * to the most recently created slice whose last response contains at
+ * least one of the varbind names.
+ */
+
+static snmp_slice_t*
+snmp_slice_lookup(snmp_packet_t *pkt, int response,
+		  snmp_key_t *key, uint32_t hash)
+{
+    snmp_slice_table_t *table, *ntable;
+    snmp_slice_t *p;
+    unsigned len = 0;
+    uint32_t sig = 0, nhash;
+    uint64_t mask = 0;
+
+    table = &slice_tables[SLICE_TABLE_ENDPOINTS];
+    ntable = &slice_tables[SLICE_TABLE_NAMES];
+    if (! table->chains) {
+	return NULL;
+    }
+
+    if (! response && snmp_slice_by_names(key->id)) {
+	snmp_names_sig(pkt, &len, &sig, &mask);
+	nhash = snmp_slice_names_hash(hash, sig);
+	for (p = ntable->chains ? ntable->chains[nhash & (ntable->size - 1)] : NULL;
+	     p; p = p->link[SLICE_TABLE_NAMES].next) {
+	    if (p->link[SLICE_TABLE_NAMES].hash == nhash
+		&& p->names->sig == sig && p->names->len == len
+		&& memcmp(&p->key, key, sizeof(*key)) == 0
+		&& snmp_vbl_cmp_names(pkt, p->names)) {
+		return p;
+	    }
+	}
+    }
+
+    for (p = table->chains[hash & (table->size - 1)];
+	 p; p = p->link[SLICE_TABLE_ENDPOINTS].next) {
+	if (p->link[SLICE_TABLE_ENDPOINTS].hash != hash
+	    || memcmp(&p->key, key, sizeof(*key)) != 0) {
+	    continue;
+	}
+	if (response) {
+	    return p;
+	}
+	if (snmp_slice_by_names(key->id)) {
+	    if (p->names->len < len
+		|| (mask & ~p->names->mask)
+		|| ! snmp_vbl_cmp_names(pkt, p->names)) {
+		continue;
+	    }
+	} else {
+	    if (p->last_response
+		&& ! snmp_vbl_lnk_names(pkt, p->last_response)) {
+		continue;
+	    }
+	}
+	return p;
+    }
+
+    return NULL;
+}
+
+/*
+ * Move a slice to the end of the activity list.
+ */
+
+static void
+snmp_slice_touch(snmp_slice_t *p, uint32_t ts_sec)
+{
+    p->last_sec = ts_sec;
+    if (p == slice_tail) {
+	return;
+    }
+    if (p->prev || p->next || p == slice_head) {
+	if (p->prev) {
+	    p->prev->next = p->next;
+	} else {
+	    slice_head = p->next;
+	}
+	p->next->prev = p->prev;
+    }
+    p->next = NULL;
+    p->prev = slice_tail;
+    if (slice_tail) {
+	slice_tail->next = p;
+    } else {
+	slice_head = p;
+    }
+    slice_tail = p;
+}
+
 /*
  * Find a slice, potentially creating new slices if a slice does not
  * yet exist.
@@ -676,6 +1548,8 @@ snmp_slice_find(snmp_packet_t *pkt)
     snmp_cache_elem_t *e = NULL;
     int slice_type;
     int reverse = 0;
+    snmp_key_t key;
+    uint32_t hash;
 
     slice_type = snmp_slice_type(pkt);
 
@@ -688,11 +1562,16 @@ snmp_slice_find(snmp_packet_t *pkt)
      */
 
     if (slice_type == SNMP_FLOW_NONE) {
-	e = snmp_cache_find(snmp_cache_list, pkt);
-	if (e && e->pkt->snmp.scoped_pdu.pdu.attr.flags & SNMP_FLAG_VALUE) {
-	    slice_type = snmp_slice_type(e->pkt);
+	e = snmp_cache_find(pkt);
+	if (e && e->pdu_type) {
+	    slice_type = snmp_pdu_slice_type(e->pdu_type);
 	    reverse = 1;
 	}
+	if (slice_type == SNMP_FLOW_NONE) {
+	    snmp_cache_unmatched++;
+	} else {
+	    snmp_cache_matched++;
+	}
     }
 
     if (slice_type == SNMP_FLOW_NONE) {
@@ -704,73 +1583,15 @@ snmp_slice_find(snmp_packet_t *pkt)
      * one if there is no appropriate slice entry yet.
      */
 
-    for (p = slice_list; p; p = p->next) {
-
-	if (p->type != slice_type) continue;
-
-	if (p->src_addr.attr.flags & SNMP_FLAG_VALUE
-	    && p->src_port.attr.flags & SNMP_FLAG_VALUE
-	    && p->dst_addr.attr.flags & SNMP_FLAG_VALUE
-	    && p->dst_port.attr.flags & SNMP_FLAG_VALUE) {
-	    if (! snmp_ipaddr_equal(&p->src_addr,
-				    reverse ? &pkt->dst_addr : &pkt->src_addr) ||
-		! snmp_uint32_equal(&p->src_port,
-				    reverse ? &pkt->dst_port : &pkt->src_port) ||
-		! snmp_ipaddr_equal(&p->dst_addr,
-				    reverse ? &pkt->src_addr : &pkt->dst_addr) ||
-		! snmp_uint32_equal(&p->dst_port,
-				    reverse ? &pkt->src_port : &pkt->dst_port)) {
-		continue;
-	    }
-	} else if (p->src_addr6.attr.flags & SNMP_FLAG_VALUE
-		   && p->src_port.attr.flags & SNMP_FLAG_VALUE
-		   && p->dst_addr6.attr.flags & SNMP_FLAG_VALUE
-		   && p->dst_port.attr.flags & SNMP_FLAG_VALUE) {
-	    if (! snmp_ip6addr_equal(&p->src_addr6,
-				     reverse ? &pkt->dst_addr6 : &pkt->src_addr6) ||
-		! snmp_uint32_equal(&p->src_port,
-				    reverse ? &pkt->dst_port : &pkt->src_port) ||
-		! snmp_ip6addr_equal(&p->dst_addr6,
-				     reverse ? &pkt->src_addr6 : &pkt->dst_addr6) ||
-		! snmp_uint32_equal(&p->dst_port,
-				    reverse ? &pkt->src_port : &pkt->dst_port)) {
-		continue;
-	    }
-	} else {
-	    continue;
-	}
-
-#if 0
-	fprintf(stderr, "\n(current, first, last_response):\n");
-	snmp_csv_write_stream_pkt(stderr, pkt);
-	snmp_csv_write_stream_pkt(stderr, p->pkt);
-	snmp_csv_write_stream_pkt(stderr, p->last_response);
-#endif
-	    
-	if (slice_type == SNMP_SLICE_GET ||
-	    slice_type == SNMP_SLICE_SET ||
-	    slice_type == SNMP_SLICE_TRAP ||
-	    slice_type == SNMP_SLICE_INFORM) {
-	    if (! e && ! snmp_vbl_cmp_names(pkt, p->pkt)) {
-		continue;
-	    }
-	}
-
-	if (slice_type == SNMP_SLICE_GETNEXT ||
-	    slice_type == SNMP_SLICE_GETBULK) {
-	    if (! e
-		&& p->last_response
-		&& ! snmp_vbl_lnk_names(pkt, p->last_response)) {
-		continue;
-	    }
-	}
-
-	break;
+    p = NULL;
+    if (snmp_key(pkt, reverse, slice_type, &key, &hash)) {
+	p = snmp_slice_lookup(pkt, e != NULL, &key, hash);
     }
 
     if (! p) {
 	p = xmalloc(sizeof(snmp_slice_t));
-	p->id = slice_id++;
+	p->id = slice_id;
+	slice_id += shard_count;
 	p->type = slice_type;
 	if (pkt->src_addr.attr.flags & SNMP_FLAG_VALUE
 	    && pkt->dst_addr.attr.flags & SNMP_FLAG_VALUE) {
@@ -784,29 +1605,41 @@ snmp_slice_find(snmp_packet_t *pkt)
 	}
 	memcpy(&p->src_port, &pkt->src_port, sizeof(p->src_port));
 	memcpy(&p->dst_port, &pkt->dst_port, sizeof(p->dst_port));
-	p->name = snmp_slice_name(p);
-	p->pkt = snmp_pkt_copy(pkt);
+	p->file.name = snmp_slice_name(p);
+	p->file.kind = "slice";
+	p->names = snmp_names_new(pkt);
 	p->last_response = NULL;
-	p->next = slice_list;
-	slice_list = p;
+
+	/*
+	 * The slice is indexed by its own endpoints, which are the
+	 * endpoints of the packet that created the slice.
+	 */
+
+	if (snmp_key(pkt, 0, slice_type, &p->key, &hash)) {
+	    slice_table_link(SLICE_TABLE_ENDPOINTS, p, hash);
+	    if (snmp_slice_by_names(slice_type)) {
+		slice_table_link(SLICE_TABLE_NAMES, p,
+				 snmp_slice_names_hash(hash, p->names->sig));
+	    }
+	}
     }
 
     if (e) {
-	if (p->last_response) {
-	    snmp_pkt_delete(p->last_response);
-	}
-	p->last_response = snmp_pkt_copy(pkt);
+	free(p->last_response);
+	p->last_response = snmp_names_new(pkt);
     }
+
+    snmp_slice_touch(p, pkt->time_sec.value);
     
     return p;
 }
 
 /*
- * Helper function to open a flow file with a nice extension.
+ * Helper function to open a flow or slice file with a nice extension.
  */
 
 static FILE*
-snmp_flow_open_stream(snmp_flow_t *flow, snmp_write_t *out, const char *mode)
+snmp_file_open_stream(snmp_file_t *file, snmp_write_t *out, const char *mode)
 {
 #define MAX_FILENAME_SIZE 4096
     char filename[MAX_FILENAME_SIZE];
@@ -817,237 +1650,681 @@ snmp_flow_open_stream(snmp_flow_t *flow, snmp_write_t *out, const char *mode)
 	     out->path ? "/" : "",
 	     out->prefix ? out->prefix : "",
 	     out->prefix ? "-" : "",
-	     flow->name,
+	     file->name,
 	     out->ext ? out->ext : "");
     stream = fopen(filename, mode);
     if (! stream) {
-	fprintf(stderr, "%s: failed to open flow file %s: %s\n",
-		progname, filename, strerror(errno));
+	fprintf(stderr, "%s: failed to open %s file %s: %s\n",
+		progname, file->kind, filename, strerror(errno));
     }
     return stream;
 }
 
 /*
- * Helper function to close a flow file stream. Any stream errors that
- * might have occured are reported to stderr.
+ * We keep an LRU list of open files to reduce the number of open()
+ * close() system calls. The most recently used file is at the head
+ * of the list. The number of open files is limited by the number of
+ * file descriptors we may use.
  */
 
+static __thread snmp_file_t *open_file_head = NULL;
+static __thread snmp_file_t *open_file_tail = NULL;
+static __thread unsigned long open_file_count = 0;
+static __thread unsigned long open_file_limit = 0;
+static __thread int cnt = 0;
+
 static void
-snmp_flow_close_stream(snmp_flow_t *flow)
+open_file_unlink(snmp_file_t *file)
 {
-    if (flow && flow->stream) {
-	if (fflush(flow->stream) || ferror(flow->stream)) {
-	    fprintf(stderr, "%s: error on flow stream %s: %s\n",
-		    progname, flow->name, strerror(errno));
-	}
-	fclose(flow->stream);
-	flow->stream = NULL;
+    if (file->lru_prev) {
+	file->lru_prev->lru_next = file->lru_next;
+    } else {
+	open_file_head = file->lru_next;
+    }
+    if (file->lru_next) {
+	file->lru_next->lru_prev = file->lru_prev;
+    } else {
+	open_file_tail = file->lru_prev;
     }
+    file->lru_prev = file->lru_next = NULL;
 }
 
-/*
- * Helper function to open a slice file with a nice extension.
- */
-
-static FILE*
-snmp_slice_open_stream(snmp_slice_t *slice, snmp_write_t *out, const char *mode)
+static void
+open_file_push(snmp_file_t *file)
 {
-#define MAX_FILENAME_SIZE 4096
-    char filename[MAX_FILENAME_SIZE];
-    FILE *stream;
-
-    snprintf(filename, MAX_FILENAME_SIZE, "%s%s%s%s%s.%s",
-	     out->path ? out->path : "",
-	     out->path ? "/" : "",
-	     out->prefix ? out->prefix : "",
-	     out->prefix ? "-" : "",
-	     slice->name,
-	     out->ext ? out->ext : "");
-    stream = fopen(filename, mode);
-    if (! stream) {
-	fprintf(stderr, "%s: failed to open slice file %s: %s\n",
-		progname, filename, strerror(errno));
+    file->lru_prev = NULL;
+    file->lru_next = open_file_head;
+    if (open_file_head) {
+	open_file_head->lru_prev = file;
+    } else {
+	open_file_tail = file;
     }
-    return stream;
+    open_file_head = file;
 }
 
 /*
- * Helper function to close a slice file stream. Any stream errors that
- * might have occured are reported to stderr.
+ * Helper function to close a flow or slice file stream. Any stream
+ * errors that might have occured are reported to stderr.
  */
 
 static void
-snmp_slice_close_stream(snmp_slice_t *slice)
+snmp_file_close_stream(snmp_file_t *file)
 {
-    if (slice && slice->stream) {
-	if (fflush(slice->stream) || ferror(slice->stream)) {
-	    fprintf(stderr, "%s: error on slice stream %s: %s\n",
-		    progname, slice->name, strerror(errno));
+    if (file && file->stream) {
+	if (fflush(file->stream) || ferror(file->stream)) {
+	    fprintf(stderr, "%s: error on %s stream %s: %s\n",
+		    progname, file->kind, file->name, strerror(errno));
 	}
-	fclose(slice->stream);
-	slice->stream = NULL;
+	fclose(file->stream);
+	file->stream = NULL;
+	open_file_unlink(file);
+	open_file_count--;
     }
 }
 
 /*
- * We keep an LRU cache of open flows to reduce the number of open()
- * close() system calls.
+ * Make sure the stream of a file is open and move the file to the
+ * head of the LRU list. The least recently used file is closed if we
+ * would otherwise exceed the open file limit.
  */
 
-static snmp_flow_t **open_flow_cache = NULL;
-static int open_flow_cache_size = 0;
-static int cnt = 0;
-
-static void
-open_flow_cache_init()
+static FILE*
+snmp_file_stream(snmp_file_t *file, snmp_write_t *out, const char *mode)
 {
-    struct rlimit rl;
-
-    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) {
-	fprintf(stderr,
-		"%s: getrlimit() failed: unable to allocate open flow cache\n",
-		progname);
-	exit(1);
+    if (file->stream) {
+	if (file != open_file_head) {
+	    open_file_unlink(file);
+	    open_file_push(file);
+	}
+	return file->stream;
     }
-    
-    if (rl.rlim_max == RLIM_INFINITY) {
-	open_flow_cache_size = 1024;		/* pretend to be like Linux */
-    } else if (rl.rlim_max > 8) {		/* arbitrary safety margin */
-	open_flow_cache_size = rl.rlim_max - 8;
-    } else {
-	fprintf(stderr, "%s: not enough open file descriptors left\n",
-		progname);
-	exit(1);
+
+    while (open_file_tail && open_file_count >= open_file_limit) {
+	snmp_file_close_stream(open_file_tail);
     }
 
-    open_flow_cache = xmalloc(sizeof(snmp_flow_t*) * open_flow_cache_size);
+    file->stream = snmp_file_open_stream(file, out, mode);
+    if (file->stream) {
+	open_file_push(file);
+	open_file_count++;
+    }
+    return file->stream;
 }
 
-static void
-open_flow_cache_update(snmp_packet_t *pkt)
-{
-    if (cnt == 0) {
-	open_flow_cache_init();
-    }
+/*
+ * The output functions write to a stdio stream. We use a single
+ * stream for all files whose output ends up in the buffer of the
+ * current file. The stream is flushed after every output function
+ * call so that the current file can change in between. The files
+ * with non-empty buffers are kept on a heap ordered by buffer size.
+ * When the buffered data exceeds the buffer limit, the largest
+ * buffers are written to their files until we are below half of the
+ * limit. Without fopencookie(), the output functions write directly
+ * to the file streams and nothing is buffered.
+ */
 
-    cnt++;
+static __thread FILE *buffer_stream = NULL;
+static __thread snmp_file_t *buffer_file = NULL;
+static __thread snmp_file_t **buffer_heap = NULL;
+static __thread unsigned long buffer_heap_len = 0;
+static __thread unsigned long buffer_heap_size = 0;
+static __thread size_t buffer_total = 0;
+static __thread size_t buffer_limit = 0;
 
-    if (! (cnt % 1024)) {
-	snmp_cache_list = snmp_cache_expire(snmp_cache_list,
-					    pkt->time_sec.value - 300,
-					    pkt->time_usec.value);
-    }
+#define BUFFER_STREAM_SIZE	65536
+
+static inline void
+buffer_heap_set(unsigned long pos, snmp_file_t *file)
+{
+    buffer_heap[pos - 1] = file;
+    file->heap_pos = pos;
 }
 
-#if 0
 static void
-open_flow_cache_print()
+buffer_heap_up(snmp_file_t *file)
 {
-    int i;
+    unsigned long pos = file->heap_pos;
+    snmp_file_t *parent;
 
-    for (i = 0; i < open_flow_cache_size; i++) {
-	fprintf(stderr, "%3d: %s\n", i,
-		open_flow_cache[i] ? open_flow_cache[i]->name : "");
+    while (pos > 1) {
+	parent = buffer_heap[pos / 2 - 1];
+	if (parent->buf_len >= file->buf_len) {
+	    break;
+	}
+	buffer_heap_set(pos, parent);
+	pos /= 2;
     }
+    buffer_heap_set(pos, file);
 }
-#endif
 
 static void
-open_flow_cache_add(snmp_flow_t *flow)
+buffer_heap_down(snmp_file_t *file)
 {
-    int i, j;
-    snmp_flow_t *tmp;
+    unsigned long pos = file->heap_pos, kid;
 
-    for (i = 0; i < open_flow_cache_size; i++) {
-	if (open_flow_cache[i] == flow) {
-	    break;
+    while ((kid = 2 * pos) <= buffer_heap_len) {
+	if (kid < buffer_heap_len
+	    && buffer_heap[kid]->buf_len > buffer_heap[kid - 1]->buf_len) {
+	    kid++;
 	}
-	if (!open_flow_cache[i]) {
-	    i = open_flow_cache_size;
+	if (buffer_heap[kid - 1]->buf_len <= file->buf_len) {
 	    break;
 	}
+	buffer_heap_set(pos, buffer_heap[kid - 1]);
+	pos = kid;
     }
+    buffer_heap_set(pos, file);
+}
 
-    /* The current flow is on the top - don't bother any further... */
+static void
+buffer_heap_remove(snmp_file_t *file)
+{
+    snmp_file_t *last;
+    unsigned long pos = file->heap_pos;
 
-    if (i == 0) {
-	if (! open_flow_cache[0]) {
-	    open_flow_cache[0] = flow;
-	}
+    if (! pos) {
 	return;
     }
+    file->heap_pos = 0;
+    last = buffer_heap[--buffer_heap_len];
+    if (last != file) {
+	buffer_heap_set(pos, last);
+	buffer_heap_up(last);
+	buffer_heap_down(last);
+    }
+}
+
+#ifdef HAVE_FOPENCOOKIE
+
+/*
+ * The stdio cookie write function of the buffer stream which appends
+ * data to the buffer of the current file.
+ */
+
+static ssize_t
+buffer_stream_write(void *cookie, const char *data, size_t len)
+{
+    snmp_file_t *file = buffer_file;
+
+    if (! file) {
+	return len;
+    }
 
-    /* Flow not found in the cache, so close the last flow and assign
-       the new flow to it... */
+    if (file->buf_len + len > file->buf_size) {
+	size_t size = file->buf_size ? file->buf_size : 256;
+	while (size < file->buf_len + len) {
+	    size *= 2;
+	}
+	file->buf = realloc(file->buf, size);
+	if (! file->buf) {
+	    abort();
+	}
+	file->buf_size = size;
+    }
+    memcpy(file->buf + file->buf_len, data, len);
+    file->buf_len += len;
+    buffer_total += len;
+
+    if (! file->heap_pos) {
+	if (buffer_heap_len == buffer_heap_size) {
+	    buffer_heap_size = buffer_heap_size ? 2 * buffer_heap_size : 1024;
+	    buffer_heap = realloc(buffer_heap,
+				  buffer_heap_size * sizeof(snmp_file_t *));
+	    if (! buffer_heap) {
+		abort();
+	    }
+	}
+	buffer_heap_set(++buffer_heap_len, file);
+    }
+    buffer_heap_up(file);
     
-    if (i == open_flow_cache_size) {
-	i--;
-	if (open_flow_cache[i]) {
-	    snmp_flow_close_stream(open_flow_cache[i]);
+    return len;
+}
+
+static FILE*
+buffer_stream_get(snmp_file_t *file, snmp_write_t *out)
+{
+    if (! buffer_stream) {
+	cookie_io_functions_t io = { .write = buffer_stream_write };
+	buffer_stream = fopencookie(NULL, "w", io);
+	if (! buffer_stream) {
+	    abort();
+	}
+	setvbuf(buffer_stream, NULL, _IOFBF, BUFFER_STREAM_SIZE);
+    }
+    buffer_file = file;
+    return buffer_stream;
+}
+
+static void
+buffer_stream_put()
+{
+    fflush(buffer_stream);
+    buffer_file = NULL;
+}
+
+#else
+
+static FILE*
+buffer_stream_get(snmp_file_t *file, snmp_write_t *out)
+{
+    return snmp_file_stream(file, out, "a");
+}
+
+static void
+buffer_stream_put()
+{
+}
+
+#endif
+
+/*
+ * Release the buffer of a file without writing it.
+ */
+
+static void
+snmp_file_drop(snmp_file_t *file)
+{
+    buffer_heap_remove(file);
+    buffer_total -= file->buf_len;
+    free(file->buf);
+    file->buf = NULL;
+    file->buf_len = file->buf_size = 0;
+}
+
+/*
+ * Write the buffered output of a file to the file and release the
+ * buffer memory. We give up if the file cannot be reopened since the
+ * buffered output would otherwise be lost.
+ */
+
+static void
+snmp_file_flush(snmp_file_t *file, snmp_write_t *out)
+{
+    FILE *stream;
+
+    if (file->buf_len) {
+	stream = snmp_file_stream(file, out, "a");
+	if (! stream) {
+	    fprintf(stderr, "%s: unable to write %lu buffered bytes "
+		    "of %s file %s - aborting\n", progname,
+		    (unsigned long) file->buf_len, file->kind, file->name);
+	    exit(1);
 	}
-	open_flow_cache[i] = flow;
+	if (fwrite(file->buf, 1, file->buf_len, stream) != file->buf_len) {
+	    fprintf(stderr, "%s: error on %s stream %s: %s\n",
+		    progname, file->kind, file->name, strerror(errno));
+	}
+    }
+    snmp_file_drop(file);
+}
+
+/*
+ * Write a packet to a flow or slice file. Returns 0 if the file could
+ * not be created. The file is created when the first packet is
+ * written so that errors are detected early.
+ */
+
+static int
+snmp_file_write(snmp_file_t *file, snmp_write_t *out, snmp_packet_t *pkt)
+{
+    FILE *stream;
+
+    if (file->cnt == 0 && ! snmp_file_stream(file, out, "w")) {
+	return 0;
     }
 
-    /* Move the flow to the top... */
+    stream = buffer_stream_get(file, out);
+    if (! stream) {
+	return 0;
+    }
+    if (file->cnt == 0 && out->write_new) {
+	out->write_new(stream);
+    }
+    if (out->write_pkt) {
+	out->write_pkt(stream, pkt);
+    }
+    buffer_stream_put();
+    file->cnt++;
 
-    tmp = open_flow_cache[i];
-    for (j = i; j > 0; j--) {
-	open_flow_cache[j] = open_flow_cache[j-1];
+    if (buffer_total > buffer_limit) {
+	while (buffer_heap_len && buffer_total > buffer_limit / 2) {
+	    snmp_file_flush(buffer_heap[0], out);
+	}
     }
-    open_flow_cache[0] = tmp;
+    return 1;
 }
 
+/*
+ * Finish a flow or slice file and release its name.
+ */
+
 static void
-open_flow_cache_reset()
+snmp_file_done(snmp_file_t *file, snmp_write_t *out)
 {
-    if (open_flow_cache) {
-	free(open_flow_cache);
-	open_flow_cache = NULL;
-	open_flow_cache_size = 0;
-	cnt = 0;
+    if (file->name) {
+	if (snmp_file_stream(file, out, "a")) {
+	    if (out->write_end) {
+		out->write_end(buffer_stream_get(file, out));
+		buffer_stream_put();
+	    }
+	    snmp_file_flush(file, out);
+	    snmp_file_close_stream(file);
+	}
+	snmp_file_drop(file);
+	free(file->name);
+	file->name = NULL;
     }
 }
 
 /*
- * Below are the flow interface functions as defined in snmp.h, namely
- * the initializing function, the per packet write functions, and the
- * finalizing function.
+ * Determine the number of files we keep open. We use the soft limit
+ * on file descriptors minus a safety margin. If the user asked for a
+ * larger number of open files, we try to raise the soft limit first.
  */
 
-void
-snmp_flow_init(snmp_write_t *out)
+static void
+open_file_init(snmp_write_t *out)
 {
-    flow_id = 0;
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) {
+	fprintf(stderr,
+		"%s: getrlimit() failed: unable to allocate open file cache\n",
+		progname);
+	exit(1);
+    }
+
+    if (out->open_limit && rl.rlim_cur != RLIM_INFINITY
+	&& rl.rlim_cur < out->open_limit + 8) {
+	rl.rlim_cur = out->open_limit + 8;
+	if (rl.rlim_max != RLIM_INFINITY && rl.rlim_cur > rl.rlim_max) {
+	    rl.rlim_cur = rl.rlim_max;
+	}
+	(void) setrlimit(RLIMIT_NOFILE, &rl);
+	(void) getrlimit(RLIMIT_NOFILE, &rl);
+    }
+    
+    if (rl.rlim_cur == RLIM_INFINITY) {
+	open_file_limit = 1024;			/* pretend to be like Linux */
+    } else if (rl.rlim_cur > 8) {		/* arbitrary safety margin */
+	open_file_limit = rl.rlim_cur - 8;
+    } else {
+	fprintf(stderr, "%s: not enough open file descriptors left\n",
+		progname);
+	exit(1);
+    }
+
+    if (out->open_limit && out->open_limit < open_file_limit) {
+	open_file_limit = out->open_limit;
+    }
+
+    open_file_limit /= shard_count;
+    if (! open_file_limit) {
+	open_file_limit = 1;
+    }
 }
 
-void
-snmp_flow_write(snmp_write_t *out, snmp_packet_t *pkt)
+static void
+buffer_init(snmp_write_t *out)
+{
+    buffer_limit = out->buffer_limit ? out->buffer_limit : SNMP_BUFFER_LIMIT;
+    buffer_limit /= shard_count;
+}
+
+/*
+ * Write a packet that does not belong to a flow or slice to the main
+ * output stream.
+ */
+
+static void
+snmp_output_write(snmp_write_t *out, snmp_packet_t *pkt)
+{
+    if (out->stream && out->write_pkt) {
+	pthread_mutex_lock(&output_lock);
+	out->write_pkt(out->stream, pkt);
+	pthread_mutex_unlock(&output_lock);
+    }
+}
+
+static void
+open_file_update(snmp_write_t *out, snmp_packet_t *pkt)
+{
+    if (cnt == 0) {
+	open_file_init(out);
+	buffer_init(out);
+	snmp_cache_window = out->cache_window;
+	snmp_cache_limit = out->cache_limit;
+	snmp_slice_timeout = out->slice_timeout;
+    }
+
+    cnt++;
+
+    snmp_cache_expire(pkt->time_sec.value);
+}
+
+static void
+open_file_reset()
+{
+    open_file_head = open_file_tail = NULL;
+    open_file_count = 0;
+    open_file_limit = 0;
+    cnt = 0;
+
+    if (buffer_stream) {
+	fclose(buffer_stream);
+	buffer_stream = NULL;
+    }
+    free(buffer_heap);
+    buffer_heap = NULL;
+    buffer_heap_len = buffer_heap_size = 0;
+    buffer_total = 0;
+}
+
+/*
+ * The shards. Each shard has a bounded queue of packets which is
+ * filled by the reading thread and drained by the shard thread. All
+ * packets of a pair of endpoints go to the same shard so that
+ * requests and responses meet in the same request cache.
+ */
+
+typedef struct _snmp_shard {
+    unsigned		id;
+    pthread_t		thread;
+    pthread_mutex_t	lock;
+    pthread_cond_t	cond;
+    snmp_packet_t	**queue;
+    unsigned		head;
+    unsigned		len;
+    int			done;
+    snmp_write_t	*out;
+    void		(*write)(snmp_write_t *out, snmp_packet_t *pkt);
+    void		(*done_func)(snmp_write_t *out);
+} snmp_shard_t;
+
+#define SHARD_QUEUE_SIZE	4096
+
+static snmp_shard_t *shards = NULL;
+static unsigned shards_num = 0;
+
+static void*
+snmp_shard_main(void *arg)
+{
+    snmp_shard_t *shard = (snmp_shard_t *) arg;
+    snmp_packet_t *pkt;
+
+    shard_id = shard->id;
+    shard_count = shards_num;
+    flow_id = slice_id = shard_id;
+
+    while (1) {
+	pthread_mutex_lock(&shard->lock);
+	while (! shard->len && ! shard->done) {
+	    pthread_cond_wait(&shard->cond, &shard->lock);
+	}
+	if (! shard->len) {
+	    pthread_mutex_unlock(&shard->lock);
+	    break;
+	}
+	pkt = shard->queue[shard->head];
+	shard->head = (shard->head + 1) % SHARD_QUEUE_SIZE;
+	if (shard->len-- == SHARD_QUEUE_SIZE) {
+	    pthread_cond_signal(&shard->cond);
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	shard->write(shard->out, pkt);
+	snmp_pkt_delete(pkt);
+    }
+
+    shard->done_func(shard->out);
+    return NULL;
+}
+
+static void
+snmp_shard_start(snmp_write_t *out,
+		 void (*write)(snmp_write_t *out, snmp_packet_t *pkt),
+		 void (*done_func)(snmp_write_t *out))
+{
+    unsigned i;
+    int rc;
+
+    shards_num = out->jobs;
+    shards = xmalloc(shards_num * sizeof(snmp_shard_t));
+    for (i = 0; i < shards_num; i++) {
+	shards[i].id = i;
+	shards[i].out = out;
+	shards[i].write = write;
+	shards[i].done_func = done_func;
+	shards[i].queue = xmalloc(SHARD_QUEUE_SIZE * sizeof(snmp_packet_t *));
+	pthread_mutex_init(&shards[i].lock, NULL);
+	pthread_cond_init(&shards[i].cond, NULL);
+	rc = pthread_create(&shards[i].thread, NULL,
+			    snmp_shard_main, &shards[i]);
+	if (rc) {
+	    fprintf(stderr, "%s: failed to create thread: %s\n",
+		    progname, strerror(rc));
+	    exit(1);
+	}
+    }
+}
+
+/*
+ * Select the shard of a packet by hashing the addresses of the two
+ * endpoints in a canonical order, so that both directions map to the
+ * same shard.
+ */
+
+static snmp_shard_t*
+snmp_shard_select(snmp_packet_t *pkt)
+{
+    uint32_t hash = SNMP_HASH_INIT;
+    void *a = NULL, *b = NULL, *t;
+    size_t len = 0;
+
+    if (pkt->src_addr.attr.flags & SNMP_FLAG_VALUE
+	&& pkt->dst_addr.attr.flags & SNMP_FLAG_VALUE) {
+	a = &pkt->src_addr.value;
+	b = &pkt->dst_addr.value;
+	len = 4;
+    } else if (pkt->src_addr6.attr.flags & SNMP_FLAG_VALUE
+	       && pkt->dst_addr6.attr.flags & SNMP_FLAG_VALUE) {
+	a = &pkt->src_addr6.value;
+	b = &pkt->dst_addr6.value;
+	len = 16;
+    }
+
+    if (len) {
+	if (memcmp(a, b, len) > 0) {
+	    t = a, a = b, b = t;
+	}
+	hash = snmp_hash_bytes(hash, a, len);
+	hash = snmp_hash_bytes(hash, b, len);
+    }
+
+    return &shards[hash % shards_num];
+}
+
+/*
+ * Hand a copy of a packet to its shard, starting the shards if they
+ * are not running yet. We block while the queue of the shard is full.
+ */
+
+static void
+snmp_shard_dispatch(snmp_write_t *out, snmp_packet_t *pkt,
+		    void (*write)(snmp_write_t *out, snmp_packet_t *pkt),
+		    void (*done_func)(snmp_write_t *out))
+{
+    snmp_shard_t *shard;
+
+    if (! shards) {
+	snmp_shard_start(out, write, done_func);
+    }
+
+    shard = snmp_shard_select(pkt);
+    pkt = snmp_pkt_copy(pkt);
+
+    pthread_mutex_lock(&shard->lock);
+    while (shard->len == SHARD_QUEUE_SIZE) {
+	pthread_cond_wait(&shard->cond, &shard->lock);
+    }
+    shard->queue[(shard->head + shard->len) % SHARD_QUEUE_SIZE] = pkt;
+    if (shard->len++ == 0) {
+	pthread_cond_signal(&shard->cond);
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/*
+ * Tell all shards that there are no more packets and wait for them to
+ * finish their flows or slices.
+ */
+
+static void
+snmp_shard_finish()
+{
+    unsigned i;
+
+    for (i = 0; i < shards_num; i++) {
+	pthread_mutex_lock(&shards[i].lock);
+	shards[i].done = 1;
+	pthread_cond_signal(&shards[i].cond);
+	pthread_mutex_unlock(&shards[i].lock);
+    }
+
+    for (i = 0; i < shards_num; i++) {
+	pthread_join(shards[i].thread, NULL);
+	pthread_mutex_destroy(&shards[i].lock);
+	pthread_cond_destroy(&shards[i].cond);
+	free(shards[i].queue);
+    }
+
+    free(shards);
+    shards = NULL;
+    shards_num = 0;
+}
+
+/*
+ * The flow functions that run within a shard (or in the main thread
+ * if there are no shards).
+ */
+
+static void
+snmp_flow_write_shard(snmp_write_t *out, snmp_packet_t *pkt)
 {
     snmp_flow_t *flow;
 
-    open_flow_cache_update(pkt);
+    open_file_update(out, pkt);
     
     flow = snmp_flow_find(pkt);
-    if (flow && flow->name) {
-	if (! flow->stream) {
-	    flow->stream = snmp_flow_open_stream(flow, out,
-						 (flow->cnt == 0) ? "w" : "a");
-	}
-	if (flow->stream) {
-	    if (flow->cnt == 0 && out->write_new) {
-		out->write_new(flow->stream);
-	    }
-	    if (out->write_pkt) {
-		out->write_pkt(flow->stream, pkt);
-	    }
-	    flow->cnt++;
+    if (flow && flow->file.name) {
+	if (snmp_file_write(&flow->file, out, pkt)) {
 	    if (pkt->snmp.scoped_pdu.pdu.type != SNMP_PDU_RESPONSE
 		&& pkt->snmp.scoped_pdu.pdu.type != SNMP_PDU_TRAP1
 		&& pkt->snmp.scoped_pdu.pdu.type != SNMP_PDU_TRAP2
 		&& pkt->snmp.scoped_pdu.pdu.type != SNMP_PDU_RESPONSE) {
-		snmp_cache_list = snmp_cache_add(snmp_cache_list, pkt);
+		snmp_cache_add(pkt);
 	    }
-	    open_flow_cache_add(flow);
 	    return;
 	}
     }
@@ -1057,80 +2334,132 @@ snmp_flow_write(snmp_write_t *out, snmp_packet_t *pkt)
      * be coming? xxx
      */
 
-    if (out->stream && out->write_pkt) {
-	out->write_pkt(out->stream, pkt);
-    }
-    snmp_cache_list = snmp_cache_add(snmp_cache_list, pkt);
+    snmp_output_write(out, pkt);
+    snmp_cache_add(pkt);
 }
 
-void
-snmp_flow_done(snmp_write_t *out)
+static void
+snmp_flow_done_shard(snmp_write_t *out)
 {
     snmp_flow_t *p, *q;
 
     for (p = flow_list; p; ) {
-	if (p->name) {
-	    if (! p->stream) {
-		p->stream = snmp_flow_open_stream(p, out, "a");
-	    }
-	    if (p->stream) {
-		if (out->write_end) {
-		    out->write_end(p->stream);
-		}
-		snmp_flow_close_stream(p);
-	    }
-	    free(p->name);
-	}
+	snmp_file_done(&p->file, out);
 	q = p->next;
 	free(p);
 	p = q;
     }
+    flow_list = NULL;
+    flow_table_reset();
 
-    open_flow_cache_reset();
+    open_file_reset();
+    snmp_cache_done();
 }
 
 /*
- * Below are the slice interface functions as defined in snmp.h, namely
+ * Below are the flow interface functions as defined in snmp.h, namely
  * the initializing function, the per packet write functions, and the
  * finalizing function.
  */
 
 void
-snmp_slice_init(snmp_write_t *out)
+snmp_flow_init(snmp_write_t *out)
 {
-    slice_id = 0;
+    flow_id = 0;
 }
 
 void
-snmp_slice_write(snmp_write_t *out, snmp_packet_t *pkt)
+snmp_flow_write(snmp_write_t *out, snmp_packet_t *pkt)
+{
+    if (out->jobs > 1) {
+	snmp_shard_dispatch(out, pkt,
+			    snmp_flow_write_shard, snmp_flow_done_shard);
+	return;
+    }
+
+    snmp_flow_write_shard(out, pkt);
+}
+
+void
+snmp_flow_done(snmp_write_t *out)
+{
+    if (shards) {
+	snmp_shard_finish();
+    } else {
+	snmp_flow_done_shard(out);
+    }
+    if (out->verbose) {
+	snmp_cache_report();
+    }
+}
+
+/*
+ * The slice functions that run within a shard (or in the main thread
+ * if there are no shards).
+ */
+
+/*
+ * Finish a slice file and release the slice.
+ */
+
+static void
+snmp_slice_retire(snmp_slice_t *p, snmp_write_t *out)
+{
+    slice_table_unlink(SLICE_TABLE_ENDPOINTS, p);
+    slice_table_unlink(SLICE_TABLE_NAMES, p);
+
+    if (p->prev) {
+	p->prev->next = p->next;
+    } else {
+	slice_head = p->next;
+    }
+    if (p->next) {
+	p->next->prev = p->prev;
+    } else {
+	slice_tail = p->prev;
+    }
+
+    snmp_file_done(&p->file, out);
+    free(p->names);
+    free(p->last_response);
+    free(p);
+}
+
+/*
+ * Retire all slices that have been idle for longer than the slice
+ * timeout relative to the time stamp ts_sec.
+ */
+
+static void
+snmp_slice_expire(snmp_write_t *out, uint32_t ts_sec)
+{
+    if (! snmp_slice_timeout) {
+	return;
+    }
+
+    while (slice_head && ts_sec > slice_head->last_sec
+	   && ts_sec - slice_head->last_sec > snmp_slice_timeout) {
+	snmp_slice_retire(slice_head, out);
+    }
+}
+
+static void
+snmp_slice_write_shard(snmp_write_t *out, snmp_packet_t *pkt)
 {
     snmp_slice_t *slice;
 
-    open_flow_cache_update(pkt);
+    open_file_update(out, pkt);
+    snmp_slice_expire(out, pkt->time_sec.value);
 
     slice = snmp_slice_find(pkt);
-    if (slice && slice->name) {
-	if (! slice->stream) {
-	    slice->stream = snmp_slice_open_stream(slice, out,
-						   (slice->cnt == 0) ? "w" : "a");
-	}
-	if (slice->stream) {
-	    if (slice->cnt == 0 && out->write_new) {
-		out->write_new(slice->stream);
-	    }
-	    if (out->write_pkt) {
-		out->write_pkt(slice->stream, pkt);
-	    }
-	    slice->cnt++;
+    if (slice && slice->file.name) {
+	if (snmp_file_write(&slice->file, out, pkt)) {
 	    if (pkt->snmp.scoped_pdu.pdu.type != SNMP_PDU_RESPONSE
 		&& pkt->snmp.scoped_pdu.pdu.type != SNMP_PDU_TRAP1
 		&& pkt->snmp.scoped_pdu.pdu.type != SNMP_PDU_TRAP2
 		&& pkt->snmp.scoped_pdu.pdu.type != SNMP_PDU_RESPONSE) {
-		snmp_cache_list = snmp_cache_add(snmp_cache_list, pkt);
+		snmp_cache_add(pkt);
 	    }
-#if 0
-	    open_flow_cache_add(flow);
-#endif
 	    return;
 	}
     }
@@ -1140,35 +2469,55 @@ snmp_slice_write(snmp_write_t *out, snmp_packet_t *pkt)
      * be coming? xxx
      */
 
-    if (out->stream && out->write_pkt) {
-	out->write_pkt(out->stream, pkt);
+    snmp_output_write(out, pkt);
+    snmp_cache_add(pkt);
+}
+
+static void
+snmp_slice_done_shard(snmp_write_t *out)
+{
+    while (slice_head) {
+	snmp_slice_retire(slice_head, out);
     }
-    snmp_cache_list = snmp_cache_add(snmp_cache_list, pkt);
+    slice_table_reset();
+
+    open_file_reset();
+    snmp_cache_done();
 }
 
+/*
+ * Below are the slice interface functions as defined in snmp.h, namely
+ * the initializing function, the per packet write functions, and the
+ * finalizing function.
+ */
+
 void
-snmp_slice_done(snmp_write_t *out)
+snmp_slice_init(snmp_write_t *out)
 {
-    snmp_slice_t *p, *q;
+    slice_id = 0;
+}
 
-    for (p = slice_list; p; ) {
-	if (p->name) {
-	    if (! p->stream) {
-		p->stream = snmp_slice_open_stream(p, out, "a");
-	    }
-	    if (p->stream) {
-		if (out->write_end) {
-		    out->write_end(p->stream);
-		}
-		snmp_slice_close_stream(p);
-	    }
-	    free(p->name);
-	    snmp_pkt_delete(p->pkt);
-	}
-	q = p->next;
-	free(p);
-	p = q;
+void
+snmp_slice_write(snmp_write_t *out, snmp_packet_t *pkt)
+{
+    if (out->jobs > 1) {
+	snmp_shard_dispatch(out, pkt,
+			    snmp_slice_write_shard, snmp_slice_done_shard);
+	return;
     }
 
-    open_flow_cache_reset();
+    snmp_slice_write_shard(out, pkt);
+}
+
+void
+snmp_slice_done(snmp_write_t *out)
+{
+    if (shards) {
+	snmp_shard_finish();
+    } else {
+	snmp_slice_done_shard(out);
+    }
+    if (out->verbose) {
+	snmp_cache_report();
+    }
 }
@@ -0,0 +1,221 @@
+/*
+ * hex.c --
+ *
+ * Conversion of octet string values from and to the hex digits used
+ * by the CSV and XML representations. The scalar code works with
+ * lookup tables; on x86 processors with SSSE3, blocks of 16 octets
+ * are converted with vector instructions.
+ *
+ * Copyright (c) 2006 Juergen Schoenwaelder
+ *
+ * $Id$
+ */
+
+#include "config.h"
+#include "snmp.h"
+
+#include <string.h>
+
+/*
+ * The value of a hex digit or -1 for characters which are not hex
+ * digits. Both lower and upper case digits are accepted.
+ */
+
+static const signed char hex_value[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+/*
+ * The two lower case hex digits of every octet.
+ */
+
+static const char hex_digits[513] =
+    "000102030405060708090a0b0c0d0e0f"
+    "101112131415161718191a1b1c1d1e1f"
+    "202122232425262728292a2b2c2d2e2f"
+    "303132333435363738393a3b3c3d3e3f"
+    "404142434445464748494a4b4c4d4e4f"
+    "505152535455565758595a5b5c5d5e5f"
+    "606162636465666768696a6b6c6d6e6f"
+    "707172737475767778797a7b7c7d7e7f"
+    "808182838485868788898a8b8c8d8e8f"
+    "909192939495969798999a9b9c9d9e9f"
+    "a0a1a2a3a4a5a6a7a8a9aaabacadaeaf"
+    "b0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+    "c0c1c2c3c4c5c6c7c8c9cacbcccdcecf"
+    "d0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+    "e0e1e2e3e4e5e6e7e8e9eaebecedeeef"
+    "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+/*
+ * Vectorized conversion. The encoder splits 16 octets into nibbles
+ * and maps them to digits with a pshufb table lookup. The decoder
+ * classifies 32 digits with byte compares, computes their values
+ * and combines pairs of nibbles with pmaddubsw. All loads of a block
+ * happen before its store, so decoding in place works. The kernels
+ * are compiled for SSSE3 regardless of the compiler flags and are
+ * only called if the processor supports it.
+ */
+
+#include <tmmintrin.h>
+
+#define HEX_SIMD
+
+__attribute__((target("ssse3")))
+static size_t
+hex_encode_ssse3(char *dst, const unsigned char *src, size_t len)
+{
+    const __m128i table = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+					'8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i x, hi, lo;
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+	x = _mm_loadu_si128((const __m128i *) (src + i));
+	hi = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(x, 4), mask));
+	lo = _mm_shuffle_epi8(table, _mm_and_si128(x, mask));
+	_mm_storeu_si128((__m128i *) (dst + 2 * i), _mm_unpacklo_epi8(hi, lo));
+	_mm_storeu_si128((__m128i *) (dst + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+    return i;
+}
+
+/*
+ * Return the values of 16 hex digits and clear the bits in *valid
+ * which belong to characters that are not hex digits.
+ */
+
+__attribute__((target("ssse3")))
+static inline __m128i
+hex_nibbles(__m128i c, __m128i *valid)
+{
+    __m128i d, l, isd, isl;
+
+    d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+    l = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    isd = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    isl = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(5)), l);
+    *valid = _mm_and_si128(*valid, _mm_or_si128(isd, isl));
+    return _mm_or_si128(_mm_and_si128(isd, d),
+			_mm_andnot_si128(isd, _mm_add_epi8(l, _mm_set1_epi8(10))));
+}
+
+__attribute__((target("ssse3")))
+static size_t
+hex_decode_ssse3(unsigned char *dst, const char *src, size_t len)
+{
+    const __m128i weight = _mm_set1_epi16(0x0110);
+    __m128i a, b, valid;
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+	valid = _mm_set1_epi8(-1);
+	a = _mm_loadu_si128((const __m128i *) (src + 2 * i));
+	b = _mm_loadu_si128((const __m128i *) (src + 2 * i + 16));
+	a = _mm_maddubs_epi16(hex_nibbles(a, &valid), weight);
+	b = _mm_maddubs_epi16(hex_nibbles(b, &valid), weight);
+	if (_mm_movemask_epi8(valid) != 0xffff) {
+	    break;
+	}
+	_mm_storeu_si128((__m128i *) (dst + i), _mm_packus_epi16(a, b));
+    }
+    return i;
+}
+
+static inline int
+hex_have_ssse3(void)
+{
+#ifdef __SSSE3__
+    return 1;
+#else
+    return __builtin_cpu_supports("ssse3");
+#endif
+}
+
+#endif
+
+/*
+ * Write the 2 * len hex digits of the len octets at src to dst. The
+ * result is not NUL terminated.
+ */
+
+void
+snmp_hex_encode(char *dst, const unsigned char *src, size_t len)
+{
+    size_t i = 0;
+
+#ifdef HEX_SIMD
+    if (len >= 16 && hex_have_ssse3()) {
+	i = hex_encode_ssse3(dst, src, len);
+    }
+#endif
+    for (; i < len; i++) {
+	memcpy(dst + 2 * i, hex_digits + 2 * src[i], 2);
+    }
+}
+
+/*
+ * Convert the 2 * len hex digits at src into len octets at dst, which
+ * may be the same as src. Returns -1 if src contains a character
+ * which is not a hex digit and 0 otherwise.
+ */
+
+int
+snmp_hex_decode(unsigned char *dst, const char *src, size_t len)
+{
+    const unsigned char *s = (const unsigned char *) src;
+    size_t i = 0;
+    int hi, lo;
+
+#ifdef HEX_SIMD
+    if (len >= 16 && hex_have_ssse3()) {
+	i = hex_decode_ssse3(dst, src, len);
+    }
+#endif
+    for (; i < len; i++) {
+	hi = hex_value[s[2 * i]];
+	lo = hex_value[s[2 * i + 1]];
+	if ((hi | lo) < 0) {
+	    return -1;
+	}
+	dst[i] = (hi << 4) | lo;
+    }
+    return 0;
+}
+
+/*
+ * Write the hex digits of len octets to a stream.
+ */
+
+void
+snmp_hex_write(FILE *stream, const unsigned char *src, size_t len)
+{
+    char buffer[1024];
+    size_t n;
+
+    while (len) {
+	n = len < sizeof(buffer) / 2 ? len : sizeof(buffer) / 2;
+	snmp_hex_encode(buffer, src, n);
+	fwrite(buffer, 1, 2 * n, stream);
+	src += n;
+	len -= n;
+    }
+}
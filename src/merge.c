@@ -0,0 +1,325 @@
+/*
+ * merge.c --
+ *
+ * Read several input files at the same time, each on its own thread,
+ * and merge the decoded messages in time stamp order before they are
+ * passed on to the processing callback. The number of reading threads
+ * is bounded; if there are more files, the threads continue with the
+ * next file once they have finished one.
+ *
+ * Copyright (c) 2006 Juergen Schoenwaelder
+ *
+ * $Id$
+ */
+
+#define _GNU_SOURCE
+
+#include "config.h"
+#include "snmp.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+/*
+ * Every reading thread is a source. The reading thread copies the
+ * messages into batches and hands over one batch at a time to the
+ * merging thread, so that the lock is not taken for every message.
+ * A reader blocks as long as its previous batch has not been taken,
+ * which bounds the memory used by files that are ahead in time. A
+ * batch only holds messages of a single file. The files which have
+ * not been started yet are taken in command line order by the
+ * threads which finish their file.
+ */
+
+#define MERGE_BATCH_SIZE	256
+
+typedef struct _merge_batch {
+    unsigned		index;		/* position of the file */
+    unsigned		len;
+    snmp_packet_t	*pkt[MERGE_BATCH_SIZE];
+} merge_batch_t;
+
+typedef struct _merge {
+    char		**files;
+    unsigned		count;
+    unsigned		next;		/* next file not yet started */
+    pthread_mutex_t	lock;
+    snmp_reader		read;
+    void		*reader_data;
+} merge_t;
+
+typedef struct _merge_source {
+    merge_t		*merge;
+    unsigned		index;		/* file read by the thread */
+    pthread_t		thread;
+    pthread_mutex_t	lock;
+    pthread_cond_t	cond;
+    merge_batch_t	*fill;		/* filled by the reading thread */
+    merge_batch_t	*ready;		/* handed over, NULL if none */
+    merge_batch_t	*drain;		/* drained by the merging thread */
+    unsigned		next;		/* next message in the drain batch */
+    int			done;
+    uint32_t		time_sec;	/* time stamp of the next message */
+    uint32_t		time_usec;
+} merge_source_t;
+
+static inline void*
+xmalloc(size_t size)
+{
+    void *p;
+
+    p = malloc(size);
+    if (! p) {
+	abort();
+    }
+    memset(p, 0, size);
+    return p;
+}
+
+/*
+ * Hand the batch filled by the reading thread over to the merging
+ * thread and start a new one. We wait until the merging thread has
+ * taken the previous batch.
+ */
+
+static void
+merge_handover(merge_source_t *src)
+{
+    pthread_mutex_lock(&src->lock);
+    while (src->ready) {
+	pthread_cond_wait(&src->cond, &src->lock);
+    }
+    src->ready = src->fill;
+    pthread_cond_signal(&src->cond);
+    pthread_mutex_unlock(&src->lock);
+
+    src->fill = xmalloc(sizeof(merge_batch_t));
+    src->fill->index = src->index;
+}
+
+/*
+ * The reader callback. The message is only valid during the callback,
+ * so we keep a copy.
+ */
+
+static void
+merge_collect(snmp_packet_t *pkt, void *user_data)
+{
+    merge_source_t *src = (merge_source_t *) user_data;
+
+    src->fill->pkt[src->fill->len++] = snmp_pkt_copy(pkt);
+    if (src->fill->len == MERGE_BATCH_SIZE) {
+	merge_handover(src);
+    }
+}
+
+static void*
+merge_source_main(void *arg)
+{
+    merge_source_t *src = (merge_source_t *) arg;
+    merge_t *m = src->merge;
+
+    src->fill = xmalloc(sizeof(merge_batch_t));
+    while (src->index < m->count) {
+	src->fill->index = src->index;
+	m->read(m->files[src->index], m->reader_data, merge_collect, src);
+	if (src->fill->len) {
+	    merge_handover(src);
+	}
+	pthread_mutex_lock(&m->lock);
+	src->index = m->next < m->count ? m->next++ : m->count;
+	pthread_mutex_unlock(&m->lock);
+    }
+    free(src->fill);
+    src->fill = NULL;
+
+    pthread_mutex_lock(&src->lock);
+    src->done = 1;
+    pthread_cond_signal(&src->cond);
+    pthread_mutex_unlock(&src->lock);
+    return NULL;
+}
+
+/*
+ * Return the next message of a source without removing it, waiting
+ * for the reading thread if necessary. Returns NULL once the source
+ * is exhausted. The time stamp of the source is updated to the time
+ * stamp of the message; messages without a time stamp inherit the
+ * time stamp of their predecessor.
+ */
+
+static snmp_packet_t*
+merge_source_peek(merge_source_t *src)
+{
+    snmp_packet_t *pkt;
+
+    while (! src->drain || src->next == src->drain->len) {
+	pthread_mutex_lock(&src->lock);
+	while (! src->ready && ! src->done) {
+	    pthread_cond_wait(&src->cond, &src->lock);
+	}
+	free(src->drain);
+	src->drain = src->ready;
+	src->ready = NULL;
+	src->next = 0;
+	pthread_cond_signal(&src->cond);
+	pthread_mutex_unlock(&src->lock);
+	if (! src->drain) {
+	    return NULL;
+	}
+    }
+
+    pkt = src->drain->pkt[src->next];
+    if (pkt->time_sec.attr.flags & SNMP_FLAG_VALUE) {
+	src->time_sec = pkt->time_sec.value;
+	src->time_usec = (pkt->time_usec.attr.flags & SNMP_FLAG_VALUE)
+	    ? pkt->time_usec.value : 0;
+    }
+    return pkt;
+}
+
+/*
+ * The merging thread keeps the sources which still have messages in
+ * a binary heap ordered by the time stamp of their next message. Ties
+ * are broken by the position of the file on the command line so that
+ * the output does not depend on thread scheduling.
+ */
+
+static inline int
+merge_before(merge_source_t *a, merge_source_t *b)
+{
+    if (a->time_sec != b->time_sec) {
+	return a->time_sec < b->time_sec;
+    }
+    if (a->time_usec != b->time_usec) {
+	return a->time_usec < b->time_usec;
+    }
+    return a->drain->index < b->drain->index;
+}
+
+static void
+merge_heap_down(merge_source_t **heap, unsigned len, unsigned i)
+{
+    merge_source_t *src = heap[i];
+    unsigned c;
+
+    while ((c = 2 * i + 1) < len) {
+	if (c + 1 < len && merge_before(heap[c + 1], heap[c])) {
+	    c++;
+	}
+	if (! merge_before(heap[c], src)) {
+	    break;
+	}
+	heap[i] = heap[c];
+	i = c;
+    }
+    heap[i] = src;
+}
+
+/*
+ * Entry point which reads count files with at most readers threads
+ * using the read function and calls the callback func for each SNMP
+ * message in time stamp order, passing the user data pointer as well.
+ * Within a file, messages keep their order, so files are expected to
+ * be sorted by time. If there are more files than readers, a file is
+ * only started when a thread has finished its previous file, so the
+ * files should be given in the order of their first message. A
+ * warning is printed if the merged messages are not in time stamp
+ * order. The callback is always called from the calling thread and
+ * the message is released when the callback returns.
+ */
+
+void
+snmp_merge_read_files(char **files, int count, unsigned readers,
+		      snmp_reader read, void *reader_data,
+		      snmp_callback func, void *user_data)
+{
+    merge_source_t *sources, **heap, *src;
+    snmp_packet_t *pkt;
+    merge_t merge;
+    unsigned i, len = 0;
+    uint32_t last_sec = 0, last_usec = 0;
+    int rc, warned = 0;
+
+    assert(files && read);
+
+    if (count <= 0) {
+	return;
+    }
+    if (readers == 0 || readers > (unsigned) count) {
+	readers = count;
+    }
+
+    merge.files = files;
+    merge.count = count;
+    merge.next = readers;
+    merge.read = read;
+    merge.reader_data = reader_data;
+    pthread_mutex_init(&merge.lock, NULL);
+
+    sources = xmalloc(readers * sizeof(merge_source_t));
+    heap = xmalloc(readers * sizeof(merge_source_t *));
+
+    for (i = 0; i < readers; i++) {
+	src = &sources[i];
+	src->merge = &merge;
+	src->index = i;
+	pthread_mutex_init(&src->lock, NULL);
+	pthread_cond_init(&src->cond, NULL);
+	rc = pthread_create(&src->thread, NULL, merge_source_main, src);
+	if (rc) {
+	    fprintf(stderr, "%s: failed to create thread: %s\n",
+		    progname, strerror(rc));
+	    exit(1);
+	}
+    }
+
+    for (i = 0; i < readers; i++) {
+	if (merge_source_peek(&sources[i])) {
+	    heap[len++] = &sources[i];
+	}
+    }
+    for (i = len / 2; i-- > 0; ) {
+	merge_heap_down(heap, len, i);
+    }
+
+    while (len) {
+	src = heap[0];
+	if (src->time_sec < last_sec
+	    || (src->time_sec == last_sec && src->time_usec < last_usec)) {
+	    if (! warned) {
+		fprintf(stderr, "%s: warning: input files overlap in time "
+			"or are not sorted - merged output is not in time "
+			"stamp order\n", progname);
+		warned = 1;
+	    }
+	} else {
+	    last_sec = src->time_sec;
+	    last_usec = src->time_usec;
+	}
+	pkt = src->drain->pkt[src->next++];
+	if (func) {
+	    func(pkt, user_data);
+	}
+	snmp_pkt_delete(pkt);
+	if (! merge_source_peek(src)) {
+	    heap[0] = heap[--len];
+	}
+	if (len) {
+	    merge_heap_down(heap, len, 0);
+	}
+    }
+
+    for (i = 0; i < readers; i++) {
+	pthread_join(sources[i].thread, NULL);
+	pthread_mutex_destroy(&sources[i].lock);
+	pthread_cond_destroy(&sources[i].cond);
+    }
+    pthread_mutex_destroy(&merge.lock);
+
+    free(heap);
+    free(sources);
+}
@@ -0,0 +1,158 @@
+/*
+ * oid.c --
+ *
+ * Decoding of BER encoded OID values. Long OIDs are decoded with SSE2
+ * instructions on x86 processors which support them; everything else
+ * uses a plain scalar loop.
+ *
+ * Copyright (c) 2006 Juergen Schoenwaelder
+ *
+ * $Id$
+ */
+
+#include "config.h"
+#include "snmp.h"
+
+#define OIDMUX		40	/* first sub-identifier is 1st*OIDMUX+2nd */
+#define OID_SHIFT7	7
+#define OID_MORE	0x80	/* continuation bit of a BER octet */
+
+/*
+ * Decode the BER encoded sub-identifiers of an OID value into out,
+ * which must have room for len + 1 elements, and return the number
+ * of sub-identifiers. If first is set, the first sub-identifier is
+ * split into the two components it encodes as 1st*OIDMUX+2nd (see
+ * X.690:1997 clause 8.19 for the details). An incomplete trailing
+ * sub-identifier is ignored.
+ */
+
+static unsigned
+oid_decode_scalar(uint32_t *out, const unsigned char *p, unsigned len,
+		  int first)
+{
+    uint32_t o = 0, s;
+    unsigned n = 0;
+
+    for (; len-- > 0; p++) {
+	o = (o << OID_SHIFT7) + (*p & ~OID_MORE);
+	if (*p & OID_MORE) continue;
+
+	if (first) {
+	    first = 0;
+	    s = o / OIDMUX;
+	    if (s > 2) s = 2;
+	    out[n++] = s;
+	    o -= s * OIDMUX;
+	}
+	out[n++] = o;
+	o = 0;
+    }
+    return n;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+/*
+ * Vectorized decoder. Most sub-identifiers in real traffic are below
+ * 128 and hence a single byte. We load 16 bytes, locate the
+ * continuation bits with a movemask and zero-extend the whole block
+ * to 32 bit values in one go. The run of single byte sub-identifiers
+ * at the start of the block is kept and the next multi-byte
+ * sub-identifier is decoded the scalar way. The block stores may
+ * write up to 16 elements beyond the decoded values, which is always
+ * within the len + 1 elements the caller provides.
+ *
+ * SSE2 is part of the x86-64 baseline. On 32-bit x86 the decoder is
+ * compiled for SSE2 anyway and only used if the processor has it.
+ * There is no AVX2 variant since runs of more than 16 single byte
+ * sub-identifiers are rare and a 32 byte block did not decode faster.
+ */
+
+#include <emmintrin.h>
+
+#define OID_SIMD
+#define OID_SIMD_MIN	24	/* shorter OIDs are faster the scalar way */
+
+static inline unsigned
+oid_decode_long(uint32_t *out, const unsigned char **pp,
+		const unsigned char *end)
+{
+    const unsigned char *p;
+    uint32_t o = 0;
+
+    for (p = *pp; p < end; p++) {
+	o = (o << OID_SHIFT7) + (*p & ~OID_MORE);
+	if (! (*p & OID_MORE)) {
+	    *out = o;
+	    *pp = p + 1;
+	    return 1;
+	}
+    }
+    *pp = end;
+    return 0;
+}
+
+__attribute__((target("sse2")))
+static unsigned
+oid_decode_sse2(uint32_t *out, const unsigned char *p, unsigned len)
+{
+    const unsigned char *end = p + len;
+    const __m128i zero = _mm_setzero_si128();
+    unsigned n = 0, k, cont;
+    __m128i x, lo, hi;
+
+    while (end - p >= 16) {
+	x = _mm_loadu_si128((const __m128i *) p);
+	cont = _mm_movemask_epi8(x);
+	lo = _mm_unpacklo_epi8(x, zero);
+	hi = _mm_unpackhi_epi8(x, zero);
+	_mm_storeu_si128((__m128i *) (out + n), _mm_unpacklo_epi16(lo, zero));
+	_mm_storeu_si128((__m128i *) (out + n + 4), _mm_unpackhi_epi16(lo, zero));
+	_mm_storeu_si128((__m128i *) (out + n + 8), _mm_unpacklo_epi16(hi, zero));
+	_mm_storeu_si128((__m128i *) (out + n + 12), _mm_unpackhi_epi16(hi, zero));
+	k = cont ? (unsigned) __builtin_ctz(cont) : 16;
+	n += k;
+	p += k;
+	if (k < 16) {
+	    n += oid_decode_long(out + n, &p, end);
+	}
+    }
+
+    return n + oid_decode_scalar(out + n, p, end - p, 0);
+}
+
+static inline int
+oid_have_sse2(void)
+{
+#ifdef __SSE2__
+    return 1;
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+#endif
+
+/*
+ * Decode an OID value, using the vectorized decoder for everything
+ * after the first sub-identifier if the OID is long enough.
+ */
+
+unsigned
+snmp_oid_decode(uint32_t *out, const unsigned char *p, unsigned len)
+{
+#ifdef OID_SIMD
+    const unsigned char *q = p, *end = p + len;
+    unsigned n;
+
+    if (len >= OID_SIMD_MIN && oid_have_sse2()) {
+	while (q < end && (*q & OID_MORE)) q++;
+	if (q < end) {
+	    q++;
+	    n = oid_decode_scalar(out, p, q - p, 1);
+	    return n + oid_decode_sse2(out + n, q, end - q);
+	}
+    }
+#endif
+    return oid_decode_scalar(out, p, len, 1);
+}
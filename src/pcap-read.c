@@ -37,14 +37,6 @@
 
 #define _GNU_SOURCE
 
-#undef HACK_AROUND_LIBNET_API_CHANGES
-
-#ifdef HACK_AROUND_LIBNET_API_CHANGES
-int libnet_build_ip() { return libnet_build_ipv4(); }
-int libnet_write_ip() { return libnet_write_raw_ipv4(); }
-int libnet_open_raw_sock() { return libnet_open_raw4(); }
-#endif
-
 #include "config.h"
 
 #include "snmp.h"
@@ -60,48 +52,67 @@ int libnet_open_raw_sock() { return libnet_open_raw4(); }
 #include <inttypes.h>
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <regex.h>
 
 #include <pcap.h>
 
-#include <nids.h>
-
-/* libnids does not allow to pass user data - this is not thread safe */
-static snmp_callback user_callback = NULL;
-static void *user_data = NULL;
-
 /*
- * Convert octet string values into something useful.
+ * All state of a pcap reader lives in a reader object which is passed
+ * down to every decoding function. Readers do not share anything, so
+ * several readers can run on separate threads at the same time.
  */
 
-static char*
-hexify(const int len, const u_char *str)
-{
-	static size_t size = 0;
-	static char *buffer = NULL;
-	int i;
-
-	if (len < 0) {
-		return NULL;
-	}
+#define IPFRAG_SIZE		65536
+
+typedef struct _arena_block {
+    struct _arena_block *next;
+    size_t		size;
+    size_t		used;
+    char		data[];
+} arena_block_t;
+
+typedef struct _ipfrag {
+    struct _ipfrag *next;
+    int		family;		/* AF_INET or AF_INET6 */
+    u_char	src[16];
+    u_char	dst[16];
+    uint32_t	id;
+    unsigned	proto;		/* next header of the fragmentable part */
+    time_t	time;		/* arrival time of the first fragment */
+    unsigned	len;		/* datagram length, 0 until the last fragment */
+    unsigned	blocks;		/* number of 8 byte blocks received */
+    u_char	map[IPFRAG_SIZE / 64];
+    u_char	data[IPFRAG_SIZE];
+} ipfrag_t;
+
+struct _snmp_pcap_reader {
+    snmp_callback func;		/* called for each SNMP message */
+    snmp_batch_callback batch_func; /* called for batches of messages */
+    void	*user_data;	/* passed on to the callback */
+    snmp_packet_t *batch;	/* messages not yet passed on */
+    unsigned	batch_len;
+    snmp_decode_t skip;		/* fields we do not decode */
+    int		truncated;	/* see asn1_parse() */
+    int		datalink;	/* data link type of the current input */
+    ipfrag_t	*ipfrag_list;	/* incomplete IPv4 and IPv6 datagrams */
+    unsigned	ipfrag_count;
+    arena_block_t *arena_head;	/* memory for the current message */
+    arena_block_t *arena_cur;
+};
 
-	if (size < 2*len+1) {
-		size = 2*len+1;
-		buffer = realloc(buffer, size);
-		if (! buffer) {
-			size = 0;
-			return NULL;
-		}
-	}
-	
-	for (i = 0; i < len; i++) {
-		snprintf(buffer+2*i, size-2*i, "%.2x", str[i]);
-	}
-	return buffer;
-}
+/* see snmp_pcap_set_decode() */
+static snmp_decode_t default_skip = SNMP_DECODE_ALL;
 
 /*
  * generic-trap values in the SNMP Trap-PDU
@@ -333,9 +344,6 @@ const char *SnmpVersion[] = {
 };
 
 
-static int truncated;
-
-
 /*
  * constants for ASN.1 decoding
  */
@@ -356,10 +364,9 @@ static int truncated;
 
 /*
  * truncated==1 means the packet was complete, but we don't have all of
- * it to decode.
+ * it to decode. The flag lives in the reader.
  */
-static int truncated;
-#define ifNotTruncated if (truncated) fputs("[|snmp]", stdout); else
+#define ifNotTruncated if (r->truncated) fputs("[|snmp]", stdout); else
 
 /*
  * This decodes the next ASN.1 object in the stream pointed to by "p"
@@ -370,7 +377,8 @@ static int truncated;
  * O/w, this returns the number of bytes parsed from "p".
  */
 static int
-asn1_parse(register const u_char *p, u_int len, struct be *elem)
+asn1_parse(snmp_pcap_reader_t *r,
+	   register const u_char *p, u_int len, struct be *elem)
 {
 	u_char form, class, id;
 	int i, hdr;
@@ -433,7 +441,7 @@ asn1_parse(register const u_char *p, u_int len, struct be *elem)
 			elem->asnlen = (elem->asnlen << ASN_SHIFT8) | *p++;
 	}
 	if (len < elem->asnlen) {
-		if (!truncated) {
+		if (!r->truncated) {
 			fprintf(stderr, "[len%d<asnlen%u]\n",
 				len, elem->asnlen);
 			return -1;
@@ -625,122 +633,82 @@ asn1_parse(register const u_char *p, u_int len, struct be *elem)
 }
 
 /*
- * Display the ASN.1 object represented by the BE object.
- * This used to be an integral part of asn1_parse() before the intermediate
- * BE form was added.
+ * Memory for a decoded packet (varbinds and OID values) comes from a
+ * bump arena. The arena is reset in O(1) after the user callback has
+ * returned, so the blocks are reused for the next packet. Callbacks
+ * which need a packet beyond the callback must use snmp_pkt_copy().
  */
-static const char*
-asn1_print(struct be *elem)
+
+#define ARENA_BLOCK_SIZE	(64 * 1024)
+#define ARENA_ALIGN		(2 * sizeof(void *))
+
+static arena_block_t*
+arena_block_new(size_t size, arena_block_t *next)
 {
-	static char buffer[1024];
-	char numbuf[20];
-	u_char *p = (u_char *)elem->data.raw;
-	uint32_t asnlen = elem->asnlen;
-
-	buffer[0] = 0;
-
-	switch (elem->type) {
-
-	case BE_OCTET:
-		return hexify(asnlen, p);
-
-	case BE_NULL:
-		return buffer;
-
-	case BE_OID: {
-	int o = 0, first = -1, i = asnlen;
-
-		for (; i-- > 0; p++) {
-			o = (o << ASN_SHIFT7) + (*p & ~ASN_BIT8);
-			if (*p & ASN_LONGLEN)
-			        continue;
-
-			/*
-			 * first subitem encodes two items with 1st*OIDMUX+2nd
-			 * (see X.690:1997 clause 8.19 for the details)
-			 */
-			if (first < 0) {
-			        int s;
-				first = 0;
-				s = o / OIDMUX;
-				if (s > 2) s = 2;
-				snprintf(buffer, sizeof(buffer), "%d", s);
-				/* OBJ_PRINT(s, first); */
-				o -= s * OIDMUX;
-			}
-			snprintf(numbuf, sizeof(numbuf), ".%d", o);
-			strcat(buffer, numbuf);
-			/* OBJ_PRINT(o, first); */
-			if (--first < 0)
-				first = 0;
-			o = 0;
-		}
-		return buffer;
-	}
-
-	case BE_INT:
-		sprintf(buffer, "%"PRIi32, elem->data.integer);
-		return buffer;
-
-	case BE_UNS:
-	case BE_COUNTER:
-	case BE_TIMETICKS:
-		sprintf(buffer, "%"PRIu32, elem->data.uns);
-		return buffer;
-
-	case BE_UNS64:
-		sprintf(buffer, "%"PRIu64, elem->data.uns64);
-		return buffer;
-
-	case BE_STR: {
-#if 0
-		register int printable = 1, first = 1;
-		const u_char *p = elem->data.str;
-		for (i = asnlen; printable && i-- > 0; p++)
-			printable = isprint(*p) || isspace(*p);
-		p = elem->data.str;
-		if (printable) {
-			snprintf(buffer, sizeof(buffer), "%.*s",
-				 asnlen, elem->data.str);
-			return buffer;
-		} else
-			for (i = asnlen; i-- > 0; p++) {
-				fprintf(stderr, first ? "(fix me)%.2x" : "_%.2x", *p);
-				first = 0;
-			}
+    arena_block_t *b;
 
-#else
-		return hexify(asnlen, p);
-#endif
-		break;
-	}
+    b = malloc(sizeof(arena_block_t) + size);
+    if (! b) {
+	abort();
+    }
+    b->next = next;
+    b->size = size;
+    b->used = 0;
+    return b;
+}
 
-	case BE_SEQ:
-		return NULL;
+static void*
+arena_alloc(snmp_pcap_reader_t *r, size_t size)
+{
+    arena_block_t *b = r->arena_cur;
+    void *p;
+
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    if (! b) {
+	b = r->arena_head = arena_block_new(size > ARENA_BLOCK_SIZE
+					 ? size : ARENA_BLOCK_SIZE, NULL);
+    } else if (b->size - b->used < size) {
+	if (! b->next || b->next->size < size) {
+	    b->next = arena_block_new(size > ARENA_BLOCK_SIZE
+				      ? size : ARENA_BLOCK_SIZE, b->next);
+	}
+	b = b->next;
+	b->used = 0;
+    }
+    r->arena_cur = b;
 
-	case BE_INETADDR:
-		if (asnlen != ASNLEN_INETADDR)
-			fprintf(stderr, "[inetaddr len!=%d]\n",
-				ASNLEN_INETADDR);
-		sprintf(buffer, "%u.%u.%u.%u", p[0], p[1], p[2], p[3]);
-		return buffer;
+    p = b->data + b->used;
+    b->used += size;
+    return p;
+}
 
-	case BE_NOSUCHOBJECT:
-	case BE_NOSUCHINST:
-	case BE_ENDOFMIBVIEW:
-	        return Class[EXCEPTIONS].Id[elem->id];
+static void*
+arena_calloc(snmp_pcap_reader_t *r, size_t size)
+{
+    return memset(arena_alloc(r, size), 0, size);
+}
 
-	case BE_PDU:
-		return Class[CONTEXT].Id[elem->id];
+static inline void
+arena_reset(snmp_pcap_reader_t *r)
+{
+    r->arena_cur = r->arena_head;
+    if (r->arena_cur) {
+	r->arena_cur->used = 0;
+    }
+}
 
-	case BE_ANY:
-		fputs("[BE_ANY!?]\n", stderr);
-		return NULL;
+static void
+arena_free(snmp_pcap_reader_t *r)
+{
+    arena_block_t *b;
 
-	default:
-		fputs("[be!?]\n", stderr);
-		return NULL;
-	}
+    while (r->arena_head) {
+	b = r->arena_head;
+	r->arena_head = b->next;
+	free(b);
+    }
+    r->arena_cur = NULL;
 }
 
 /*
@@ -813,41 +781,13 @@ set_octs(snmp_octs_t *v, int count, struct be *elem)
  */
 
 static void
-set_oid(snmp_oid_t *v, int count, struct be *elem)
+set_oid(snmp_pcap_reader_t *r, snmp_oid_t *v, int count, struct be *elem)
 {
-    uint32_t o = 0;
-    int first = -1, i = elem->asnlen;
-    u_char *p = (u_char *)elem->data.raw;
-    
-    v->value = malloc((1 + elem->asnlen) * sizeof(uint32_t));
-    if (! v->value) {
-	abort();
-    }
-    v->len = 0;
+    v->value = arena_alloc(r, (1 + elem->asnlen) * sizeof(uint32_t));
+    v->len = snmp_oid_decode(v->value,
+			     (const unsigned char *) elem->data.raw,
+			     elem->asnlen);
 
-    for (; i-- > 0; p++) {
-	o = (o << ASN_SHIFT7) + (*p & ~ASN_BIT8);
-	if (*p & ASN_LONGLEN) continue;
-
-	/*
-	 * first subitem encodes two items with 1st*OIDMUX+2nd
-	 * (see X.690:1997 clause 8.19 for the details)
-	 */
-	if (first < 0) {
-	    uint32_t s;
-	    first = 0;
-	    s = o / OIDMUX;
-	    if (s > 2) s = 2;
-	    v->value[v->len++] = s;
-	    o -= s * OIDMUX;
-	}
-	v->value[v->len++] = o;
-	if (--first < 0) {
-	    first = 0;
-	}
-	o = 0;
-    }
-    
     v->attr.blen = count;
     v->attr.vlen = elem->asnlen;
     v->attr.flags = SNMP_FLAG_VALUE | SNMP_FLAG_BLEN | SNMP_FLAG_VLEN;
@@ -867,20 +807,122 @@ set_ipaddr(snmp_ipaddr_t *v, int count, struct be *elem)
 }
 
 
+/*
+ * Helper to record only the lengths of a value which is not decoded.
+ */
+
+static void
+set_length(snmp_attr_t *attr, int count, struct be *elem)
+{
+    attr->blen = count;
+    attr->vlen = elem->asnlen;
+    attr->flags = SNMP_FLAG_BLEN | SNMP_FLAG_VLEN;
+}
+
+/*
+ * Map the BER element type of a varbind value to the varbind type.
+ * Unknown element types map to 0.
+ */
+
+static uint32_t
+varbind_type(int type)
+{
+    switch (type) {
+    case BE_NULL:		return SNMP_TYPE_NULL;
+    case BE_INT:		return SNMP_TYPE_INT32;
+    case BE_UNS:		return SNMP_TYPE_UINT32;
+    case BE_COUNTER:		return SNMP_TYPE_COUNTER32;
+    case BE_TIMETICKS:		return SNMP_TYPE_TIMETICKS;
+    case BE_UNS64:		return SNMP_TYPE_COUNTER64;
+    case BE_INETADDR:		return SNMP_TYPE_IPADDR;
+    case BE_STR:		return SNMP_TYPE_OCTS;
+    case BE_OID:		return SNMP_TYPE_OID;
+    case BE_OCTET:		return SNMP_TYPE_OPAQUE;
+    case BE_NOSUCHOBJECT:	return SNMP_TYPE_NO_SUCH_OBJ;
+    case BE_NOSUCHINST:		return SNMP_TYPE_NO_SUCH_INST;
+    case BE_ENDOFMIBVIEW:	return SNMP_TYPE_END_MIB_VIEW;
+    default:			return 0;
+    }
+}
+
+/*
+ * Return the attributes of the value of a varbind, depending on the
+ * type of the varbind.
+ */
+
+static snmp_attr_t*
+varbind_value_attr(snmp_varbind_t *vb)
+{
+    switch (vb->type) {
+    case SNMP_TYPE_INT32:
+	return &vb->value.i32.attr;
+    case SNMP_TYPE_UINT32:
+    case SNMP_TYPE_COUNTER32:
+    case SNMP_TYPE_TIMETICKS:
+	return &vb->value.u32.attr;
+    case SNMP_TYPE_COUNTER64:
+	return &vb->value.u64.attr;
+    case SNMP_TYPE_IPADDR:
+	return &vb->value.ip.attr;
+    case SNMP_TYPE_OCTS:
+    case SNMP_TYPE_OPAQUE:
+	return &vb->value.octs.attr;
+    case SNMP_TYPE_OID:
+	return &vb->value.oid.attr;
+    default:
+	return &vb->value.null.attr;
+    }
+}
+
+/*
+ * Helper to fill the value of a varbind with a known type.
+ */
+
+static void
+set_value(snmp_pcap_reader_t *r, snmp_varbind_t *vb, int count, struct be *elem)
+{
+    switch (vb->type) {
+    case SNMP_TYPE_INT32:
+	set_int32(&vb->value.i32, count, elem);
+	break;
+    case SNMP_TYPE_UINT32:
+    case SNMP_TYPE_COUNTER32:
+    case SNMP_TYPE_TIMETICKS:
+	set_uint32(&vb->value.u32, count, elem);
+	break;
+    case SNMP_TYPE_COUNTER64:
+	set_uint64(&vb->value.u64, count, elem);
+	break;
+    case SNMP_TYPE_IPADDR:
+	set_ipaddr(&vb->value.ip, count, elem);
+	break;
+    case SNMP_TYPE_OCTS:
+    case SNMP_TYPE_OPAQUE:
+	set_octs(&vb->value.octs, count, elem);
+	break;
+    case SNMP_TYPE_OID:
+	set_oid(r, &vb->value.oid, count, elem);
+	break;
+    default:
+	set_null(&vb->value.null, count, elem);
+	break;
+    }
+}
 
 /*
  * Decode an SNMP varbind list.
  */
 
 static void
-varbind_print(u_char pduid, const u_char *np, u_int length, snmp_packet_t *pkt)
+varbind_print(snmp_pcap_reader_t *r,
+	      u_char pduid, const u_char *np, u_int length, snmp_packet_t *pkt)
 {
 	struct be elem;
 	int count = 0, ind;
 	snmp_varbind_t **lvbp;
 
 	/* Sequence of varBind */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_SEQ) {
 		fputs("[!SEQ of varbind]\n", stderr);
@@ -897,6 +939,9 @@ varbind_print(u_char pduid, const u_char *np, u_int length, snmp_packet_t *pkt)
 	pkt->snmp.scoped_pdu.pdu.varbindings.attr.flags
 		= SNMP_FLAG_VALUE | SNMP_FLAG_BLEN | SNMP_FLAG_VLEN;
 
+	if (r->skip & SNMP_SKIP_VARBINDS)
+		return;
+
 	length = elem.asnlen;
 	np = (u_char *)elem.data.raw;
 
@@ -907,14 +952,10 @@ varbind_print(u_char pduid, const u_char *np, u_int length, snmp_packet_t *pkt)
 		u_int vblength;
 		snmp_varbind_t *vb;
 
-		vb = (snmp_varbind_t *) malloc(sizeof(snmp_varbind_t));
-		if (! vb) {
-			abort();
-		}
-		memset(vb, 0, sizeof(snmp_varbind_t));
+		vb = arena_calloc(r, sizeof(snmp_varbind_t));
 
 		/* Sequence */
-		if ((count = asn1_parse(np, length, &elem)) < 0)
+		if ((count = asn1_parse(r, np, length, &elem)) < 0)
 			return;
 		if (elem.type != BE_SEQ) {
 			fputs("[!varbind]\n", stderr);
@@ -932,91 +973,34 @@ varbind_print(u_char pduid, const u_char *np, u_int length, snmp_packet_t *pkt)
 		np = (u_char *)elem.data.raw;
 
 		/* objName (OID) */
-		if ((count = asn1_parse(np, length, &elem)) < 0)
+		if ((count = asn1_parse(r, np, length, &elem)) < 0)
 			return;
 		if (elem.type != BE_OID) {
 			fputs("[objName!=OID]\n", stderr);
 			return;
 		}
 
-		set_oid(&vb->name, count, &elem);
+		if (r->skip & SNMP_SKIP_NAMES) {
+			set_length(&vb->name.attr, count, &elem);
+		} else {
+			set_oid(r, &vb->name, count, &elem);
+		}
 
 		length -= count;
 		np += count;
 
 		/* objVal (ANY) */
-		if ((count = asn1_parse(np, length, &elem)) < 0)
+		if ((count = asn1_parse(r, np, length, &elem)) < 0)
 			return;
 
-		switch (elem.type) {
-		case BE_NULL:
-		    vb->type = SNMP_TYPE_NULL;
-		    vb->attr.flags |= SNMP_FLAG_VALUE;
-		    set_null(&vb->value.null, count, &elem);
-		    break;
-		case BE_INT:
-		    vb->type = SNMP_TYPE_INT32;
-		    vb->attr.flags |= SNMP_FLAG_VALUE;
-		    set_int32(&vb->value.i32, count, &elem);
-		    break;
-		case BE_UNS:
-		    vb->type = SNMP_TYPE_UINT32;
-		    vb->attr.flags |= SNMP_FLAG_VALUE;
-		    set_uint32(&vb->value.u32, count, &elem);
-		    break;
-		case BE_COUNTER:
-		    vb->type = SNMP_TYPE_COUNTER32;
-		    vb->attr.flags |= SNMP_FLAG_VALUE;
-		    set_uint32(&vb->value.u32, count, &elem);
-		    break;
-		case BE_TIMETICKS:
-		    vb->type = SNMP_TYPE_TIMETICKS;
-		    vb->attr.flags |= SNMP_FLAG_VALUE;
-		    set_uint32(&vb->value.u32, count, &elem);
-		    break;
-		case BE_UNS64:
-		    vb->type = SNMP_TYPE_COUNTER64;
-		    vb->attr.flags |= SNMP_FLAG_VALUE;
-		    set_uint64(&vb->value.u64, count, &elem);
-		    break;
-		case BE_INETADDR:
-		    vb->type = SNMP_TYPE_IPADDR;
-		    vb->attr.flags |= SNMP_FLAG_VALUE;
-		    set_ipaddr(&vb->value.ip, count, &elem);
-		    break;
-		case BE_STR:
-		    vb->type = SNMP_TYPE_OCTS;
-		    vb->attr.flags |= SNMP_FLAG_VALUE;
-		    set_octs(&vb->value.octs, count, &elem);
-		    break;
-		case BE_OID:
-		    vb->type = SNMP_TYPE_OID;
-		    vb->attr.flags |= SNMP_FLAG_VALUE;
-		    set_oid(&vb->value.oid, count, &elem);
-		    break;
-		case BE_OCTET:
-		    vb->type = SNMP_TYPE_OPAQUE;
-		    vb->attr.flags |= SNMP_FLAG_VALUE;
-		    set_octs(&vb->value.octs, count, &elem);
-		    break;
-		case BE_NOSUCHOBJECT:
-		    vb->type = SNMP_TYPE_NO_SUCH_OBJ;
+		vb->type = varbind_type(elem.type);
+		if (vb->type) {
 		    vb->attr.flags |= SNMP_FLAG_VALUE;
-		    set_null(&vb->value.null, count, &elem);
-		    break;
-		case BE_NOSUCHINST:
-		    vb->type = SNMP_TYPE_NO_SUCH_INST;
-		    vb->attr.flags |= SNMP_FLAG_VALUE;
-		    set_null(&vb->value.null, count, &elem);
-		    break;
-		case BE_ENDOFMIBVIEW:
-		    vb->type = SNMP_TYPE_END_MIB_VIEW;
-		    vb->attr.flags |= SNMP_FLAG_VALUE;
-		    set_null(&vb->value.null, count, &elem);
-		    break;
-		default:
-		    /* xxx ??? xxx */
-		    break;
+		    if (snmp_skip_value(r->skip, vb->type)) {
+			set_length(varbind_value_attr(vb), count, &elem);
+		    } else {
+			set_value(r, vb, count, &elem);
+		    }
 		}
 
 		length = vblength;
@@ -1033,13 +1017,14 @@ varbind_print(u_char pduid, const u_char *np, u_int length, snmp_packet_t *pkt)
  */
 
 static void
-snmppdu_print(u_char pduid, const u_char *np, u_int length, snmp_packet_t *pkt)
+snmppdu_print(snmp_pcap_reader_t *r,
+	      u_char pduid, const u_char *np, u_int length, snmp_packet_t *pkt)
 {
 	struct be elem;
 	int count = 0;
 
 	/* reqId (Integer) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_INT) {
 		fputs("[reqId!=INT]\n", stderr);
@@ -1052,7 +1037,7 @@ snmppdu_print(u_char pduid, const u_char *np, u_int length, snmp_packet_t *pkt)
 	np += count;
 
 	/* errorStatus (Integer) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_INT) {
 		fputs("[errorStatus!=INT]\n", stderr);
@@ -1065,7 +1050,7 @@ snmppdu_print(u_char pduid, const u_char *np, u_int length, snmp_packet_t *pkt)
 	np += count;
 
 	/* errorIndex (Integer) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_INT) {
 		fputs("[errorIndex!=INT]\n", stderr);
@@ -1077,7 +1062,7 @@ snmppdu_print(u_char pduid, const u_char *np, u_int length, snmp_packet_t *pkt)
 	length -= count;
 	np += count;
 
-	varbind_print(pduid, np, length, pkt);
+	varbind_print(r, pduid, np, length, pkt);
 	return;
 }
 
@@ -1086,26 +1071,32 @@ snmppdu_print(u_char pduid, const u_char *np, u_int length, snmp_packet_t *pkt)
  */
 
 static void
-trappdu_print(const u_char *np, u_int length, snmp_packet_t *pkt)
+trappdu_print(snmp_pcap_reader_t *r,
+	      const u_char *np, u_int length, snmp_packet_t *pkt)
 {
 	struct be elem;
 	int count = 0;
 
 	/* enterprise (oid) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_OID) {
 		fputs("[enterprise!=OID]\n", stderr);
 		return;
 	}
 
-	set_oid(&pkt->snmp.scoped_pdu.pdu.enterprise, count, &elem);
+	if (r->skip & SNMP_SKIP_ENTERPRISE) {
+		set_length(&pkt->snmp.scoped_pdu.pdu.enterprise.attr,
+			   count, &elem);
+	} else {
+		set_oid(r, &pkt->snmp.scoped_pdu.pdu.enterprise, count, &elem);
+	}
 
 	length -= count;
 	np += count;
 
 	/* agent-addr (inetaddr) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_INETADDR) {
 		fputs("[agent-addr!=INETADDR]\n", stderr);
@@ -1118,7 +1109,7 @@ trappdu_print(const u_char *np, u_int length, snmp_packet_t *pkt)
 	np += count;
 
 	/* generic-trap (Integer) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_INT) {
 		fputs("[generic-trap!=INT]\n", stderr);
@@ -1131,7 +1122,7 @@ trappdu_print(const u_char *np, u_int length, snmp_packet_t *pkt)
 	np += count;
 
 	/* specific-trap (Integer) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_INT) {
 		fputs("[specific-trap!=INT]\n", stderr);
@@ -1144,7 +1135,7 @@ trappdu_print(const u_char *np, u_int length, snmp_packet_t *pkt)
 	np += count;
 
 	/* time-stamp (TimeTicks) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_TIMETICKS) {
 		fputs("[time-stamp!=TIMETICKS]\n", stderr);
@@ -1156,7 +1147,7 @@ trappdu_print(const u_char *np, u_int length, snmp_packet_t *pkt)
 	length -= count;
 	np += count;
 
-	varbind_print(TRAP, np, length, pkt);
+	varbind_print(r, TRAP, np, length, pkt);
 	return;
 }
 
@@ -1165,13 +1156,14 @@ trappdu_print(const u_char *np, u_int length, snmp_packet_t *pkt)
  */
 
 static void
-pdu_print(const u_char *np, u_int length, int version, snmp_packet_t *pkt)
+pdu_print(snmp_pcap_reader_t *r,
+	  const u_char *np, u_int length, int version, snmp_packet_t *pkt)
 {
 	struct be pdu;
 	int count = 0;
 
 	/* PDU (Context) */
-	if ((count = asn1_parse(np, length, &pdu)) < 0)
+	if ((count = asn1_parse(r, np, length, &pdu)) < 0)
 		return;
 	if (pdu.type != BE_PDU) {
 		fputs("[no PDU]\n", stderr);
@@ -1236,7 +1228,7 @@ pdu_print(const u_char *np, u_int length, int version, snmp_packet_t *pkt)
 
 	switch (pdu.id) {
 	case TRAP:
-		trappdu_print(np, length, pkt);
+		trappdu_print(r, np, length, pkt);
 		break;
 	case GETREQ:
 	case GETNEXTREQ:
@@ -1246,7 +1238,7 @@ pdu_print(const u_char *np, u_int length, int version, snmp_packet_t *pkt)
 	case INFORMREQ:
 	case V2TRAP:
 	case REPORT:
-		snmppdu_print(pdu.id, np, length, pkt);
+		snmppdu_print(r, pdu.id, np, length, pkt);
 		break;
 	}
 }
@@ -1256,13 +1248,14 @@ pdu_print(const u_char *np, u_int length, int version, snmp_packet_t *pkt)
  */
 
 static void
-scopedpdu_print(const u_char *np, u_int length, int version, snmp_packet_t *pkt)
+scopedpdu_print(snmp_pcap_reader_t *r,
+		const u_char *np, u_int length, int version, snmp_packet_t *pkt)
 {
 	struct be elem;
 	int count = 0;
 
 	/* Sequence */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_SEQ) {
 		fputs("[!scoped PDU]\n", stderr);
@@ -1280,7 +1273,7 @@ scopedpdu_print(const u_char *np, u_int length, int version, snmp_packet_t *pkt)
 	np = (u_char *)elem.data.raw;
 
 	/* contextEngineID (OCTET STRING) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_STR) {
 		fputs("[contextEngineID!=STR]\n", stderr);
@@ -1293,7 +1286,7 @@ scopedpdu_print(const u_char *np, u_int length, int version, snmp_packet_t *pkt)
 	np += count;
 
 	/* contextName (OCTET STRING) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_STR) {
 		fputs("[contextName!=STR]\n", stderr);
@@ -1305,7 +1298,7 @@ scopedpdu_print(const u_char *np, u_int length, int version, snmp_packet_t *pkt)
 	length -= count;
 	np += count;
 
-	pdu_print(np, length, version, pkt);
+	pdu_print(r, np, length, version, pkt);
 }
 
 /*
@@ -1314,25 +1307,30 @@ scopedpdu_print(const u_char *np, u_int length, int version, snmp_packet_t *pkt)
  */
 
 static void
-v12msg_parse(const u_char *np, u_int length, int version, snmp_packet_t *pkt)
+v12msg_parse(snmp_pcap_reader_t *r,
+	     const u_char *np, u_int length, int version, snmp_packet_t *pkt)
 {
 	struct be elem;
 	int count = 0;
 
 	/* Community (String) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_STR) {
 		fputs("[comm!=STR]\n", stderr);
 		return;
 	}
 
-	set_octs(&pkt->snmp.community, count, &elem);
+	if (r->skip & SNMP_SKIP_COMMUNITY) {
+		set_length(&pkt->snmp.community.attr, count, &elem);
+	} else {
+		set_octs(&pkt->snmp.community, count, &elem);
+	}
 
 	length -= count;
 	np += count;
 
-	pdu_print(np, length, version, pkt);
+	pdu_print(r, np, length, version, pkt);
 }
 
 /*
@@ -1341,13 +1339,14 @@ v12msg_parse(const u_char *np, u_int length, int version, snmp_packet_t *pkt)
  */
 
 static void
-usm_print(const u_char *np, u_int length, snmp_packet_t *pkt)
+usm_print(snmp_pcap_reader_t *r,
+	  const u_char *np, u_int length, snmp_packet_t *pkt)
 {
         struct be elem;
 	int count = 0;
 
 	/* Sequence */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_SEQ) {
 		fputs("[!usm]\n", stderr);
@@ -1363,7 +1362,7 @@ usm_print(const u_char *np, u_int length, snmp_packet_t *pkt)
 	np = (u_char *)elem.data.raw;
 
 	/* msgAuthoritativeEngineID (OCTET STRING) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_STR) {
 		fputs("[msgAuthoritativeEngineID!=STR]\n", stderr);
@@ -1376,7 +1375,7 @@ usm_print(const u_char *np, u_int length, snmp_packet_t *pkt)
 	np += count;
 
 	/* msgAuthoritativeEngineBoots (INTEGER) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_INT) {
 		fputs("[msgAuthoritativeEngineBoots!=INT]\n", stderr);
@@ -1389,7 +1388,7 @@ usm_print(const u_char *np, u_int length, snmp_packet_t *pkt)
 	np += count;
 
 	/* msgAuthoritativeEngineTime (INTEGER) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_INT) {
 		fputs("[msgAuthoritativeEngineTime!=INT]\n", stderr);
@@ -1402,7 +1401,7 @@ usm_print(const u_char *np, u_int length, snmp_packet_t *pkt)
 	np += count;
 
 	/* msgUserName (OCTET STRING) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_STR) {
 		fputs("[msgUserName!=STR]\n", stderr);
@@ -1415,7 +1414,7 @@ usm_print(const u_char *np, u_int length, snmp_packet_t *pkt)
         np += count;
 
 	/* msgAuthenticationParameters (OCTET STRING) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_STR) {
 		fputs("[msgAuthenticationParameters!=STR]\n", stderr);
@@ -1428,7 +1427,7 @@ usm_print(const u_char *np, u_int length, snmp_packet_t *pkt)
         np += count;
 
 	/* msgPrivacyParameters (OCTET STRING) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_STR) {
 		fputs("[msgPrivacyParameters!=STR]\n", stderr);
@@ -1450,7 +1449,8 @@ usm_print(const u_char *np, u_int length, snmp_packet_t *pkt)
  */
 
 static void
-v3msg_print(const u_char *np, u_int length, snmp_packet_t *pkt)
+v3msg_print(snmp_pcap_reader_t *r,
+	    const u_char *np, u_int length, snmp_packet_t *pkt)
 {
 	struct be elem;
 	int count = 0;
@@ -1460,11 +1460,10 @@ v3msg_print(const u_char *np, u_int length, snmp_packet_t *pkt)
 	int xlength = length;
 
 	/* Sequence */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_SEQ) {
 		fputs("[!message]", stderr);
-		asn1_print(&elem);
 		return;
 	}
 
@@ -1477,7 +1476,7 @@ v3msg_print(const u_char *np, u_int length, snmp_packet_t *pkt)
 	np = (u_char *)elem.data.raw;
 
 	/* msgID (INTEGER) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_INT) {
 		fputs("[msgID!=INT]\n", stderr);
@@ -1490,7 +1489,7 @@ v3msg_print(const u_char *np, u_int length, snmp_packet_t *pkt)
 	np += count;
 
 	/* msgMaxSize (INTEGER) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_INT) {
 		fputs("[msgMaxSize!=INT]\n", stderr);
@@ -1503,7 +1502,7 @@ v3msg_print(const u_char *np, u_int length, snmp_packet_t *pkt)
 	np += count;
 
 	/* msgFlags (OCTET STRING) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_STR) {
 		fputs("[msgFlags!=STR]\n", stderr);
@@ -1526,11 +1525,10 @@ v3msg_print(const u_char *np, u_int length, snmp_packet_t *pkt)
 	np += count;
 
 	/* msgSecurityModel (INTEGER) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_INT) {
 		fputs("[msgSecurityModel!=INT]\n", stderr);
-		asn1_print(&elem);
 		return;
 	}
 	
@@ -1551,21 +1549,20 @@ v3msg_print(const u_char *np, u_int length, snmp_packet_t *pkt)
 	/* xxx */
 
 	/* msgSecurityParameters (OCTET STRING) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_STR) {
 		fputs("[msgSecurityParameters!=STR]", stdout);
-		asn1_print(&elem);
 		return;
 	}
 	length -= count;
 	np += count;
 
 	if (model == 3) {
-		usm_print(elem.data.str, elem.asnlen, pkt);
+		usm_print(r, elem.data.str, elem.asnlen, pkt);
 	}
 
-	scopedpdu_print(np, length, 3, pkt);
+	scopedpdu_print(r, np, length, 3, pkt);
 }
 
 /*
@@ -1575,16 +1572,17 @@ v3msg_print(const u_char *np, u_int length, snmp_packet_t *pkt)
  */
 
 static void
-snmp_parse(const u_char *np, u_int length, snmp_packet_t *pkt)
+snmp_parse(snmp_pcap_reader_t *r,
+	   const u_char *np, u_int length, snmp_packet_t *pkt)
 {
 	struct be elem;
 	int count = 0;
 	int version = 0;
 
-	truncated = 0;
+	r->truncated = 0;
 
 	/* initial Sequence */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_SEQ) {
 		fputs("[!init SEQ]\n", stderr);
@@ -1603,7 +1601,7 @@ snmp_parse(const u_char *np, u_int length, snmp_packet_t *pkt)
 	np = (u_char *)elem.data.raw;
 
 	/* Version (INTEGER) */
-	if ((count = asn1_parse(np, length, &elem)) < 0)
+	if ((count = asn1_parse(r, np, length, &elem)) < 0)
 		return;
 	if (elem.type != BE_INT) {
 		fputs("[version!=INT]\n", stderr);
@@ -1628,10 +1626,10 @@ snmp_parse(const u_char *np, u_int length, snmp_packet_t *pkt)
 	switch (version) {
 	case SNMP_VERSION_1:
         case SNMP_VERSION_2:
-		v12msg_parse(np, length, version, pkt);
+		v12msg_parse(r, np, length, version, pkt);
 		break;
 	case SNMP_VERSION_3:
-		v3msg_print(np, length, pkt);
+		v3msg_print(r, np, length, pkt);
 		break;
 	default:
 	        fprintf(stderr, "[version = %d]\n", elem.data.integer);
@@ -1640,191 +1638,1094 @@ snmp_parse(const u_char *np, u_int length, snmp_packet_t *pkt)
 }
 
 /*
- * Deallocate memory for a parsed SNMP packet.
+ * The pcap reader decodes the link, network and transport headers
+ * itself and hands the UDP payload directly to snmp_parse(). Only
+ * IPv4 and IPv6 fragments take a detour through the small reassembly
+ * queue below, which is part of the reader state.
  */
 
-static void
-snmp_free(snmp_packet_t *pkt)
+#define ETHTYPE_IPV4		0x0800
+#define ETHTYPE_IPV6		0x86dd
+#define ETHTYPE_VLAN		0x8100
+#define ETHTYPE_QINQ		0x88a8
+
+#define IPV4_MF			0x2000
+#define IPV4_OFFMASK		0x1fff
+#define IPV6_MF			0x0001
+
+#define IPFRAG_TIMEOUT		30	/* seconds, same as libnids/linux */
+#define IPFRAG_MAX		64	/* max. number of incomplete datagrams */
+
+static inline unsigned
+get16(const u_char *p)
 {
-    snmp_varbind_t *varbind, *last_varbind;
+    return (p[0] << 8) | p[1];
+}
+
+/*
+ * Release the varbinds which a callback added to a decoded message
+ * with malloc(), for example snmp_pkt_v1tov2(), before the arena is
+ * reset. They carry the SNMP_FLAG_DYNAMIC flag.
+ */
 
-    varbind = pkt->snmp.scoped_pdu.pdu.varbindings.varbind;
+static void
+pkt_free_dynamic(snmp_packet_t *pkt)
+{
+    snmp_varbind_t *vb, *q;
 
-    while (varbind) {
-	if (varbind->name.value) {
-	    free(varbind->name.value);
+    for (vb = pkt->snmp.scoped_pdu.pdu.varbindings.varbind; vb; vb = q) {
+	q = vb->next;
+	if (! (vb->attr.flags & SNMP_FLAG_DYNAMIC)) {
+	    continue;
+	}
+	if (vb->name.attr.flags & SNMP_FLAG_DYNAMIC) {
+	    free(vb->name.value);
 	}
-	if (varbind->type == SNMP_TYPE_OID && varbind->value.oid.value) {
-	    free(varbind->value.oid.value);
+	if ((vb->type == SNMP_TYPE_OCTS || vb->type == SNMP_TYPE_OPAQUE)
+	    && vb->value.octs.attr.flags & SNMP_FLAG_DYNAMIC) {
+	    free(vb->value.octs.value);
 	}
-	last_varbind = varbind;
-	varbind = varbind->next;
-	free(last_varbind);
+	if (vb->type == SNMP_TYPE_OID
+	    && vb->value.oid.attr.flags & SNMP_FLAG_DYNAMIC) {
+	    free(vb->value.oid.value);
+	}
+	free(vb);
     }
 }
 
 /*
- * Callback invoked by libnids for every UDP datagram that we have
- * received. Note that the datagram might have been reassembled from
- * multiple IP packets. The time information belongs to the last
- * fragment we have received.
+ * Pass the collected batch of messages on to the batch callback. The
+ * decoded messages point into the arena and into the packet data, so
+ * this must be called before either of them goes away.
  */
 
 static void
-udp_callback(struct tuple4 * addr, char * buf, int len, void *ignore)
+batch_flush(snmp_pcap_reader_t *r)
+{
+    snmp_packet_t *pkts[SNMP_BATCH_SIZE];
+    unsigned i;
+
+    if (! r->batch_len) {
+	return;
+    }
+    for (i = 0; i < r->batch_len; i++) {
+	pkts[i] = &r->batch[i];
+    }
+    r->batch_func(pkts, r->batch_len, r->user_data);
+    for (i = 0; i < r->batch_len; i++) {
+	pkt_free_dynamic(&r->batch[i]);
+    }
+    r->batch_len = 0;
+    arena_reset(r);
+}
+
+/*
+ * Fill the transport information of a packet, call the SNMP decoder
+ * and pass the result on to the user callback. In batch mode, the
+ * message is added to the current batch instead.
+ */
+
+static void
+udp_deliver(snmp_pcap_reader_t *r, const struct pcap_pkthdr *hdr,
+	    const u_char *saddr, const u_char *daddr, int family,
+	    const u_char *udp, unsigned len)
 {
     snmp_packet_t _pkt, *pkt = &_pkt;
+    unsigned ulen;
 
+    if (len < 8) {
+	return;
+    }
+    ulen = get16(udp + 4);
+    if (ulen < 8 || ulen > len) {
+	return;
+    }
+
+    if (r->batch) {
+	pkt = &r->batch[r->batch_len];
+    }
     memset(pkt, 0, sizeof(snmp_packet_t));
     
-    pkt->time_sec.value = nids_last_pcap_header->ts.tv_sec;
+    pkt->time_sec.value = hdr->ts.tv_sec;
     pkt->time_sec.attr.flags |= SNMP_FLAG_VALUE;
-    pkt->time_usec.value = nids_last_pcap_header->ts.tv_usec;
+    pkt->time_usec.value = hdr->ts.tv_usec;
     pkt->time_usec.attr.flags |= SNMP_FLAG_VALUE;
 
-    pkt->src_addr.value = addr->saddr;
-    pkt->src_addr.attr.flags |= SNMP_FLAG_VALUE;
-    pkt->src_port.value = addr->source;
+    if (family == AF_INET) {
+	memcpy(&pkt->src_addr.value, saddr, 4);
+	pkt->src_addr.attr.flags |= SNMP_FLAG_VALUE;
+	memcpy(&pkt->dst_addr.value, daddr, 4);
+	pkt->dst_addr.attr.flags |= SNMP_FLAG_VALUE;
+    } else {
+	memcpy(&pkt->src_addr6.value, saddr, 16);
+	pkt->src_addr6.attr.flags |= SNMP_FLAG_VALUE;
+	memcpy(&pkt->dst_addr6.value, daddr, 16);
+	pkt->dst_addr6.attr.flags |= SNMP_FLAG_VALUE;
+    }
+
+    pkt->src_port.value = get16(udp);
     pkt->src_port.attr.flags |= SNMP_FLAG_VALUE;
- 
-    pkt->dst_addr.value = addr->daddr;
-    pkt->dst_addr.attr.flags |= SNMP_FLAG_VALUE;
-    pkt->dst_port.value = addr->dest;
+    pkt->dst_port.value = get16(udp + 2);
     pkt->dst_port.attr.flags |= SNMP_FLAG_VALUE;
 
     pkt->attr.flags |= SNMP_FLAG_VALUE;
 
-    snmp_parse((unsigned char *) buf, len, pkt);
+    snmp_parse(r, udp + 8, ulen - 8, pkt);
 
-    if (user_callback) {
-	user_callback(pkt, user_data);
+    if (r->batch) {
+	if (++r->batch_len == SNMP_BATCH_SIZE) {
+	    batch_flush(r);
+	}
+	return;
+    }
+
+    if (r->func) {
+	r->func(pkt, r->user_data);
     }
 
-    snmp_free(pkt);
+    pkt_free_dynamic(pkt);
+    arena_reset(r);
 }
 
 /*
- * Entry point which reads a pcap file, applies the given pcap filter
- * and then calls the callback func for each SNMP message, passing the
- * user data pointer as well.
+ * Release a reassembly queue entry.
  */
 
-void
-snmp_pcap_read_file(const char *file, const char *filter,
-		    snmp_callback func, void *data)
+static void
+ipfrag_free(snmp_pcap_reader_t *r, ipfrag_t **pp)
 {
-    assert(file);
+    ipfrag_t *q = *pp;
 
-    nids_params.filename = (char *) file;
-    nids_params.device = NULL;
-    nids_params.pcap_filter = (char *) filter;
+    *pp = q->next;
+    free(q);
+    r->ipfrag_count--;
+}
 
-#if 1
-    static struct nids_chksum_ctl ctl;
-#endif
+/*
+ * Drop all incomplete datagrams, e.g. at the end of the input.
+ */
 
-    user_callback = func;
-    user_data = data;
-	
-    if (! nids_init()) {
-	fprintf(stderr, "libnids initialization failed: %s\n", nids_errbuf);
-	exit(1);
+static void
+ipfrag_flush(snmp_pcap_reader_t *r)
+{
+    while (r->ipfrag_list) {
+	ipfrag_free(r, &r->ipfrag_list);
     }
+}
 
-#if 1
-    /* this code discables checksum checking in libnids */
-    ctl.netaddr = inet_addr("0.0.0.0");
-    ctl.mask = inet_addr("0.0.0.0");
-    ctl.action = NIDS_DONT_CHKSUM;
-    nids_register_chksum_ctl(&ctl, 1);
-#endif
+/*
+ * Skip the IPv6 extension headers which may precede the upper layer
+ * header or a fragment header. On return, nh is the type of the
+ * header at p. Returns -1 if the extension headers are truncated.
+ */
 
-    nids_register_udp(udp_callback);
-    nids_run();
+static int
+ipv6_skip_ext(unsigned *nh, const u_char **p, unsigned *len)
+{
+    unsigned hlen;
+
+    while (1) {
+	switch (*nh) {
+	case IPPROTO_HOPOPTS:
+	case IPPROTO_ROUTING:
+	case IPPROTO_DSTOPTS:
+	    if (*len < 8) {
+		return -1;
+	    }
+	    hlen = ((*p)[1] + 1) * 8;
+	    break;
+	case IPPROTO_AH:
+	    if (*len < 8) {
+		return -1;
+	    }
+	    hlen = ((*p)[1] + 2) * 4;
+	    break;
+	default:
+	    return 0;
+	}
+	if (hlen > *len) {
+	    return -1;
+	}
+	*nh = (*p)[0];
+	*p += hlen;
+	*len -= hlen;
+    }
 }
 
-void
-snmp_pcap_read_stream(FILE *stream, const char *filter,
-		      snmp_callback func, void *data)
+/*
+ * Deliver the payload of an IPv6 datagram (or of a reassembled IPv6
+ * datagram) if it carries UDP.
+ */
+
+static void
+ipv6_upper(snmp_pcap_reader_t *r, const struct pcap_pkthdr *hdr,
+	   const u_char *saddr, const u_char *daddr,
+	   unsigned nh, const u_char *p, unsigned len)
 {
-#ifdef HAVE_LIBNIDS_PCAP_DESC
+    if (ipv6_skip_ext(&nh, &p, &len) == -1 || nh != IPPROTO_UDP) {
+	return;
+    }
 
-    /* This code was suggested by Rafal Wojtczuk <nergal@avet.com.pl>
-       but requires libnids 1.21 to compile and run. */
-    
-    char errbuf[PCAP_ERRBUF_SIZE];
-    
-    assert(stream);
+    udp_deliver(r, hdr, saddr, daddr, AF_INET6, p, len);
+}
 
-    nids_params.filename = NULL;
-    nids_params.device = NULL;
-    nids_params.pcap_filter = (char *) filter;
-    nids_params.pcap_desc = pcap_fopen_offline(stream, errbuf);
+/*
+ * Add an IPv4 or IPv6 fragment to the reassembly queue. The data of
+ * a fragment starts at the given offset of the fragmentable part of
+ * the datagram. The complete datagram is delivered when the last
+ * missing fragment arrives, so the time stamp is that of the last
+ * fragment we have received. Incomplete datagrams expire after
+ * IPFRAG_TIMEOUT seconds and the oldest datagram is dropped if the
+ * queue is full.
+ */
 
-    if (! nids_params.pcap_desc) {
-	fprintf(stderr, "opening pcap stream failed: %s\n", errbuf);
-	exit(1);
+static void
+ipfrag_input(snmp_pcap_reader_t *r, const struct pcap_pkthdr *hdr,
+	     int family, const u_char *saddr, const u_char *daddr,
+	     uint32_t id, unsigned proto, unsigned off, int more,
+	     const u_char *data, unsigned len)
+{
+    ipfrag_t *q, **pp, **oldest = NULL;
+    unsigned alen = (family == AF_INET) ? 4 : 16;
+    unsigned i, first, last, need;
+
+    if (more) {
+	len &= ~7u;
+    }
+    if (len == 0 || off + len > IPFRAG_SIZE - 1) {
+	return;
     }
 
-    user_callback = func;
-    user_data = data;
-	
-    if (! nids_init()) {
-	fprintf(stderr, "libnids initialization failed: %s\n", nids_errbuf);
-	exit(1);
+    for (pp = &r->ipfrag_list; *pp; ) {
+	q = *pp;
+	if (hdr->ts.tv_sec - q->time > IPFRAG_TIMEOUT) {
+	    ipfrag_free(r, pp);
+	    continue;
+	}
+	if (q->id == id && q->family == family
+	    && memcmp(q->src, saddr, alen) == 0
+	    && memcmp(q->dst, daddr, alen) == 0) {
+	    break;
+	}
+	oldest = pp;
+	pp = &q->next;
     }
 
-    nids_register_udp(udp_callback);
-    nids_run();
-#else
-    char path[] = "/tmp/snmpdump.XXXXXX";
-    pid_t pid;
+    q = *pp;
+    if (! q) {
+	if (r->ipfrag_count >= IPFRAG_MAX && oldest) {
+	    ipfrag_free(r, oldest);
+	}
+	q = malloc(sizeof(ipfrag_t));
+	if (! q) {
+	    abort();
+	}
+	memset(q->map, 0, sizeof(q->map));
+	q->family = family;
+	memcpy(q->src, saddr, alen);
+	memcpy(q->dst, daddr, alen);
+	q->id = id;
+	q->proto = proto;
+	q->time = hdr->ts.tv_sec;
+	q->len = 0;
+	q->blocks = 0;
+	q->next = r->ipfrag_list;
+	r->ipfrag_list = q;
+	r->ipfrag_count++;
+	pp = &r->ipfrag_list;
+    }
 
-    assert(stream);
+    memcpy(q->data + off, data, len);
+    first = off / 8;
+    last = (off + len + 7) / 8;
+    for (i = first; i < last; i++) {
+	if (! (q->map[i / 8] & (1 << (i % 8)))) {
+	    q->map[i / 8] |= 1 << (i % 8);
+	    q->blocks++;
+	}
+    }
+    if (! more) {
+	q->len = off + len;
+    }
 
-    if (mktemp(path) == NULL) {
-	fprintf(stderr, "%s: creating temporary file name failed\n",
-		progname);
-	exit(1);
+    if (! q->len) {
+	return;
+    }
+    need = (q->len + 7) / 8;
+    if (q->blocks < need) {
+	return;
+    }
+    for (i = 0; i < need; i++) {
+	if (! (q->map[i / 8] & (1 << (i % 8)))) {
+	    return;
+	}
     }
 
-    if (mkfifo(path, 0600) == -1) {
-	fprintf(stderr, "%s: failed to create fifo: %s\n",
-		progname, strerror(errno));
+    if (q->family == AF_INET) {
+	udp_deliver(r, hdr, q->src, q->dst, AF_INET, q->data, q->len);
+    } else {
+	ipv6_upper(r, hdr, q->src, q->dst, q->proto, q->data, q->len);
+    }
+    batch_flush(r);
+    ipfrag_free(r, pp);
+}
+
+/*
+ * Decode an IPv4 header. We check the header checksum (as libnids
+ * did) but not the UDP checksum since traces produced with checksum
+ * offloading often carry bogus UDP checksums.
+ */
+
+static void
+ipv4_input(snmp_pcap_reader_t *r,
+	   const struct pcap_pkthdr *hdr, const u_char *ip, unsigned len)
+{
+    unsigned hl, tot, i;
+    uint32_t sum = 0;
+
+    if (len < 20 || (ip[0] >> 4) != 4) {
+	return;
+    }
+    hl = (ip[0] & 0x0f) * 4;
+    tot = get16(ip + 2);
+    if (hl < 20 || tot < hl || tot > len) {
+	return;
+    }
+    for (i = 0; i < hl; i += 2) {
+	sum += get16(ip + i);
+    }
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum += sum >> 16;
+    if (sum != 0xffff) {
+	return;
+    }
+    if (ip[9] != IPPROTO_UDP) {
+	return;
+    }
+
+    if (get16(ip + 6) & (IPV4_MF | IPV4_OFFMASK)) {
+	ipfrag_input(r, hdr, AF_INET, ip + 12, ip + 16, get16(ip + 4),
+		     IPPROTO_UDP, (get16(ip + 6) & IPV4_OFFMASK) * 8,
+		     (get16(ip + 6) & IPV4_MF) != 0, ip + hl, tot - hl);
+	return;
+    }
+
+    udp_deliver(r, hdr, ip + 12, ip + 16, AF_INET, ip + hl, tot - hl);
+}
+
+/*
+ * Decode an IPv6 header. Extension headers are skipped and fragments
+ * go to the reassembly queue, where the fragment header is the last
+ * header of the unfragmentable part. Jumbograms are not supported.
+ */
+
+static void
+ipv6_input(snmp_pcap_reader_t *r,
+	   const struct pcap_pkthdr *hdr, const u_char *ip, unsigned len)
+{
+    const u_char *p;
+    unsigned plen, nh, off;
+
+    if (len < 40 || (ip[0] >> 4) != 6) {
+	return;
+    }
+    plen = get16(ip + 4);
+    if (plen > len - 40) {
+	return;
+    }
+    nh = ip[6];
+    p = ip + 40;
+    if (ipv6_skip_ext(&nh, &p, &plen) == -1) {
+	return;
+    }
+
+    if (nh == IPPROTO_FRAGMENT) {
+	if (plen < 8) {
+	    return;
+	}
+	off = get16(p + 2) & ~7u;
+	if (off || (get16(p + 2) & IPV6_MF)) {
+	    ipfrag_input(r, hdr, AF_INET6, ip + 8, ip + 24,
+			 (get16(p + 4) << 16) | get16(p + 6), p[0],
+			 off, (get16(p + 2) & IPV6_MF) != 0, p + 8, plen - 8);
+	    return;
+	}
+	/* an atomic fragment is just a complete datagram */
+	nh = p[0];
+	p += 8, plen -= 8;
+    }
+
+    ipv6_upper(r, hdr, ip + 8, ip + 24, nh, p, plen);
+}
+
+/*
+ * Callback invoked by libpcap for every captured frame. We strip the
+ * link layer header (including any VLAN tags) and dispatch on the
+ * network layer protocol.
+ */
+
+static void
+pcap_input(u_char *user, const struct pcap_pkthdr *hdr, const u_char *p)
+{
+    snmp_pcap_reader_t *r = (snmp_pcap_reader_t *) user;
+    unsigned len = hdr->caplen, type = 0, off;
+
+    switch (r->datalink) {
+    case DLT_EN10MB:
+	if (len < 14) {
+	    return;
+	}
+	type = get16(p + 12);
+	off = 14;
+	while (type == ETHTYPE_VLAN || type == ETHTYPE_QINQ) {
+	    if (len < off + 4) {
+		return;
+	    }
+	    type = get16(p + off + 2);
+	    off += 4;
+	}
+	break;
+    case DLT_LINUX_SLL:
+	if (len < 16) {
+	    return;
+	}
+	type = get16(p + 14);
+	off = 16;
+	break;
+    case DLT_NULL:
+    case DLT_LOOP:
+	off = 4;
+	break;
+    case DLT_RAW:
+    default:
+	off = 0;
+	break;
+    }
+
+    if (len <= off) {
+	return;
+    }
+    p += off, len -= off;
+
+    /* the null, loop and raw link types have no usable type field */
+    if (! type) {
+	type = ((p[0] >> 4) == 6) ? ETHTYPE_IPV6 : ETHTYPE_IPV4;
+    }
+
+    switch (type) {
+    case ETHTYPE_IPV4:
+	ipv4_input(r, hdr, p, len);
+	break;
+    case ETHTYPE_IPV6:
+	ipv6_input(r, hdr, p, len);
+	break;
+    }
+}
+
+/*
+ * Frames delivered by pcap_loop() are only valid during the callback,
+ * so a batch cannot extend beyond a frame.
+ */
+
+static void
+pcap_loop_input(u_char *user, const struct pcap_pkthdr *hdr, const u_char *p)
+{
+    snmp_pcap_reader_t *r = (snmp_pcap_reader_t *) user;
+
+    pcap_input(user, hdr, p);
+    batch_flush(r);
+}
+
+/*
+ * Check that we know how to decode the given data link type and
+ * remember it for pcap_input().
+ */
+
+static void
+snmp_pcap_datalink(snmp_pcap_reader_t *r, int dlt)
+{
+    switch (dlt) {
+    case DLT_EN10MB:
+    case DLT_LINUX_SLL:
+    case DLT_NULL:
+    case DLT_LOOP:
+    case DLT_RAW:
+	break;
+    default:
+	fprintf(stderr, "%s: unsupported pcap data link type %d\n",
+		progname, dlt);
 	exit(1);
     }
+    r->datalink = dlt;
+}
 
-    pid = fork();
-    if (pid == -1) {
-	fprintf(stderr, "%s: fork failed: %s\n",
-		progname, strerror(errno));
+/*
+ * Compile a pcap filter expression or die. The filter compiler of
+ * older libpcap versions is not reentrant, hence the lock.
+ */
+
+static void
+snmp_pcap_compile(pcap_t *pcap, const char *filter, struct bpf_program *prog)
+{
+    static pthread_mutex_t compile_lock = PTHREAD_MUTEX_INITIALIZER;
+    int rc;
+
+    pthread_mutex_lock(&compile_lock);
+    rc = pcap_compile(pcap, prog, (char *) filter, 1, 0);
+    pthread_mutex_unlock(&compile_lock);
+    if (rc == -1) {
+	fprintf(stderr, "%s: invalid pcap filter '%s': %s\n",
+		progname, filter, pcap_geterr(pcap));
 	exit(1);
     }
+}
 
-    if (pid == 0) {
-	FILE *fifo;
-	int c;
-	
-	fifo = fopen(path, "w");
-	if (! fifo) {
-	    fprintf(stderr, "%s: failed to open fifo: %s\n",
-		    progname, strerror(errno));
+/*
+ * Run the decoder over an opened pcap handle until the end of the
+ * input is reached and close the handle afterwards.
+ */
+
+static void
+snmp_pcap_run(snmp_pcap_reader_t *r, pcap_t *pcap, const char *filter)
+{
+    struct bpf_program prog;
+
+    snmp_pcap_datalink(r, pcap_datalink(pcap));
+
+    if (filter) {
+	snmp_pcap_compile(pcap, filter, &prog);
+	if (pcap_setfilter(pcap, &prog) == -1) {
+	    fprintf(stderr, "%s: invalid pcap filter '%s': %s\n",
+		    progname, filter, pcap_geterr(pcap));
 	    exit(1);
 	}
-	while ((c = getc(stream)) != EOF) {
-	    putc(c, fifo);
+	pcap_freecode(&prog);
+    }
+
+    if (pcap_loop(pcap, -1, pcap_loop_input, (u_char *) r) == -1) {
+	fprintf(stderr, "%s: reading pcap input failed: %s\n",
+		progname, pcap_geterr(pcap));
+    }
+
+    ipfrag_flush(r);
+    arena_free(r);
+    pcap_close(pcap);
+}
+
+/*
+ * Classic pcap files (but not pcapng) are parsed by the reader itself
+ * so that the BER decoder works directly on the record data, either
+ * in a memory mapping or in a large read buffer. Filters are applied
+ * with pcap_offline_filter() on a dead pcap handle.
+ */
+
+#define PCAP_FILE_MAGIC		0xa1b2c3d4
+#define PCAP_FILE_MAGIC_NSEC	0xa1b23c4d
+#define PCAP_FILE_HDRLEN	24
+#define PCAP_RECORD_HDRLEN	16
+#define PCAP_RECORD_MAX		262144	/* same sanity limit as libpcap */
+#define PCAP_MMAP_WINDOW	(8 * 1024 * 1024)
+#define PCAP_STREAM_BUFSIZE	(1024 * 1024)
+
+typedef struct {
+    int		swap;		/* file byte order differs from ours */
+    int		nsec;		/* time stamps have nanosecond resolution */
+    int		dlt;		/* data link type */
+    uint32_t	snaplen;
+    int		error;		/* a record header is corrupt */
+    pcap_t     *dead;		/* handle for filtering or NULL */
+#ifdef HAVE_PCAP_OFFLINE_FILTER
+    struct bpf_program prog;
+#endif
+} pcap_file_t;
+
+static inline uint32_t
+swap32(uint32_t v)
+{
+    return (v >> 24) | ((v >> 8) & 0xff00)
+	| ((v << 8) & 0xff0000) | (v << 24);
+}
+
+static inline uint32_t
+get32(const u_char *p, int swap)
+{
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+    return swap ? swap32(v) : v;
+}
+
+/*
+ * Map the link type values used in pcap files to the DLT_ values
+ * of the local libpcap. Returns -1 for link types we do not decode.
+ */
+
+static int
+pcap_file_linktype(uint32_t linktype)
+{
+    switch (linktype & 0x03ffffff) {
+    case 0:
+	return DLT_NULL;
+    case 1:
+	return DLT_EN10MB;
+    case 12:			/* some old files use DLT_RAW directly */
+    case 14:
+    case 101:
+	return DLT_RAW;
+    case 108:
+	return DLT_LOOP;
+    case 113:
+	return DLT_LINUX_SLL;
+    default:
+	return -1;
+    }
+}
+
+/*
+ * Parse the pcap file header and compile the filter. Returns -1 if
+ * this is not a file we can read ourself, in which case the caller
+ * falls back to libpcap.
+ */
+
+static int
+pcap_file_open(snmp_pcap_reader_t *r,
+	       pcap_file_t *pf, const u_char *hdr, const char *filter)
+{
+    uint32_t magic;
+
+    memset(pf, 0, sizeof(pcap_file_t));
+    memcpy(&magic, hdr, 4);
+    pf->swap = (magic == swap32(PCAP_FILE_MAGIC)
+		|| magic == swap32(PCAP_FILE_MAGIC_NSEC));
+    if (pf->swap) {
+	magic = swap32(magic);
+    }
+    if (magic != PCAP_FILE_MAGIC && magic != PCAP_FILE_MAGIC_NSEC) {
+	return -1;
+    }
+    pf->nsec = (magic == PCAP_FILE_MAGIC_NSEC);
+    pf->snaplen = get32(hdr + 16, pf->swap);
+    pf->dlt = pcap_file_linktype(get32(hdr + 20, pf->swap));
+    if (pf->dlt == -1) {
+	return -1;
+    }
+
+    if (filter) {
+#ifdef HAVE_PCAP_OFFLINE_FILTER
+	pf->dead = pcap_open_dead(pf->dlt, pf->snaplen);
+	if (! pf->dead) {
+	    return -1;
 	}
-	
-	if (fflush(fifo) || ferror(fifo) || ferror(stream)) {
-	    perror(progname);
-	    exit(1);
+	snmp_pcap_compile(pf->dead, filter, &pf->prog);
+#else
+	return -1;
+#endif
+    }
+
+    snmp_pcap_datalink(r, pf->dlt);
+    return 0;
+}
+
+static void
+pcap_file_close(snmp_pcap_reader_t *r, pcap_file_t *pf)
+{
+    ipfrag_flush(r);
+    arena_free(r);
+#ifdef HAVE_PCAP_OFFLINE_FILTER
+    if (pf->dead) {
+	pcap_freecode(&pf->prog);
+	pcap_close(pf->dead);
+    }
+#endif
+}
+
+/*
+ * Decode all complete records in the buffer p of length len and
+ * return the number of bytes consumed. Sets the error flag if a
+ * record header announces an impossible capture length.
+ */
+
+static size_t
+pcap_file_records(snmp_pcap_reader_t *r,
+		  pcap_file_t *pf, const u_char *p, size_t len)
+{
+    struct pcap_pkthdr hdr;
+    const u_char *start = p, *end = p + len;
+    uint32_t caplen;
+
+    while (end - p >= PCAP_RECORD_HDRLEN) {
+	caplen = get32(p + 8, pf->swap);
+	if (caplen > PCAP_RECORD_MAX && caplen > pf->snaplen) {
+	    pf->error = 1;
+	    break;
 	}
-	fclose(fifo);
-	unlink(path);
-	exit(0);
-    } else {
-	snmp_pcap_read_file(path, filter, func, data);
-	unlink(path);
+	if (caplen > (size_t) (end - p - PCAP_RECORD_HDRLEN)) {
+	    break;
+	}
+	hdr.ts.tv_sec = get32(p, pf->swap);
+	hdr.ts.tv_usec = get32(p + 4, pf->swap);
+	if (pf->nsec) {
+	    hdr.ts.tv_usec /= 1000;
+	}
+	hdr.caplen = caplen;
+	hdr.len = get32(p + 12, pf->swap);
+	p += PCAP_RECORD_HDRLEN;
+#ifdef HAVE_PCAP_OFFLINE_FILTER
+	if (! pf->dead || pcap_offline_filter(&pf->prog, &hdr, p))
+#endif
+	    pcap_input((u_char *) r, &hdr, p);
+	p += caplen;
+    }
+    batch_flush(r);
+    return p - start;
+}
+
+#ifdef HAVE_SYS_MMAN_H
+
+/*
+ * Read a pcap file through a memory mapping. The kernel is told that
+ * we read sequentially and we ask for the next window ahead of time
+ * while dropping the pages behind us, which keeps the resident set
+ * small for multi-GB captures. Returns -1 without having read
+ * anything if the file is not a regular pcap file we can handle
+ * (e.g. a FIFO or a compressed or pcapng file). The mapping is
+ * private and writable since decoded octet strings point into the
+ * packet data and the filter-out module clears them in place.
+ */
+
+static int
+snmp_pcap_read_mmap(snmp_pcap_reader_t *r,
+		    const char *file, const char *filter)
+{
+    struct stat st;
+    pcap_file_t pf;
+    const u_char *base, *end, *p, *window, *limit;
+    size_t size, n;
+    uint32_t caplen;
+    int fd;
+
+    /* do not open FIFOs here since the writer might go away before
+       the fallback gets to open them again */
+    if (stat(file, &st) == -1 || ! S_ISREG(st.st_mode)) {
+	return -1;
+    }
+    fd = open(file, O_RDONLY);
+    if (fd == -1) {
+	return -1;
+    }
+    if (fstat(fd, &st) == -1 || ! S_ISREG(st.st_mode)
+	|| st.st_size < PCAP_FILE_HDRLEN) {
+	close(fd);
+	return -1;
+    }
+    size = st.st_size;
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+	return -1;
+    }
+    end = base + size;
+
+    if (pcap_file_open(r, &pf, base, filter) == -1) {
+	munmap((void *) base, size);
+	return -1;
+    }
+
+    (void) madvise((void *) base, size, MADV_SEQUENTIAL);
+
+    for (p = base + PCAP_FILE_HDRLEN, window = base; p < end; p += n) {
+	while (p >= window) {
+	    if (window - base >= PCAP_MMAP_WINDOW) {
+		(void) madvise((void *) (window - PCAP_MMAP_WINDOW),
+			       PCAP_MMAP_WINDOW, MADV_DONTNEED);
+	    }
+	    window += PCAP_MMAP_WINDOW;
+	    if (window < end) {
+		(void) madvise((void *) window,
+			       (size_t) (end - window) < PCAP_MMAP_WINDOW
+			       ? (size_t) (end - window) : PCAP_MMAP_WINDOW,
+			       MADV_WILLNEED);
+	    }
+	}
+	n = pcap_file_records(r, &pf, p, (window < end ? window : end) - p);
+	if (n == 0) {
+	    /* the next record straddles the window, decode just that one */
+	    limit = end;
+	    if (end - p >= PCAP_RECORD_HDRLEN) {
+		caplen = get32(p + 8, pf.swap);
+		if (caplen < (size_t) (end - p - PCAP_RECORD_HDRLEN)) {
+		    limit = p + PCAP_RECORD_HDRLEN + caplen;
+		}
+	    }
+	    n = pcap_file_records(r, &pf, p, limit - p);
+	    if (n == 0) {
+		fprintf(stderr, "%s: %s: %s\n", progname, file, pf.error
+			? "corrupt pcap record header" : "truncated pcap record");
+		break;
+	    }
+	}
+    }
+
+    pcap_file_close(r, &pf);
+    munmap((void *) base, size);
+    return 0;
+}
+
+#endif
+
+/*
+ * Read pcap records from a stream in large chunks. Records are
+ * decoded in place in the read buffer and only the trailing partial
+ * record is moved to the front before the next read. Returns -1 if
+ * the stream does not carry a classic pcap file, in which case the
+ * file header has already been read into hdr.
+ */
+
+static int
+snmp_pcap_read_buffered(snmp_pcap_reader_t *r,
+			FILE *stream, u_char *hdr, const char *filter)
+{
+    pcap_file_t pf;
+    u_char *buf;
+    size_t size = PCAP_STREAM_BUFSIZE, len = 0, n;
+
+    if (pcap_file_open(r, &pf, hdr, filter) == -1) {
+	return -1;
+    }
+
+    buf = malloc(size);
+    if (! buf) {
+	abort();
+    }
+
+    while ((n = fread(buf + len, 1, size - len, stream)) > 0) {
+	len += n;
+	n = pcap_file_records(r, &pf, buf, len);
+	if (pf.error) {
+	    break;
+	}
+	len -= n;
+	memmove(buf, buf + n, len);
+	if (len == size) {
+	    size *= 2;
+	    buf = realloc(buf, size);
+	    if (! buf) {
+		abort();
+	    }
+	}
+    }
+
+    if (pf.error) {
+	fprintf(stderr, "%s: corrupt pcap record header\n", progname);
+    } else if (ferror(stream)) {
+	fprintf(stderr, "%s: reading pcap input failed: %s\n",
+		progname, strerror(errno));
+    } else if (len) {
+	fprintf(stderr, "%s: truncated pcap record\n", progname);
+    }
+
+    free(buf);
+    pcap_file_close(r, &pf);
+    return 0;
+}
+
+/*
+ * Create a new pcap reader which calls the callback func for each
+ * SNMP message, passing the user data pointer as well. A reader may
+ * be used for several inputs in sequence, but only by one thread at
+ * a time.
+ */
+
+snmp_pcap_reader_t*
+snmp_pcap_reader_new(snmp_callback func, void *data)
+{
+    snmp_pcap_reader_t *r;
+
+    r = calloc(1, sizeof(*r));
+    if (! r) {
+	abort();
+    }
+    r->func = func;
+    r->user_data = data;
+    r->datalink = -1;
+    return r;
+}
+
+/*
+ * Create a new pcap reader which calls the callback func for batches
+ * of SNMP messages.
+ */
+
+snmp_pcap_reader_t*
+snmp_pcap_reader_new_batch(snmp_batch_callback func, void *data)
+{
+    snmp_pcap_reader_t *r;
+
+    assert(func);
+
+    r = snmp_pcap_reader_new(NULL, data);
+    r->batch_func = func;
+    r->batch = malloc(SNMP_BATCH_SIZE * sizeof(snmp_packet_t));
+    if (! r->batch) {
+	abort();
+    }
+    return r;
+}
+
+/*
+ * Set how much of a message is decoded by this reader.
+ */
+
+void
+snmp_pcap_reader_set_decode(snmp_pcap_reader_t *r, snmp_decode_t decode)
+{
+    assert(r);
+    r->skip = decode;
+}
+
+/*
+ * Read a pcap file, apply the given pcap filter and pass the SNMP
+ * messages to the reader's callback.
+ */
+
+void
+snmp_pcap_reader_read_file(snmp_pcap_reader_t *r,
+			   const char *file, const char *filter)
+{
+    FILE *stream;
+
+    assert(r && file);
+
+#ifdef HAVE_SYS_MMAN_H
+    if (snmp_pcap_read_mmap(r, file, filter) == 0) {
+	return;
     }
 #endif
+
+    /* compressed files are decompressed on the fly */
+    stream = snmp_zio_open(file);
+    if (! stream) {
+	exit(1);
+    }
+    snmp_pcap_reader_read_stream(r, stream, filter);
+    fclose(stream);
+}
+
+void
+snmp_pcap_reader_read_stream(snmp_pcap_reader_t *r,
+			     FILE *stream, const char *filter)
+{
+    u_char hdr[PCAP_FILE_HDRLEN];
+    size_t len;
+#ifdef HAVE_PCAP_FOPEN_OFFLINE
+    char errbuf[PCAP_ERRBUF_SIZE];
+    pcap_t *pcap;
+    FILE *replay;
+#endif
+
+    assert(r && stream);
+
+    len = fread(hdr, 1, sizeof(hdr), stream);
+    if (len == sizeof(hdr)
+	&& snmp_pcap_read_buffered(r, stream, hdr, filter) == 0) {
+	return;
+    }
+
+#ifdef HAVE_PCAP_FOPEN_OFFLINE
+    /* let libpcap deal with everything else (e.g. pcapng), replaying
+       the bytes we have already consumed; pcap_close() closes the
+       replay stream but not the stream we were given */
+    replay = snmp_zio_unread(stream, hdr, len);
+    pcap = pcap_fopen_offline(replay, errbuf);
+    if (! pcap) {
+	fprintf(stderr, "%s: opening pcap stream failed: %s\n",
+		progname, errbuf);
+	exit(1);
+    }
+    snmp_pcap_run(r, pcap, filter);
+#else
+    fprintf(stderr, "%s: unsupported pcap stream format\n", progname);
+    exit(1);
+#endif
+}
+
+/*
+ * Release a reader and all memory it still holds.
+ */
+
+void
+snmp_pcap_reader_delete(snmp_pcap_reader_t *r)
+{
+    if (r) {
+	ipfrag_flush(r);
+	arena_free(r);
+	free(r->batch);
+	free(r);
+    }
+}
+
+/*
+ * Set how much of a message is decoded by subsequent calls of the
+ * reader functions below.
+ */
+
+void
+snmp_pcap_set_decode(snmp_decode_t decode)
+{
+    default_skip = decode;
+}
+
+/*
+ * Entry point which reads a pcap file, applies the given pcap filter
+ * and then calls the callback func for each SNMP message, passing the
+ * user data pointer as well. This is a shorthand for a reader which
+ * is used for a single input.
+ */
+
+void
+snmp_pcap_read_file(const char *file, const char *filter,
+		    snmp_callback func, void *data)
+{
+    snmp_pcap_reader_t *r;
+
+    r = snmp_pcap_reader_new(func, data);
+    snmp_pcap_reader_set_decode(r, default_skip);
+    snmp_pcap_reader_read_file(r, file, filter);
+    snmp_pcap_reader_delete(r);
+}
+
+void
+snmp_pcap_read_stream(FILE *stream, const char *filter,
+		      snmp_callback func, void *data)
+{
+    snmp_pcap_reader_t *r;
+
+    r = snmp_pcap_reader_new(func, data);
+    snmp_pcap_reader_set_decode(r, default_skip);
+    snmp_pcap_reader_read_stream(r, stream, filter);
+    snmp_pcap_reader_delete(r);
+}
+
+void
+snmp_pcap_read_file_batch(const char *file, const char *filter,
+			  snmp_batch_callback func, void *data)
+{
+    snmp_pcap_reader_t *r;
+
+    r = snmp_pcap_reader_new_batch(func, data);
+    snmp_pcap_reader_set_decode(r, default_skip);
+    snmp_pcap_reader_read_file(r, file, filter);
+    snmp_pcap_reader_delete(r);
+}
+
+void
+snmp_pcap_read_stream_batch(FILE *stream, const char *filter,
+			    snmp_batch_callback func, void *data)
+{
+    snmp_pcap_reader_t *r;
+
+    r = snmp_pcap_reader_new_batch(func, data);
+    snmp_pcap_reader_set_decode(r, default_skip);
+    snmp_pcap_reader_read_stream(r, stream, filter);
+    snmp_pcap_reader_delete(r);
 }
@@ -78,6 +78,7 @@ snmp_pkt_v1tov2(snmp_packet_t *pkt)
     nvb->name.len = sizeof(snmpTrapOid0) / sizeof(snmpTrapOid0[0]);
     nvb->name.value = xmemdup(snmpTrapOid0, nvb->name.len * sizeof(uint32_t));
     nvb->name.attr.flags |= SNMP_FLAG_VALUE;
+    nvb->name.attr.flags |= SNMP_FLAG_DYNAMIC;
     if (! pdu->generic_trap.attr.flags & SNMP_FLAG_VALUE) {
 	nvb->value.oid.len = 0;
 	nvb->value.oid.value = NULL;
@@ -88,36 +89,42 @@ snmp_pkt_v1tov2(snmp_packet_t *pkt)
 	    nvb->value.oid.value = xmemdup(coldStart,
 				   nvb->value.oid.len * sizeof(uint32_t));
 	    nvb->value.oid.attr.flags |= SNMP_FLAG_VALUE;
+	    nvb->value.oid.attr.flags |= SNMP_FLAG_DYNAMIC;
 	    break;
 	case 1: /* warmStart */
 	    nvb->value.oid.len = sizeof(warmStart) / sizeof(warmStart[0]);
 	    nvb->value.oid.value = xmemdup(warmStart,
 				   nvb->value.oid.len * sizeof(uint32_t));
 	    nvb->value.oid.attr.flags |= SNMP_FLAG_VALUE;
+	    nvb->value.oid.attr.flags |= SNMP_FLAG_DYNAMIC;
 	    break;
 	case 2: /* linkDown */
 	    nvb->value.oid.len = sizeof(linkDown) / sizeof(linkDown[0]);
 	    nvb->value.oid.value = xmemdup(linkDown,
 				   nvb->value.oid.len * sizeof(uint32_t));
 	    nvb->value.oid.attr.flags |= SNMP_FLAG_VALUE;
+	    nvb->value.oid.attr.flags |= SNMP_FLAG_DYNAMIC;
 	    break;
 	case 3: /* linkUp */
 	    nvb->value.oid.len = sizeof(linkUp) / sizeof(linkUp[0]);
 	    nvb->value.oid.value = xmemdup(linkUp,
 				   nvb->value.oid.len * sizeof(uint32_t));
 	    nvb->value.oid.attr.flags |= SNMP_FLAG_VALUE;
+	    nvb->value.oid.attr.flags |= SNMP_FLAG_DYNAMIC;
 	    break;
 	case 4: /* authenticationFailure */
 	    nvb->value.oid.len = sizeof(authFailure) / sizeof(authFailure[0]);
 	    nvb->value.oid.value = xmemdup(authFailure,
 				   nvb->value.oid.len * sizeof(uint32_t));
 	    nvb->value.oid.attr.flags |= SNMP_FLAG_VALUE;
+	    nvb->value.oid.attr.flags |= SNMP_FLAG_DYNAMIC;
 	    break;
 	case 5: /* egpNeighborLoss */
 	    nvb->value.oid.len = sizeof(egpNeighLoss) / sizeof(egpNeighLoss[0]);
 	    nvb->value.oid.value = xmemdup(egpNeighLoss,
 				   nvb->value.oid.len * sizeof(uint32_t));
 	    nvb->value.oid.attr.flags |= SNMP_FLAG_VALUE;
+	    nvb->value.oid.attr.flags |= SNMP_FLAG_DYNAMIC;
 	    break;
 	case 6: /* enterprise specific */
 	    if ((! pdu->specific_trap.attr.flags & SNMP_FLAG_VALUE)
@@ -134,6 +141,7 @@ snmp_pkt_v1tov2(snmp_packet_t *pkt)
 		nvb->value.oid.value[len] = 0;
 		nvb->value.oid.value[++len] = pdu->specific_trap.value;
 		nvb->value.oid.attr.flags |= SNMP_FLAG_VALUE;
+		nvb->value.oid.attr.flags |= SNMP_FLAG_DYNAMIC;
 	    }
 	    break;
 	default:
@@ -152,6 +160,7 @@ snmp_pkt_v1tov2(snmp_packet_t *pkt)
     nvb->name.len = sizeof(sysUpTime0) / sizeof(sysUpTime0[0]);
     nvb->name.value = xmemdup(sysUpTime0, nvb->name.len * sizeof(uint32_t));
     nvb->name.attr.flags |= SNMP_FLAG_VALUE;
+    nvb->name.attr.flags |= SNMP_FLAG_DYNAMIC;
     if (! pdu->time_stamp.attr.flags & SNMP_FLAG_VALUE) {
 	nvb->value.u32.value = 0;
     } else {
@@ -174,6 +183,7 @@ snmp_pkt_v1tov2(snmp_packet_t *pkt)
     nvb->name.len = sizeof(snmpTrapAddress0) / sizeof(snmpTrapAddress0[0]);
     nvb->name.value = xmemdup(snmpTrapAddress0, nvb->name.len * sizeof(uint32_t));
     nvb->name.attr.flags |= SNMP_FLAG_VALUE;
+    nvb->name.attr.flags |= SNMP_FLAG_DYNAMIC;
     if (! pdu->agent_addr.attr.flags & SNMP_FLAG_VALUE) {
 	nvb->value.ip.value = 0;
     } else {
@@ -193,6 +203,7 @@ snmp_pkt_v1tov2(snmp_packet_t *pkt)
     nvb->name.len = sizeof(snmpTrapCommunity0) / sizeof(snmpTrapCommunity0[0]);
     nvb->name.value = xmemdup(snmpTrapCommunity0, nvb->name.len * sizeof(uint32_t));
     nvb->name.attr.flags |= SNMP_FLAG_VALUE;
+    nvb->name.attr.flags |= SNMP_FLAG_DYNAMIC;
     if (! pkt->snmp.community.attr.flags & SNMP_FLAG_VALUE) {
 	nvb->value.octs.len = 0;
 	nvb->value.octs.value = NULL;
@@ -216,6 +227,7 @@ snmp_pkt_v1tov2(snmp_packet_t *pkt)
     nvb->name.len = sizeof(snmpTrapEnterprise0) / sizeof(snmpTrapEnterprise0[0]);
     nvb->name.value = xmemdup(snmpTrapEnterprise0, nvb->name.len * sizeof(uint32_t));
     nvb->name.attr.flags |= SNMP_FLAG_VALUE;
+    nvb->name.attr.flags |= SNMP_FLAG_DYNAMIC;
     if (! pdu->enterprise.attr.flags & SNMP_FLAG_VALUE) {
 	nvb->value.oid.len = 0;
 	nvb->value.oid.value = NULL;
@@ -253,6 +265,45 @@ snmp_pkt_new(void)
     return pkt;
 }
 
+/*
+ * Helper functions to duplicate and release the values of octet
+ * strings and object identifiers embedded in a packet.
+ */
+
+static inline void
+snmp_octs_dup(snmp_octs_t *v)
+{
+    if (v->value) {
+	v->value = (unsigned char *) xmemdup(v->value, v->len);
+	v->attr.flags |= SNMP_FLAG_DYNAMIC;
+    }
+}
+
+static inline void
+snmp_octs_free(snmp_octs_t *v)
+{
+    if (v->value && v->attr.flags & SNMP_FLAG_DYNAMIC) {
+	free(v->value);
+    }
+}
+
+static inline void
+snmp_oid_dup(snmp_oid_t *v)
+{
+    if (v->value) {
+	v->value = xmemdup(v->value, v->len * sizeof(uint32_t));
+	v->attr.flags |= SNMP_FLAG_DYNAMIC;
+    }
+}
+
+static inline void
+snmp_oid_free(snmp_oid_t *v)
+{
+    if (v->value && v->attr.flags & SNMP_FLAG_DYNAMIC) {
+	free(v->value);
+    }
+}
+
 snmp_packet_t*
 snmp_pkt_copy(snmp_packet_t *pkt)
 {
@@ -266,8 +317,15 @@ snmp_pkt_copy(snmp_packet_t *pkt)
     n->snmp.community.value
 	= (unsigned char *) xmemdup(pkt->snmp.community.value, pkt->snmp.community.len);
     n->snmp.community.attr.flags |= SNMP_FLAG_DYNAMIC;
-    
-    /* xxx more copying to be done here for SNMPv3 messages */
+
+    snmp_octs_dup(&n->snmp.message.msg_flags);
+    snmp_octs_dup(&n->snmp.usm.auth_engine_id);
+    snmp_octs_dup(&n->snmp.usm.user);
+    snmp_octs_dup(&n->snmp.usm.auth_params);
+    snmp_octs_dup(&n->snmp.usm.priv_params);
+    snmp_octs_dup(&n->snmp.scoped_pdu.context_engine_id);
+    snmp_octs_dup(&n->snmp.scoped_pdu.context_name);
+    snmp_oid_dup(&n->snmp.scoped_pdu.pdu.enterprise);
 
     /*
      * Duplicate the varbind list.
@@ -283,6 +341,7 @@ snmp_pkt_copy(snmp_packet_t *pkt)
 				     vb->name.len * sizeof(uint32_t));
 	switch (vb->type) {
 	case SNMP_TYPE_OCTS:
+	case SNMP_TYPE_OPAQUE:
 	    (*nvb)->value.octs.value = xmemdup(vb->value.octs.value,
 					       vb->value.octs.len);
 	    (*nvb)->value.octs.attr.flags |= SNMP_FLAG_DYNAMIC;
@@ -311,8 +370,15 @@ snmp_pkt_delete(snmp_packet_t *pkt)
 	&& pkt->snmp.community.attr.flags & SNMP_FLAG_DYNAMIC) {
 	free(pkt->snmp.community.value);
     }
-    
-    /* xxx more cleanup to be done here for SNMPv3 messages */
+
+    snmp_octs_free(&pkt->snmp.message.msg_flags);
+    snmp_octs_free(&pkt->snmp.usm.auth_engine_id);
+    snmp_octs_free(&pkt->snmp.usm.user);
+    snmp_octs_free(&pkt->snmp.usm.auth_params);
+    snmp_octs_free(&pkt->snmp.usm.priv_params);
+    snmp_octs_free(&pkt->snmp.scoped_pdu.context_engine_id);
+    snmp_octs_free(&pkt->snmp.scoped_pdu.context_name);
+    snmp_oid_free(&pkt->snmp.scoped_pdu.pdu.enterprise);
 
     /*
      * Delete the varbind list.
@@ -322,7 +388,7 @@ snmp_pkt_delete(snmp_packet_t *pkt)
 	if (vb->name.attr.flags & SNMP_FLAG_DYNAMIC) {
 	    free(vb->name.value);
 	}
-	if (vb->type == SNMP_TYPE_OCTS
+	if ((vb->type == SNMP_TYPE_OCTS || vb->type == SNMP_TYPE_OPAQUE)
 	    && vb->value.octs.attr.flags & SNMP_FLAG_DYNAMIC) {
 	    free(vb->value.octs.value);
 	}
@@ -215,6 +215,79 @@ void	       snmp_pkt_v1tov2(snmp_packet_t *pkt);
 
 typedef void (*snmp_callback)(snmp_packet_t *pkt, void *user_data);
 
+/*
+ * Prototype of the callback function which is called for a batch of
+ * up to SNMP_BATCH_SIZE SNMP messages in input order. The messages
+ * are only valid until the callback returns.
+ */
+
+typedef void (*snmp_batch_callback)(snmp_packet_t **pkts, size_t n,
+				    void *user_data);
+
+#define SNMP_BATCH_SIZE		64
+
+/*
+ * Open an input file for reading. Files compressed with gzip, zstd
+ * or xz are recognized by their magic bytes and decompressed on the
+ * fly by a separate thread. The unread function pushes back a few
+ * bytes already consumed from a stream.
+ */
+
+FILE* snmp_zio_open(const char *file);
+FILE* snmp_zio_unread(FILE *stream, const void *buf, size_t len);
+int snmp_zio_compressed(const void *buf, size_t len);
+
+/*
+ * Decoding of BER encoded OID values. The output array must have room
+ * for len + 1 sub-identifiers.
+ */
+
+unsigned snmp_oid_decode(uint32_t *out, const unsigned char *p, unsigned len);
+
+/*
+ * Conversion of octet strings from and to hex digits. The decoder
+ * converts 2 * len digits into len octets and may work in place.
+ */
+
+void snmp_hex_encode(char *dst, const unsigned char *src, size_t len);
+int snmp_hex_decode(unsigned char *dst, const char *src, size_t len);
+void snmp_hex_write(FILE *stream, const unsigned char *src, size_t len);
+
+/*
+ * The decode level tells the readers how much of a message the
+ * processing chain looks at. Parts nobody looks at are skipped but
+ * their lengths (blen and vlen) are still recorded. Besides the
+ * coarse levels, the SNMP_SKIP_* bits select individual fields which
+ * are expensive to decode.
+ */
+
+typedef unsigned snmp_decode_t;
+
+#define SNMP_SKIP_VARBINDS	0x01	/* the whole variable-bindings */
+#define SNMP_SKIP_NAMES		0x02	/* varbind names */
+#define SNMP_SKIP_VALUES	0x04	/* all varbind values */
+#define SNMP_SKIP_OCTS		0x08	/* octet-string varbind values */
+#define SNMP_SKIP_OIDS		0x10	/* object-identifier varbind values */
+#define SNMP_SKIP_COMMUNITY	0x20	/* community strings */
+#define SNMP_SKIP_ENTERPRISE	0x40	/* enterprise of SNMPv1 traps */
+
+#define SNMP_DECODE_ALL		0			/* complete messages */
+#define SNMP_DECODE_NAMES	SNMP_SKIP_VALUES	/* names and types */
+#define SNMP_DECODE_PDU		SNMP_SKIP_VARBINDS	/* no varbinds */
+
+/*
+ * Check whether a reader skips the value of a varbind of the given
+ * type under the given decode level.
+ */
+
+static inline int
+snmp_skip_value(snmp_decode_t decode, uint32_t type)
+{
+    return (decode & SNMP_SKIP_VALUES)
+	|| (type == SNMP_TYPE_OCTS && (decode & SNMP_SKIP_OCTS))
+	|| (type == SNMP_TYPE_OID && (decode & SNMP_SKIP_OIDS));
+}
+
 /*
  * XML input and output functions.
  */
@@ -223,9 +296,17 @@ void snmp_xml_read_file(const char *file,
 			snmp_callback func, void *user_data);
 void snmp_xml_read_stream(FILE *stream,
 			  snmp_callback func, void *user_data);
+void snmp_xml_read_file_batch(const char *file,
+			      snmp_batch_callback func, void *user_data);
+void snmp_xml_read_stream_batch(FILE *stream,
+				snmp_batch_callback func, void *user_data);
+void snmp_xml_set_decode(snmp_decode_t decode);
+void snmp_xml_set_scanner(int on);
+void snmp_xml_set_jobs(unsigned jobs);
 
 void snmp_xml_write_stream_new(FILE *stream);
 void snmp_xml_write_stream_pkt(FILE *stream, snmp_packet_t *pkt);
+void snmp_xml_write_stream_pkts(FILE *stream, snmp_packet_t **pkts, size_t n);
 void snmp_xml_write_stream_end(FILE *stream);
 
 /*
@@ -236,8 +317,31 @@ void snmp_pcap_read_file(const char *file, const char *filter,
 			 snmp_callback func, void *user_data);
 void snmp_pcap_read_stream(FILE *stream, const char *filter,
 			   snmp_callback func, void *user_data);
+void snmp_pcap_read_file_batch(const char *file, const char *filter,
+			       snmp_batch_callback func, void *user_data);
+void snmp_pcap_read_stream_batch(FILE *stream, const char *filter,
+				 snmp_batch_callback func, void *user_data);
 void snmp_pcap_read_life(const char *file,
 			 snmp_callback func, void *user_data);
+void snmp_pcap_set_decode(snmp_decode_t decode);
+
+/*
+ * Reentrant PCAP reader. Each reader carries its own callback and
+ * decoder state, so several readers can run on separate threads.
+ */
+
+typedef struct _snmp_pcap_reader snmp_pcap_reader_t;
+
+snmp_pcap_reader_t* snmp_pcap_reader_new(snmp_callback func, void *user_data);
+snmp_pcap_reader_t* snmp_pcap_reader_new_batch(snmp_batch_callback func,
+					       void *user_data);
+void snmp_pcap_reader_set_decode(snmp_pcap_reader_t *reader,
+				 snmp_decode_t decode);
+void snmp_pcap_reader_read_file(snmp_pcap_reader_t *reader,
+				const char *file, const char *filter);
+void snmp_pcap_reader_read_stream(snmp_pcap_reader_t *reader,
+				  FILE *stream, const char *filter);
+void snmp_pcap_reader_delete(snmp_pcap_reader_t *reader);
 
 /*
  * CSV input functions.
@@ -247,6 +351,50 @@ void snmp_csv_read_file(const char *file,
 			snmp_callback func, void *user_data);
 void snmp_csv_read_stream(FILE *stream, 
 			  snmp_callback func, void *user_data);
+void snmp_csv_read_file_batch(const char *file,
+			      snmp_batch_callback func, void *user_data);
+void snmp_csv_read_stream_batch(FILE *stream,
+				snmp_batch_callback func, void *user_data);
+void snmp_csv_set_decode(snmp_decode_t decode);
+void snmp_csv_set_jobs(unsigned jobs);
+
+/*
+ * Read several files in parallel and merge the messages in time
+ * stamp order. The read function is called on up to readers threads
+ * (0 means one per file) and must only use reentrant readers.
+ */
+
+typedef void (*snmp_reader)(const char *file, void *reader_data,
+			    snmp_callback func, void *user_data);
+
+void snmp_merge_read_files(char **files, int count, unsigned readers,
+			   snmp_reader read, void *reader_data,
+			   snmp_callback func, void *user_data);
+
+#define SNMP_MERGE_READERS	64
+#define SNMP_MERGE_READERS_MAX	1024
+
+/*
+ * Read a memory mapped text file in chunks on several threads. The
+ * split function returns the start of the first record at or after
+ * p. The parse function decodes the records of a chunk, which starts
+ * at the given file offset, and passes the messages to func, which
+ * takes over their memory; they are freed with the release function
+ * once they have been delivered in file order. Returns -1 if the file
+ * cannot be read this way.
+ */
+
+typedef struct snmp_chunk_format {
+    char* (*split)(char *p, char *end);
+    void (*parse)(char *data, size_t len, size_t offset,
+		  snmp_callback func, void *user_data);
+    void (*release)(snmp_packet_t *pkt);
+} snmp_chunk_format_t;
+
+int snmp_chunk_read_file(const char *file, unsigned jobs,
+			 const snmp_chunk_format_t *format,
+			 snmp_callback func, snmp_batch_callback batch_func,
+			 void *user_data);
 
 /*
  * CSV output functions (we do not read CVS files)
@@ -254,6 +402,7 @@ void snmp_csv_read_stream(FILE *stream,
 
 void snmp_csv_write_stream_new(FILE *stream);
 void snmp_csv_write_stream_pkt(FILE *stream, snmp_packet_t *pkt);
+void snmp_csv_write_stream_pkts(FILE *stream, snmp_packet_t **pkts, size_t n);
 void snmp_csv_write_stream_end(FILE *stream);
 
 /*
@@ -266,12 +415,27 @@ typedef struct _snmp_write {
     FILE *stream;
     void (*write_new) (FILE *stream);
     void (*write_pkt) (FILE *stream, snmp_packet_t *pkt);
+    void (*write_pkts) (FILE *stream, snmp_packet_t **pkts, size_t n);
     void (*write_end) (FILE *stream);
     const char *path;
     const char *prefix;
     const char *ext;
+    unsigned cache_window;	/* seconds to wait for responses */
+    unsigned long cache_limit;	/* max. number of cached requests */
+    unsigned long open_limit;	/* max. number of open flow files */
+    unsigned long buffer_limit;	/* max. bytes buffered for flow files */
+    unsigned jobs;		/* number of flow processing threads */
+    unsigned slice_timeout;	/* seconds after which idle slices end */
+    int verbose;		/* report statistics on stderr */
 } snmp_write_t;
 
+#define SNMP_CACHE_WINDOW	300
+#define SNMP_CACHE_WINDOW_MAX	86400
+#define SNMP_BUFFER_LIMIT	(64 * 1024 * 1024)
+#define SNMP_JOBS_MAX		256
+#define SNMP_SLICE_TIMEOUT	0
+#define SNMP_SLICE_TIMEOUT_MAX	(7 * 86400)
+
 void snmp_flow_init(snmp_write_t *out);
 void snmp_flow_write(snmp_write_t *out, snmp_packet_t *pkt);
 void snmp_flow_done(snmp_write_t *out);
@@ -292,8 +456,17 @@ typedef struct _snmp_filter snmp_filter_t;
 
 snmp_filter_t* snmp_filter_new(const char *regex, char **error);
 void snmp_filter_apply(snmp_filter_t *filter, snmp_packet_t *pkt);
+void snmp_filter_apply_batch(snmp_filter_t *filter,
+			     snmp_packet_t **pkts, size_t n);
 void snmp_filter_delete(snmp_filter_t *filter);
 
+/*
+ * Compute the decode level of the readers from the fields a
+ * filter-out filter hides.
+ */
+
+snmp_decode_t snmp_filter_decode(snmp_filter_t *filter);
+
 /*
  * Interface for anonymization. This is likely to change since we
  * still code this part of the tool.
@@ -301,6 +474,7 @@ void snmp_filter_delete(snmp_filter_t *filter);
 
 void snmp_anon_learn(snmp_packet_t *pkt);
 void snmp_anon_apply(snmp_packet_t *pkt);
+void snmp_anon_apply_batch(snmp_packet_t **pkts, size_t n);
 
 /*
  * Other useful global symbols...
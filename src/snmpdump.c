@@ -50,9 +50,9 @@ typedef enum {
 typedef struct {
     uint64_t cnt;
     snmp_filter_t *filter;
-    void (*do_filter)(snmp_filter_t *filter, snmp_packet_t *pkt);
-    void (*do_learn)(snmp_packet_t *pkt);
-    void (*do_anon)(snmp_packet_t *pkt);
+    void (*do_filter)(snmp_filter_t *filter, snmp_packet_t **pkts, size_t n);
+    void (*do_learn)(snmp_packet_t **pkts, size_t n);
+    void (*do_anon)(snmp_packet_t **pkts, size_t n);
     void (*do_flow_init)(snmp_write_t *out);
     void (*do_flow_write)(snmp_write_t *out, snmp_packet_t *pkt);
     void (*do_flow_done)(snmp_write_t *out);
@@ -60,34 +60,25 @@ typedef struct {
     int flags;
 } callback_state_t;
 
+typedef struct {
+    input_t input;
+    char *expr;
+} reader_state_t;
+
 
 /*
- * The per message callback which does all the processing and
- * printing, controlled by the state argument. This function is called
- * with a NULL packet pointer once we are done processing all packets.
+ * The batch callback which does all the processing and printing,
+ * controlled by the state argument. Every stage processes the whole
+ * batch before the next stage is called.
  */
 
 static void
-print(snmp_packet_t *pkt, void *user_data)
+print_batch(snmp_packet_t **pkts, size_t n, void *user_data)
 {
     callback_state_t *state = (callback_state_t *) user_data;
+    size_t i;
 
-    if (! state) {
-	return;
-    }
-
-    /* Cleanup by printing the proper closing text in case we have
-     * dealt with all packets.
-     */
-
-    if (! pkt) {
-	if (state->do_flow_done) {
-	    state->do_flow_done(&state->out);
-	    return;
-	}
-	if (state->cnt && state->out.write_end && state->out.stream) {
-	    state->out.write_end(state->out.stream);
-	}
+    if (! state || ! n) {
 	return;
     }
 
@@ -96,7 +87,7 @@ print(snmp_packet_t *pkt, void *user_data)
      */
     
     if (state->filter && state->do_filter) {
-	state->do_filter(state->filter, pkt);
+	state->do_filter(state->filter, pkts, n);
     }
 
     /*
@@ -106,18 +97,20 @@ print(snmp_packet_t *pkt, void *user_data)
      */
 
     if (state->flags & STATE_FLAG_V1V2) {
-	snmp_pkt_v1tov2(pkt);
+	for (i = 0; i < n; i++) {
+	    snmp_pkt_v1tov2(pkts[i]);
+	}
 	if (state->filter && state->do_filter) {
-	    state->do_filter(state->filter, pkt);
+	    state->do_filter(state->filter, pkts, n);
 	}
     }
 
     if (state->do_learn) {
-	state->do_learn(pkt);
+	state->do_learn(pkts, n);
     }
 
     if (state->do_anon) {
-	state->do_anon(pkt);
+	state->do_anon(pkts, n);
     }
 
     /*
@@ -125,46 +118,165 @@ print(snmp_packet_t *pkt, void *user_data)
      */
 
     if (state->do_flow_write) {
-	state->do_flow_write(&state->out, pkt);
-	if (state->flags & STATE_FLAG_V1V2) {
-	    snmp_pkt_delete(pkt);
+	for (i = 0; i < n; i++) {
+	    state->do_flow_write(&state->out, pkts[i]);
 	}
 	return;
     }
 
     /* Otherwise, check whether we have to generate a header and then
-     * print the packet.
+     * print the packets.
      */
 
     if (state->cnt == 0 && state->out.stream && state->out.write_new) {
 	state->out.write_new(state->out.stream);
     }
 
-    if (state->out.stream && state->out.write_pkt) {
-	state->out.write_pkt(state->out.stream, pkt);
+    if (state->out.stream && state->out.write_pkts) {
+	state->out.write_pkts(state->out.stream, pkts, n);
     }
-    state->cnt++;
+    state->cnt += n;
+}
 
-    if (state->flags & STATE_FLAG_V1V2) {
-	snmp_pkt_delete(pkt);
+
+/*
+ * The per message callback used by the merge module. This function
+ * is called with a NULL packet pointer once we are done processing
+ * all packets.
+ */
+
+static void
+print(snmp_packet_t *pkt, void *user_data)
+{
+    callback_state_t *state = (callback_state_t *) user_data;
+
+    if (! state) {
+	return;
+    }
+
+    /* Cleanup by printing the proper closing text in case we have
+     * dealt with all packets.
+     */
+
+    if (! pkt) {
+	if (state->do_flow_done) {
+	    state->do_flow_done(&state->out);
+	    return;
+	}
+	if (state->cnt && state->out.write_end && state->out.stream) {
+	    state->out.write_end(state->out.stream);
+	}
+	return;
+    }
+
+    print_batch(&pkt, 1, state);
+}
+
+
+/*
+ * Figure out how much of a message the processing chain looks at so
+ * that the readers can skip the rest. Only the filter hides things;
+ * slices are formed by comparing varbind names, so we keep the names
+ * even if they are not written.
+ */
+
+static snmp_decode_t
+decode_level(callback_state_t *state)
+{
+    snmp_decode_t level = SNMP_DECODE_ALL;
+
+    if (state->filter && state->do_filter) {
+	level = snmp_filter_decode(state->filter);
+    }
+    if (state->do_flow_write == snmp_slice_write
+	&& (level & SNMP_DECODE_PDU)) {
+	level &= ~SNMP_DECODE_PDU;
+	level |= SNMP_DECODE_NAMES;
+    }
+    return level;
+}
+
+
+/*
+ * Read a file in the selected input format, one message at a time.
+ * This is the read function of the merge module, so it may run on
+ * several threads.
+ */
+
+static void
+read_file(const char *file, void *reader_data,
+	  snmp_callback func, void *user_data)
+{
+    reader_state_t *reader = (reader_state_t *) reader_data;
+
+    switch (reader->input) {
+    case INPUT_XML:
+	snmp_xml_read_file(file, func, user_data);
+	break;
+    case INPUT_PCAP:
+	snmp_pcap_read_file(file, reader->expr, func, user_data);
+	break;
+    case INPUT_CSV:
+	snmp_csv_read_file(file, func, user_data);
+	break;
+    }
+}
+
+
+/*
+ * Read a file or a stream in the selected input format in batches.
+ */
+
+static void
+read_file_batch(const char *file, reader_state_t *reader,
+		snmp_batch_callback func, void *user_data)
+{
+    switch (reader->input) {
+    case INPUT_XML:
+	snmp_xml_read_file_batch(file, func, user_data);
+	break;
+    case INPUT_PCAP:
+	snmp_pcap_read_file_batch(file, reader->expr, func, user_data);
+	break;
+    case INPUT_CSV:
+	snmp_csv_read_file_batch(file, func, user_data);
+	break;
+    }
+}
+
+static void
+read_stream_batch(FILE *stream, reader_state_t *reader,
+		  snmp_batch_callback func, void *user_data)
+{
+    switch (reader->input) {
+    case INPUT_XML:
+	snmp_xml_read_stream_batch(stream, func, user_data);
+	break;
+    case INPUT_PCAP:
+	snmp_pcap_read_stream_batch(stream, reader->expr, func, user_data);
+	break;
+    case INPUT_CSV:
+	snmp_csv_read_stream_batch(stream, func, user_data);
+	break;
     }
 }
 
 
 /*
  * The main function to parse arguments, initialize the libraries and
- * to fire off the libnids library using nids_run() for every input
- * file we process.
+ * to fire off the reader for every input file we process.
  */
 
 int
 main(int argc, char **argv)
 {
-    int i, c;
-    char *expr = NULL, *path = NULL, *prefix = NULL;
+    int i, c, merge = 0;
+    unsigned readers = SNMP_MERGE_READERS;
+    char *path = NULL, *prefix = NULL;
     output_t output = OUTPUT_XML;
-    input_t input = INPUT_PCAP;
-    char *errmsg;
+    reader_state_t _reader, *reader = &_reader;
+    char *errmsg, *end;
+    unsigned long ul;
     anon_key_t *key = NULL;
     callback_state_t _state, *state = &_state;
     FILE *stream = stdout;
@@ -172,14 +284,18 @@ main(int argc, char **argv)
     smiInit(progname);
 
     memset(state, 0, sizeof(*state));
+    memset(reader, 0, sizeof(*reader));
+    reader->input = INPUT_PCAP;
+    state->out.cache_window = SNMP_CACHE_WINDOW;
+    state->out.slice_timeout = SNMP_SLICE_TIMEOUT;
 
     key = anon_key_new();
     anon_key_set_random(key);
 
-    while ((c = getopt(argc, argv, "FSVz:f:w:i:o:c:m:hap:tC:P:")) != -1) {
+    while ((c = getopt(argc, argv, "FSMN:XVvz:f:w:i:o:c:m:hap:tC:P:W:L:O:B:j:R:I:")) != -1) {
 	switch (c) {
 	case 'a':
-	    state->do_anon = snmp_anon_apply;
+	    state->do_anon = snmp_anon_apply_batch;
 	    break;
 	case 'z':
 	    state->filter = snmp_filter_new(optarg, &errmsg);
@@ -188,7 +304,7 @@ main(int argc, char **argv)
 			progname, errmsg);
 		continue;
 	    }
-	    state->do_filter = snmp_filter_apply;
+	    state->do_filter = snmp_filter_apply_batch;
 	    break;
 	case 'w':
 	    stream = fopen(optarg, "w");
@@ -200,11 +316,11 @@ main(int argc, char **argv)
 	    break;
 	case 'i':
 	    if (strcmp(optarg, "pcap") == 0) {
-		input = INPUT_PCAP;
+		reader->input = INPUT_PCAP;
 	    } else if (strcmp(optarg, "xml") == 0) {
-		input = INPUT_XML;
+		reader->input = INPUT_XML;
 	    } else if (strcmp(optarg, "csv") == 0) {
-		input = INPUT_CSV;
+		reader->input = INPUT_CSV;
 	    } else {
 		fprintf(stderr, "%s: ignoring input format: %s unknown\n",
 			progname, optarg);
@@ -233,7 +349,7 @@ main(int argc, char **argv)
 	    anon_key_set_passphase(key, optarg);
 	    break;
 	case 'f':
-	    expr = optarg;
+	    reader->expr = optarg;
 	    break;
 	case 'c':
 	    smiReadConfig(optarg, progname);
@@ -249,12 +365,94 @@ main(int argc, char **argv)
 	    state->do_flow_write = snmp_slice_write;
 	    state->do_flow_done = snmp_slice_done;
 	    break;
+	case 'M':
+	    merge = 1;
+	    break;
+	case 'N':
+	    ul = strtoul(optarg, &end, 10);
+	    if (! *optarg || *end || ul == 0 || ul > SNMP_MERGE_READERS_MAX) {
+		fprintf(stderr, "%s: invalid number of merge readers: %s\n",
+			progname, optarg);
+		exit(1);
+	    }
+	    readers = ul;
+	    break;
+	case 'X':
+	    snmp_xml_set_scanner(1);
+	    break;
+	case 'W':
+	    ul = strtoul(optarg, &end, 10);
+	    if (! *optarg || *end || ul > SNMP_CACHE_WINDOW_MAX) {
+		fprintf(stderr, "%s: invalid cache window: %s\n",
+			progname, optarg);
+		exit(1);
+	    }
+	    state->out.cache_window = ul;
+	    break;
+	case 'L':
+	    ul = strtoul(optarg, &end, 10);
+	    if (! *optarg || *end) {
+		fprintf(stderr, "%s: invalid cache limit: %s\n",
+			progname, optarg);
+		exit(1);
+	    }
+	    state->out.cache_limit = ul;
+	    break;
+	case 'O':
+	    ul = strtoul(optarg, &end, 10);
+	    if (! *optarg || *end || ul == 0) {
+		fprintf(stderr, "%s: invalid open file limit: %s\n",
+			progname, optarg);
+		exit(1);
+	    }
+	    state->out.open_limit = ul;
+	    break;
+	case 'B':
+	    ul = strtoul(optarg, &end, 10);
+	    if (! *optarg || *end || ul == 0) {
+		fprintf(stderr, "%s: invalid buffer limit: %s\n",
+			progname, optarg);
+		exit(1);
+	    }
+	    state->out.buffer_limit = ul;
+	    break;
+	case 'j':
+	    ul = strtoul(optarg, &end, 10);
+	    if (! *optarg || *end || ul == 0 || ul > SNMP_JOBS_MAX) {
+		fprintf(stderr, "%s: invalid number of jobs: %s\n",
+			progname, optarg);
+		exit(1);
+	    }
+	    state->out.jobs = ul;
+	    break;
+	case 'R':
+	    ul = strtoul(optarg, &end, 10);
+	    if (! *optarg || *end || ul == 0 || ul > SNMP_JOBS_MAX) {
+		fprintf(stderr, "%s: invalid number of reader jobs: %s\n",
+			progname, optarg);
+		exit(1);
+	    }
+	    snmp_csv_set_jobs(ul);
+	    snmp_xml_set_jobs(ul);
+	    break;
+	case 'I':
+	    ul = strtoul(optarg, &end, 10);
+	    if (! *optarg || *end || ul > SNMP_SLICE_TIMEOUT_MAX) {
+		fprintf(stderr, "%s: invalid slice timeout: %s\n",
+			progname, optarg);
+		exit(1);
+	    }
+	    state->out.slice_timeout = ul;
+	    break;
+	case 'v':
+	    state->out.verbose = 1;
+	    break;
 	case 'V':
 	    printf("%s %s\n", progname, VERSION);
 	    exit(0);
 	case 'h':
 	case '?':
-	    printf("%s [-c config] [-m module] [-f filter] [-i format] [-o format] [-z regex] [-p passphrase] [-w file] [-h] [-V] [-F] [-S] [-C path] [-P prefix] [-a] file ... \n", progname);
+	    printf("%s [-c config] [-m module] [-f filter] [-i format] [-o format] [-z regex] [-p passphrase] [-w file] [-h] [-v] [-V] [-F] [-S] [-M] [-N files] [-X] [-C path] [-P prefix] [-W seconds] [-L count] [-O count] [-B bytes] [-j jobs] [-R jobs] [-I seconds] [-a] file ... \n", progname);
 	    exit(0);
 	}
     }
@@ -262,6 +460,7 @@ main(int argc, char **argv)
     state->out.stream = stream;
     state->out.write_new = NULL;
     state->out.write_pkt = NULL;
+    state->out.write_pkts = NULL;
     state->out.write_end = NULL;
     state->out.path = path;
     state->out.prefix = prefix;
@@ -274,12 +473,14 @@ main(int argc, char **argv)
     case OUTPUT_XML:
 	state->out.write_new = snmp_xml_write_stream_new;
 	state->out.write_pkt = snmp_xml_write_stream_pkt;
+	state->out.write_pkts = snmp_xml_write_stream_pkts;
 	state->out.write_end = snmp_xml_write_stream_end;
 	state->out.ext = "xml";
 	break;
     case OUTPUT_CSV:
 	state->out.write_new = snmp_csv_write_stream_new;
 	state->out.write_pkt = snmp_csv_write_stream_pkt;
+	state->out.write_pkts = snmp_csv_write_stream_pkts;
 	state->out.write_end = snmp_csv_write_stream_end;
 	state->out.ext = "csv";
 	break;
@@ -288,31 +489,18 @@ main(int argc, char **argv)
 	abort();
     }
 
+    snmp_pcap_set_decode(decode_level(state));
+    snmp_csv_set_decode(decode_level(state));
+    snmp_xml_set_decode(decode_level(state));
+
     if (optind == argc) {
-	switch (input) {
-	case INPUT_XML:
-	    snmp_xml_read_stream(stdin, print, state);
-	    break;
-	case INPUT_PCAP:
-	    snmp_pcap_read_stream(stdin, expr, print, state);
-	    break;
-	case INPUT_CSV:
-	    snmp_csv_read_stream(stdin, print, state);
-	    break;
-	}
+	read_stream_batch(stdin, reader, print_batch, state);
+    } else if (merge && argc - optind > 1) {
+	snmp_merge_read_files(argv + optind, argc - optind, readers,
+			      read_file, reader, print, state);
     } else {
 	for (i = optind; i < argc; i++) {
-	    switch (input) {
-	    case INPUT_XML:
-		snmp_xml_read_file(argv[i], print, state);
-		break;
-	    case INPUT_PCAP:
-		snmp_pcap_read_file(argv[i], expr, print, state);
-		break;
-	    case INPUT_CSV:
-		snmp_csv_read_file(argv[i], print, state);
-		break;
-	    }
+	    read_file_batch(argv[i], reader, print_batch, state);
 	}
     }
     print(NULL, state);
@@ -0,0 +1,155 @@
+/*
+ * Generated by xml-elements.pl from snmptrace.rnc - do not edit.
+ */
+
+#define ELEMENT_TABLE_SIZE	128
+
+static const unsigned char element_asso[256] = {
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0, 117,   0,   0,
+      0,   0, 103,   0, 110,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0, 105,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,  52,  16,  52,  88,  63,  29,   9,   0,  64,   0,   0, 105,  44, 120,  44,
+    120,   0,  32,  96,  61,  38,  93,  30,  33, 102,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+};
+
+static const struct element element_table[ELEMENT_TABLE_SIZE] = {
+    { NULL, IN_NONE },
+    { "ipaddress", IN_IPADDRESS },
+    { "variable-bindings", IN_VARIABLE_BINDINGS },
+    { "report", IN_REPORT },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { "error-index", IN_ERROR_INDEX },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { "auth-engine-id", IN_AUTH_ENGINE_ID },
+    { "trap2", IN_TRAP2 },
+    { "object-identifier", IN_OBJECT_IDENTIFIER },
+    { "inform", IN_INFORM },
+    { "response", IN_RESPONSE },
+    { "auth-params", IN_AUTH_PARAMS },
+    { "dst-port", IN_DST_PORT },
+    { "dst-ip", IN_DST_IP },
+    { "opaque", IN_OPAQUE },
+    { "end-of-mib-view", IN_END_OF_MIB_VIEW },
+    { NULL, IN_NONE },
+    { "auth-engine-boots", IN_AUTH_ENGINE_BOOTS },
+    { "agent-addr", IN_AGENT_ADDR },
+    { "version", IN_VERSION },
+    { "src-port", IN_SRC_PORT },
+    { "src-ip", IN_SRC_IP },
+    { NULL, IN_NONE },
+    { "unsigned32", IN_UNSIGNED32 },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { "specific-trap", IN_SPECIFIC_TRAP },
+    { "message", IN_MESSAGE },
+    { "unsigned64", IN_COUNTER64 },
+    { "enterprise", IN_ENTERPRISE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { "inform-request", IN_INFORM },
+    { NULL, IN_NONE },
+    { "generic-trap", IN_GENERIC_TRAP },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { "name", IN_NAME },
+    { "time-stamp", IN_TIME_STAMP },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { "integer32", IN_INTEGER32 },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { "snmp", IN_SNMP },
+    { NULL, IN_NONE },
+    { "context-name", IN_CONTEXT_NAME },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { "request-id", IN_REQUEST_ID },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { "set-request", IN_SET_REQUEST },
+    { "community", IN_COMMUNITY },
+    { "msg-id", IN_MSG_ID },
+    { "error-status", IN_ERROR_STATUS },
+    { "snmpV2-trap", IN_TRAP2 },
+    { NULL, IN_NONE },
+    { "get-next-request", IN_GET_NEXT_REQUEST },
+    { "scoped-pdu", IN_SCOPED_PDU },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { "max-size", IN_MAX_SIZE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { "priv-params", IN_PRIV_PARAMS },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { "context-engine-id", IN_CONTEXT_ENGINE_ID },
+    { "null", IN_NULL },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { "value", IN_VALUE },
+    { "counter32", IN_COUNTER32 },
+    { "flags", IN_FLAGS },
+    { "timeticks", IN_TIMETICKS },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { "get-bulk-request", IN_GET_BULK_REQUEST },
+    { NULL, IN_NONE },
+    { "counter64", IN_COUNTER64 },
+    { "no-such-object", IN_NO_SUCH_OBJECT },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { "no-such-instance", IN_NO_SUCH_INSTANCE },
+    { "time-sec", IN_TIME_SEC },
+    { "time-usec", IN_TIME_USEC },
+    { "user", IN_USER },
+    { "get-request", IN_GET_REQUEST },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { NULL, IN_NONE },
+    { "trap", IN_TRAP },
+    { "security-model", IN_SEC_MODEL },
+    { "auth-engine-time", IN_AUTH_ENGINE_TIME },
+    { NULL, IN_NONE },
+    { "packet", IN_PACKET },
+    { "usm", IN_USM },
+    { "varbind", IN_VARBIND },
+    { NULL, IN_NONE },
+    { "octet-string", IN_OCTET_STRING },
+    { NULL, IN_NONE },
+};
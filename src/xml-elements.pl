@@ -0,0 +1,142 @@
+#!/usr/bin/perl
+#
+# xml-elements.pl --
+#
+# Generate the perfect hash tables which xml-read.c uses to map XML
+# element names to parser states. The element names are taken from
+# the RELAX NG compact schema of the snmptrace format, together with
+# a few older names the reader still accepts.
+#
+# usage: perl xml-elements.pl ../doc/snmptrace.rnc > xml-elements.h
+#
+# The hash value of a name is its length plus the associated values
+# of the first, the fifth (or first for short names) and the last
+# character, modulo the table size. The associated values are found
+# by a randomized search, so the output changes from run to run but
+# every table it prints is collision free.
+#
+# $Id$
+#
+
+use strict;
+
+my $size = 128;
+
+# names which are not in the schema but still accepted
+my %alias = (
+    'inform'		=> 'IN_INFORM',
+    'trap2'		=> 'IN_TRAP2',
+    'unsigned64'	=> 'IN_COUNTER64',
+    'value'		=> 'IN_VALUE',
+);
+
+# states which do not follow the naming rule IN_<NAME>
+my %state = (
+    'inform-request'	=> 'IN_INFORM',
+    'snmpV2-trap'	=> 'IN_TRAP2',
+    'security-model'	=> 'IN_SEC_MODEL',
+);
+
+# the document element does not change the parser state
+my %ignore = ('snmptrace' => 1);
+
+my (%names, @names, @chars, %asso, %seen);
+
+my $rnc = shift or die "usage: $0 snmptrace.rnc\n";
+open(RNC, $rnc) or die "$0: cannot open $rnc: $!\n";
+{
+    local $/;
+    $_ = <RNC>;
+}
+close(RNC);
+
+s/#.*//g;
+while (/element\s+([\w-]+)/g) {
+    $names{$1} = 1;
+}
+while (/element\s*\(([^)]*)\)/g) {
+    foreach my $n (split(/[\s|]+/, $1)) {
+	$names{$n} = 1 if $n ne '';
+    }
+}
+
+foreach my $n (keys %alias) {
+    $names{$n} = 1;
+}
+@names = sort grep { ! $ignore{$_} } keys %names;
+
+sub mid {
+    my $n = shift;
+    return length($n) > 4 ? substr($n, 4, 1) : substr($n, 0, 1);
+}
+
+sub hash {
+    my $n = shift;
+    return (length($n) + $asso{substr($n, 0, 1)} + $asso{mid($n)}
+	    + $asso{substr($n, -1)}) % $size;
+}
+
+sub collisions {
+    my (%h, $k);
+    foreach my $n (@names) {
+	$k++ if $h{hash($n)}++;
+    }
+    return $k || 0;
+}
+
+foreach my $n (@names) {
+    foreach my $c (substr($n, 0, 1), mid($n), substr($n, -1)) {
+	push(@chars, $c) unless $seen{$c}++;
+    }
+}
+
+my $k = 1;
+for (my $try = 0; $k && $try < 1000; $try++) {
+    foreach my $c (@chars) {
+	$asso{$c} = int(rand($size));
+    }
+    $k = collisions();
+    for (my $i = 0; $k && $i < 20000; $i++) {
+	my $c = $chars[int(rand(@chars))];
+	my $old = $asso{$c};
+	$asso{$c} = int(rand($size));
+	my $n = collisions();
+	if ($n <= $k) {
+	    $k = $n;
+	} else {
+	    $asso{$c} = $old;
+	}
+    }
+}
+die "$0: no perfect hash found for table size $size\n" if $k;
+
+my @table;
+foreach my $n (@names) {
+    $table[hash($n)] = $n;
+}
+
+print "/*\n";
+print " * Generated by xml-elements.pl from snmptrace.rnc - do not edit.\n";
+print " */\n\n";
+print "#define ELEMENT_TABLE_SIZE\t$size\n\n";
+print "static const unsigned char element_asso[256] = {\n";
+for (my $i = 0; $i < 256; $i += 16) {
+    print "    ", join(", ", map {
+	sprintf("%3d", defined($asso{chr($_)}) ? $asso{chr($_)} : 0)
+    } ($i .. $i + 15)), ",\n";
+}
+print "};\n\n";
+print "static const struct element element_table[ELEMENT_TABLE_SIZE] = {\n";
+for (my $i = 0; $i < $size; $i++) {
+    my $n = $table[$i];
+    if (! defined($n)) {
+	print "    { NULL, IN_NONE },\n";
+	next;
+    }
+    my $s = $alias{$n} || $state{$n};
+    if (! $s) {
+	($s = "IN_" . uc($n)) =~ s/-/_/g;
+    }
+    print "    { \"$n\", $s },\n";
+}
+print "};\n";
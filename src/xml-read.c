@@ -17,6 +17,7 @@
 #include <libxml/xmlreader.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -32,7 +33,12 @@
 
 #define ERROR(format, ...) fprintf (stderr, format, ## __VA_ARGS__)
 
-static enum {
+/*
+ * The parser state is kept by process_reader() and passed down, so
+ * that several files can be read on separate threads.
+ */
+
+typedef enum {
 	IN_NONE,
 	IN_SNMPTRACE,
 	IN_PACKET,
@@ -96,7 +102,9 @@ static enum {
 	IN_NO_SUCH_INSTANCE,
 	IN_END_OF_MIB_VIEW,
 	IN_VALUE
-} state = IN_NONE;
+} xml_state_t;
+
+static snmp_decode_t skip = SNMP_DECODE_ALL;	/* fields we do not decode */
 
 
 /*
@@ -162,18 +170,17 @@ snmp_packet_free(snmp_packet_t* packet) {
  * using a linked list to keep track of parent-states
  */
 static void
-set_state(int newState) {
-    state = newState;
+set_state(xml_state_t *state, xml_state_t newState) {
+    *state = newState;
 }
 
 /*
- * parse node currently in reader for snmp_int32_t
+ * parse the text value for snmp_int32_t
  */
 static void
-process_snmp_int32(xmlTextReaderPtr reader, snmp_int32_t* snmpint) {
+process_snmp_int32(const xmlChar *value, snmp_int32_t* snmpint) {
     char *end;
     assert(snmpint);
-    const xmlChar* value = xmlTextReaderConstValue(reader);
     if (value) {
 	snmpint->value = (int32_t) strtol((char *) value, &end, 10);
 	if (*end == '\0' && *value != '\0') {
@@ -183,13 +190,12 @@ process_snmp_int32(xmlTextReaderPtr reader, snmp_int32_t* snmpint) {
 }
 
 /*
- * parse node currently in reader for snmp_uint32_t
+ * parse the text value for snmp_uint32_t
  */
 static void
-process_snmp_uint32(xmlTextReaderPtr reader, snmp_uint32_t* snmpint) {
+process_snmp_uint32(const xmlChar *value, snmp_uint32_t* snmpint) {
     char *end;
     assert(snmpint);
-    const xmlChar* value = xmlTextReaderConstValue(reader);
     if (value) {
 	snmpint->value = (uint32_t) strtoul((char *) value, &end, 10);
 	if (*end == '\0' && *value != '\0') {
@@ -199,13 +205,12 @@ process_snmp_uint32(xmlTextReaderPtr reader, snmp_uint32_t* snmpint) {
 }
 
 /*
- * parse node currently in reader for snmp_uint64_t
+ * parse the text value for snmp_uint64_t
  */
 static void
-process_snmp_uint64(xmlTextReaderPtr reader, snmp_uint64_t* snmpint) {
+process_snmp_uint64(const xmlChar *value, snmp_uint64_t* snmpint) {
     char *end;
     assert(snmpint);
-    const xmlChar* value = xmlTextReaderConstValue(reader);
     if (value) {
 	snmpint->value = (uint64_t) strtoull((char *) value, &end, 10);
 	if (*end == '\0' && *value != '\0') {
@@ -215,12 +220,11 @@ process_snmp_uint64(xmlTextReaderPtr reader, snmp_uint64_t* snmpint) {
 }
 
 /*
- * parse node currently in reader for snmp_ipaddr_t
+ * parse the text value for snmp_ipaddr_t
  */
 static void
-process_snmp_ipaddr(xmlTextReaderPtr reader, snmp_ipaddr_t* snmpaddr) {
+process_snmp_ipaddr(const xmlChar *value, snmp_ipaddr_t* snmpaddr) {
     assert(snmpaddr);
-    const xmlChar* value = xmlTextReaderConstValue(reader);
     if (value) {
 	if (inet_pton(AF_INET, (const char*) value, &(snmpaddr->value)) > 0) {
 	    snmpaddr->attr.flags |= SNMP_FLAG_VALUE;
@@ -234,20 +238,17 @@ process_snmp_ipaddr(xmlTextReaderPtr reader, snmp_ipaddr_t* snmpaddr) {
     }
 }
 
-/* helper function for dehexify */
-static int
-char_to_i(char c){
-    int n = c;
-    if (n >= '0' && n <= '9') {
-	n -= '0';
-    } else if (n >= 'a' && n <= 'f') {
-	n -= 'a' - 10;
-    } else if (n >= 'A' && n <= 'F') {
-	n -= 'A' - 10;
-    } else {
-	n = -1;
+/*
+ * parse the text value for snmp_ip6addr_t
+ */
+static void
+process_snmp_ip6addr(const xmlChar *value, snmp_ip6addr_t* snmpaddr) {
+    assert(snmpaddr);
+    if (value) {
+	if (inet_pton(AF_INET6, (const char*) value, &(snmpaddr->value)) > 0) {
+	    snmpaddr->attr.flags |= SNMP_FLAG_VALUE;
+	}
     }
-    return n;
 }
 
 /*
@@ -258,31 +259,24 @@ char_to_i(char c){
  */
 static unsigned char*
 dehexify(const char *str, unsigned *length) {
-    static size_t size = 0; /* buffer size, i.e. length of output 
+    size_t size;	    /* buffer size, i.e. length of output 
 			     * which is strlen(str)/2
 			     */
-    static unsigned char *buffer = NULL;
-    int i;
-    int tmp, tmp2;
+    unsigned char *buffer;
+    size_t len = strlen(str);
     
-    if (strlen(str)%2 != 0) {
+    if (len%2 != 0) {
 	/* octet string implies pairs of hex numbers */
 	return NULL;
     }
-    size = strlen(str)/2;
+    size = len/2;
     assert(size);
     buffer = malloc(size);
     assert(buffer);
-    memset(buffer, 0, size);
-    for (i = 0; i < size; i++) {
-	tmp = char_to_i(str[2*i]);
-	tmp2 = char_to_i(str[2*i+1]);
-	if (tmp < 0 || tmp2 < 0) {
-	    /* encountered invalid character */
-	    free(buffer);
-	    return NULL;
-	}
-	buffer[i] = tmp*16 + tmp2;
+    if (snmp_hex_decode(buffer, str, size) < 0) {
+	/* encountered invalid character */
+	free(buffer);
+	return NULL;
     }
     *length = size;
     DEBUG("dehexify(%s): %s\n", str, buffer);
@@ -290,12 +284,11 @@ dehexify(const char *str, unsigned *length) {
 }
 
 /*
- * parse node currently in reader for snmp_octs_t
+ * parse the text value for snmp_octs_t
  */
 static void
-process_snmp_octs(xmlTextReaderPtr reader, snmp_octs_t* snmpstr) {
+process_snmp_octs(const xmlChar *value, snmp_octs_t* snmpstr) {
     assert(snmpstr);
-    const xmlChar* value = xmlTextReaderConstValue(reader);
     if (value) {
 	snmpstr->value = dehexify((const char *) value, &snmpstr->len);
 	if (snmpstr->value)
@@ -322,15 +315,14 @@ count_snmp_oid(const char* value) {
 }
 
 /*
- * parse node currently in reader for snmp_oid_t
+ * parse the text value for snmp_oid_t
  */
 static void
-process_snmp_oid(xmlTextReaderPtr reader, snmp_oid_t* snmpoid) {
+process_snmp_oid(const xmlChar *value, snmp_oid_t* snmpoid) {
     int i;
     char *end;
     int count = 0;
     assert(snmpoid);
-    const xmlChar* value = xmlTextReaderConstValue(reader);
     count = count_snmp_oid((const char*) value);
     if (value && count > 0) {
 	snmpoid->value = malloc(sizeof(uint32_t)*count);
@@ -384,682 +376,786 @@ process_snmp_attr(xmlTextReaderPtr reader, snmp_attr_t* attr) {
 }
 
 /*
- * process node currently in reader by filling in snmp_packet_t structure
- * allocates a new snmp_packet_t when new "packet" xml node is reached
- * when end of "packet" xml node is reached, callback function is called
+ * Element names are mapped to parser states with a perfect hash over
+ * the element names of doc/snmptrace.rnc and the older aliases we
+ * still accept (inform, trap2, unsigned64). The hash value is the
+ * name length plus the associated values of the first, the fifth
+ * (or first for short names) and the last character, modulo the size
+ * of the table. Each name hits its own slot, so a lookup costs one
+ * string compare. The tables in xml-elements.h are generated from the
+ * schema by xml-elements.pl.
+ */
+
+struct element {
+    const char *name;
+    xml_state_t state;
+};
+
+#include "xml-elements.h"
+
+static xml_state_t
+element_lookup(const xmlChar *name, int len)
+{
+    const struct element *e;
+
+    if (! name || len < 3) {
+	return IN_NONE;
+    }
+    e = &element_table[(len + element_asso[name[0]]
+			+ element_asso[name[len > 4 ? 4 : 0]]
+			+ element_asso[name[len - 1]]) % ELEMENT_TABLE_SIZE];
+    if (e->name && xmlStrncmp(name, BAD_CAST(e->name), len) == 0
+	&& e->name[len] == '\0') {
+	return e->state;
+    }
+    return IN_NONE;
+}
+
+static int
+pdu_type(xml_state_t state)
+{
+    switch (state) {
+    case IN_GET_REQUEST:	return SNMP_PDU_GET;
+    case IN_GET_NEXT_REQUEST:	return SNMP_PDU_GETNEXT;
+    case IN_GET_BULK_REQUEST:	return SNMP_PDU_GETBULK;
+    case IN_SET_REQUEST:	return SNMP_PDU_SET;
+    case IN_INFORM:		return SNMP_PDU_INFORM;
+    case IN_TRAP2:		return SNMP_PDU_TRAP2;
+    case IN_RESPONSE:		return SNMP_PDU_RESPONSE;
+    case IN_REPORT:		return SNMP_PDU_REPORT;
+    default:			return 0;
+    }
+}
+
+#define NODE_NEXT	0
+#define NODE_SKIP	1
+#define NODE_PACKET	2
+
+/*
+ * Start a new element: update the parser state and the packet, and
+ * return in attr where the blen and vlen attributes of the element go.
+ * Returns NODE_SKIP if the subtree of the element should be skipped.
+ * This is shared by the libxml2 reader and the snmptrace scanner.
+ */
+
+static int
+process_element(xml_state_t elem, xml_state_t *state,
+		snmp_packet_t *packet, snmp_varbind_t **varbind,
+		snmp_attr_t **attr)
+{
+    /*
+     * check what node we have:
+     * first has to come snmptrace
+     * node packet - allocate new snmp_msg_t
+     * other nodes - allocate respective storage part within
+     *		 current snmp_msg_t and fill in data
+     */
+    switch (elem) {
+    case IN_PACKET:
+	DEBUG("in PACKET\n");
+	set_state(state, IN_PACKET);
+	memset(packet, 0, sizeof(snmp_packet_t));
+	*varbind = NULL;
+	/* no attributes */
+	packet->attr.flags |= SNMP_FLAG_VALUE;
+	break;
+    /* time-sec */
+    case IN_TIME_SEC:
+	DEBUG("in TIME-SEC\n");
+	set_state(state, IN_TIME_SEC);
+	/* no attributes */
+	break;
+    /* time-usec */
+    case IN_TIME_USEC:
+	DEBUG("in TIME-USEC\n");
+	set_state(state, IN_TIME_USEC);
+	/* no attributes */
+	break;
+    /* src-ip */
+    case IN_SRC_IP:
+	DEBUG("in SRC-IP\n");
+	set_state(state, IN_SRC_IP);
+	/* no attributes */
+	break;
+    /* src-port */
+    case IN_SRC_PORT:
+	DEBUG("in SRC-PORT\n");
+	set_state(state, IN_SRC_PORT);
+	/* no attributes */
+	break;
+    /* dst-ip */
+    case IN_DST_IP:
+	DEBUG("in DST-IP\n");
+	set_state(state, IN_DST_IP);
+	/* no attributes */
+	break;
+    /* dst-port */
+    case IN_DST_PORT:
+	DEBUG("in DST-PORT\n");
+	set_state(state, IN_DST_PORT);
+	/* no attributes */
+	break;
+    /* snmp */
+    case IN_SNMP:
+	DEBUG("in SNMP\n");
+	//assert(*state == IN_PACKET);
+	set_state(state, IN_SNMP);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.attr);
+	packet->snmp.attr.flags |= SNMP_FLAG_VALUE;
+	break;
+    /* version */
+    case IN_VERSION:
+	assert(*state == IN_SNMP);
+	set_state(state, IN_VERSION);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.version.attr);
+	break;
+    /* community */
+    case IN_COMMUNITY:
+	set_state(state, IN_COMMUNITY);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.community.attr);
+	break;
+    /* trap */
+    case IN_TRAP:
+	set_state(state, IN_TRAP);
+	packet->snmp.scoped_pdu.pdu.type = SNMP_PDU_TRAP1;
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.scoped_pdu.pdu.attr);
+	packet->snmp.scoped_pdu.pdu.attr.flags |= SNMP_FLAG_VALUE;
+	break;
+    /* enterprise */
+    case IN_ENTERPRISE:
+	set_state(state, IN_ENTERPRISE);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.scoped_pdu.pdu.enterprise.attr);
+	break;
+    /* agent-addr */
+    case IN_AGENT_ADDR:
+	set_state(state, IN_AGENT_ADDR);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.scoped_pdu.pdu.agent_addr.attr);
+	break;
+    /* generic-trap */
+    case IN_GENERIC_TRAP:
+	set_state(state, IN_GENERIC_TRAP);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.scoped_pdu.pdu.generic_trap.attr);
+	break;
+    /* specific-trap */
+    case IN_SPECIFIC_TRAP:
+	set_state(state, IN_SPECIFIC_TRAP);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.scoped_pdu.pdu.specific_trap.attr);
+	break;
+    /* time-stamp */
+    case IN_TIME_STAMP:
+	set_state(state, IN_TIME_STAMP);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.scoped_pdu.pdu.time_stamp.attr);
+	break;
+    /*
+     * get-request | get-next-request | get-bulk-request |
+     * set-request | inform-request | snmpV2-trap | response | report
+     */
+    case IN_GET_REQUEST:
+    case IN_GET_NEXT_REQUEST:
+    case IN_GET_BULK_REQUEST:
+    case IN_SET_REQUEST:
+    case IN_INFORM:
+    case IN_TRAP2:
+    case IN_RESPONSE:
+    case IN_REPORT:
+	/* state */
+	set_state(state, elem);
+	packet->snmp.scoped_pdu.pdu.type = pdu_type(elem);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.scoped_pdu.pdu.attr);
+	packet->snmp.scoped_pdu.pdu.attr.flags |= SNMP_FLAG_VALUE;
+	break;
+    /* request-id */
+    case IN_REQUEST_ID:
+	set_state(state, IN_REQUEST_ID);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.scoped_pdu.pdu.req_id.attr);
+	break;
+    /* error-status */
+    case IN_ERROR_STATUS:
+	set_state(state, IN_ERROR_STATUS);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.scoped_pdu.pdu.err_status.attr);
+	break;
+    /* error-index */
+    case IN_ERROR_INDEX:
+	set_state(state, IN_ERROR_INDEX);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.scoped_pdu.pdu.err_index.attr);
+	break;
+    /* variable-bindings */
+    case IN_VARIABLE_BINDINGS:
+	set_state(state, IN_VARIABLE_BINDINGS);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.scoped_pdu.pdu.varbindings.attr);
+	packet->snmp.scoped_pdu.pdu.varbindings.attr.flags
+	    |= SNMP_FLAG_VALUE;
+	if (skip & SNMP_SKIP_VARBINDS) {
+	    return NODE_SKIP;
+	}
+	break;
+    /* varbind */
+    case IN_VARBIND:
+	set_state(state, IN_VARBIND);
+	if (*varbind != NULL) {
+	    (*varbind)->next =
+		(snmp_varbind_t*) malloc(sizeof(snmp_varbind_t));
+	    *varbind = (*varbind)->next;
+	} else {
+	    *varbind = (snmp_varbind_t*) malloc(sizeof(snmp_varbind_t));
+	    packet->snmp.scoped_pdu.pdu.varbindings.varbind = *varbind;
+	}
+	assert(*varbind);
+	memset(*varbind,0,sizeof(snmp_varbind_t));
+	//DEBUG("malloc... *varbind: %x\n", *varbind);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(*varbind)->attr;
+	break;
+    /* varbind - name */
+    case IN_NAME:
+	assert(*state == IN_VARBIND);
+	set_state(state, IN_NAME);
+	assert(*varbind);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &((*varbind)->name.attr);
+	break;
+    /* varbind (- value) - null */
+    case IN_NULL:
+	assert(*state == IN_NAME); /* maybe not needed/wanted */
+	/* we should also check if parrent is varbind */
+	set_state(state, IN_NULL); 
+	assert(*varbind);
+	(*varbind)->type = SNMP_TYPE_NULL;
+	(*varbind)->attr.flags |= SNMP_FLAG_VALUE;
+	/* attributes */
+	/* blen, vlen */
+	*attr = &((*varbind)->value.null.attr);
+	break;
+    /* varbind (- value) - integer32 */
+    case IN_INTEGER32:
+	DEBUG("in INTEGER32\n");
+	assert(*state == IN_NAME); /* maybe not needed/wanted */
+	/* we should also check if parrent is varbind */
+	set_state(state, IN_INTEGER32); 
+	assert(*varbind);
+	(*varbind)->type = SNMP_TYPE_INT32;
+	(*varbind)->attr.flags |= SNMP_FLAG_VALUE;
+	/* attributes */
+	/* blen, vlen */
+	*attr = &((*varbind)->value.i32.attr);
+	break;
+    /* varbind (- value) - unsigned32 */
+    case IN_UNSIGNED32:
+	DEBUG("in UNSIGNED32\n");
+	assert(*state == IN_NAME); /* maybe not needed/wanted */
+	/* we should also check if parrent is varbind */
+	set_state(state, IN_UNSIGNED32); 
+	assert(*varbind);
+	(*varbind)->type = SNMP_TYPE_UINT32;
+	(*varbind)->attr.flags |= SNMP_FLAG_VALUE;
+	/* attributes */
+	/* blen, vlen */
+	*attr = &((*varbind)->value.u32.attr);
+	break;
+    /* varbind (- value) - counter32 */
+    case IN_COUNTER32:
+	DEBUG("in COUNTER32\n");
+	assert(*state == IN_NAME); /* maybe not needed/wanted */
+	/* we should also check if parrent is varbind */
+	set_state(state, IN_COUNTER32); 
+	assert(*varbind);
+	(*varbind)->type = SNMP_TYPE_COUNTER32;
+	(*varbind)->attr.flags |= SNMP_FLAG_VALUE;
+	/* attributes */
+	/* blen, vlen */
+	*attr = &((*varbind)->value.u32.attr);
+	break;
+    /* varbind (- value) - timeticks */
+    case IN_TIMETICKS:
+	DEBUG("in TIMETICKS\n");
+	assert(*state == IN_NAME); /* maybe not needed/wanted */
+	/* we should also check if parrent is varbind */
+	set_state(state, IN_TIMETICKS); 
+	assert(*varbind);
+	(*varbind)->type = SNMP_TYPE_TIMETICKS;
+	(*varbind)->attr.flags |= SNMP_FLAG_VALUE;
+	/* attributes */
+	/* blen, vlen */
+	*attr = &((*varbind)->value.u32.attr);
+	break;
+    /* varbind (- value) - counter64 */
+    case IN_COUNTER64:
+	DEBUG("in COUNTER64\n");
+	assert(*state == IN_NAME); /* maybe not needed/wanted */
+	/* we should also check if parrent is varbind */
+	set_state(state, IN_COUNTER64); 
+	assert(*varbind);
+	(*varbind)->type = SNMP_TYPE_COUNTER64;
+	(*varbind)->attr.flags |= SNMP_FLAG_VALUE;
+	/* attributes */
+	/* blen, vlen */
+	*attr = &((*varbind)->value.u64.attr);
+	break;
+    /* varbind (- value) - ipaddress */
+    case IN_IPADDRESS:
+	DEBUG("in IPADDRESS\n");
+	assert(*state == IN_NAME); /* maybe not needed/wanted */
+	/* we should also check if parrent is varbind */
+	set_state(state, IN_IPADDRESS); 
+	assert(*varbind);
+	(*varbind)->type = SNMP_TYPE_IPADDR;
+	(*varbind)->attr.flags |= SNMP_FLAG_VALUE;
+	/* attributes */
+	/* blen, vlen */
+	*attr = &((*varbind)->value.ip.attr);
+	break;
+    /* varbind (- value) - octet-string */
+    case IN_OCTET_STRING:
+	DEBUG("in OCTET-STRING\n");
+	assert(*state == IN_NAME); /* maybe not needed/wanted */
+	/* we should also check if parrent is varbind */
+	set_state(state, IN_OCTET_STRING); 
+	assert(*varbind);
+	(*varbind)->type = SNMP_TYPE_OCTS;
+	(*varbind)->attr.flags |= SNMP_FLAG_VALUE;
+	/* attributes */
+	/* blen, vlen */
+	*attr = &((*varbind)->value.octs.attr);
+	break;
+    /* varbind (- value) - object-identifier */
+    case IN_OBJECT_IDENTIFIER:
+	DEBUG("in OBJECT-IDENTIFIER\n");
+	assert(*state == IN_NAME); /* maybe not needed/wanted */
+	/* we should also check if parrent is varbind */
+	set_state(state, IN_OBJECT_IDENTIFIER); 
+	assert(*varbind);
+	(*varbind)->type = SNMP_TYPE_OID;
+	(*varbind)->attr.flags |= SNMP_FLAG_VALUE;
+	/* attributes */
+	/* blen, vlen */
+	*attr = &((*varbind)->value.oid.attr);
+	break;
+    case IN_OPAQUE:
+	DEBUG("in OPAQUE\n");
+	assert(*state == IN_NAME); /* maybe not needed/wanted */
+	/* we should also check if parrent is varbind */
+	set_state(state, IN_OPAQUE); 
+	assert(*varbind);
+	(*varbind)->type = SNMP_TYPE_OPAQUE;
+	(*varbind)->attr.flags |= SNMP_FLAG_VALUE;
+	/* attributes */
+	/* blen, vlen */
+	*attr = &((*varbind)->value.octs.attr);
+	break;
+    /* varbind (- value) - no-such-object */
+    case IN_NO_SUCH_OBJECT:
+	assert(*state == IN_NAME); /* maybe not needed/wanted */
+	/* we should also check if parrent is varbind */
+	set_state(state, IN_NO_SUCH_OBJECT); 
+	assert(*varbind);
+	(*varbind)->type = SNMP_TYPE_NO_SUCH_OBJ;
+	(*varbind)->attr.flags |= SNMP_FLAG_VALUE;
+	/* attributes */
+	/* blen, vlen */
+	*attr = &((*varbind)->value.null.attr);
+	break;
+    /* varbind (- value) - no-such-instance */
+    case IN_NO_SUCH_INSTANCE:
+	assert(*state == IN_NAME); /* maybe not needed/wanted */
+	/* we should also check if parrent is varbind */
+	set_state(state, IN_NO_SUCH_INSTANCE); 
+	assert(*varbind);
+	(*varbind)->type = SNMP_TYPE_NO_SUCH_INST;
+	(*varbind)->attr.flags |= SNMP_FLAG_VALUE;
+	/* attributes */
+	/* blen, vlen */
+	*attr = &((*varbind)->value.null.attr);
+	break;
+    /* varbind (- value) - end-of-mib-view */
+    case IN_END_OF_MIB_VIEW:
+	assert(*state == IN_NAME); /* maybe not needed/wanted */
+	/* we should also check if parrent is varbind */
+	set_state(state, IN_END_OF_MIB_VIEW); 
+	assert(*varbind);
+	(*varbind)->type = SNMP_TYPE_END_MIB_VIEW;
+	(*varbind)->attr.flags |= SNMP_FLAG_VALUE;
+	/* attributes */
+	/* blen, vlen */
+	*attr = &((*varbind)->value.null.attr);
+	break;
+    /* varbind (- value) - value */
+    case IN_VALUE:
+	if (*state != IN_NAME) {
+	    ERROR("varbind value before name\n");
+	}
+	/* we should also check if parrent is a varbind */
+	set_state(state, IN_VALUE); 
+	assert(*varbind);
+	(*varbind)->type = SNMP_TYPE_VALUE;
+	(*varbind)->attr.flags |= SNMP_FLAG_VALUE;
+	/* should be empty */
+	break;
+    /* SNMPv3 msg */
+    case IN_MESSAGE:
+	DEBUG("in MESSAGE\n");
+	set_state(state, IN_MESSAGE);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &packet->snmp.message.attr;
+	packet->snmp.message.attr.flags |= SNMP_FLAG_VALUE;
+	break;
+    /* msg-id */
+    case IN_MSG_ID:
+	set_state(state, IN_MSG_ID);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.message.msg_id.attr);
+	break;
+    /* max-size */
+    case IN_MAX_SIZE:
+	set_state(state, IN_MAX_SIZE);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.message.msg_max_size.attr);
+	break;
+    /* flags */
+    case IN_FLAGS:
+	set_state(state, IN_FLAGS);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.message.msg_flags.attr);
+	break;
+    /* security-model */
+    case IN_SEC_MODEL:
+	set_state(state, IN_SEC_MODEL);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.message.msg_sec_model.attr);
+	break;
+    /* usm */
+    case IN_USM:
+	set_state(state, IN_USM);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.usm.attr);
+	packet->snmp.usm.attr.flags |= SNMP_FLAG_VALUE;
+	break;
+    /* scoped-pdu */
+    case IN_SCOPED_PDU:
+	set_state(state, IN_SCOPED_PDU);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.scoped_pdu.attr);
+	packet->snmp.scoped_pdu.attr.flags |= SNMP_FLAG_VALUE;
+	break;
+    /* context-engine-id */
+    case IN_CONTEXT_ENGINE_ID:
+	set_state(state, IN_CONTEXT_ENGINE_ID);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.scoped_pdu.context_engine_id.attr);
+	break;
+    /* context-name */
+    case IN_CONTEXT_NAME:
+	set_state(state, IN_CONTEXT_NAME);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.scoped_pdu.context_name.attr);
+	break;
+    /* auth-engine-id */
+    case IN_AUTH_ENGINE_ID:
+	set_state(state, IN_AUTH_ENGINE_ID);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.usm.auth_engine_id.attr);
+	break;
+    /* auth-engine-boots */
+    case IN_AUTH_ENGINE_BOOTS:
+	set_state(state, IN_AUTH_ENGINE_BOOTS);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.usm.auth_engine_boots.attr);
+	break;
+    /* auth-engine-time */
+    case IN_AUTH_ENGINE_TIME:
+	set_state(state, IN_AUTH_ENGINE_TIME);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.usm.auth_engine_time.attr);
+	break;
+    /* user */
+    case IN_USER:
+	set_state(state, IN_USER);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.usm.user.attr);
+	break;
+    /* auth-params */
+    case IN_AUTH_PARAMS:
+	set_state(state, IN_AUTH_PARAMS);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.usm.auth_params.attr);
+	break;
+    /* priv-params */
+    case IN_PRIV_PARAMS:
+	set_state(state, IN_PRIV_PARAMS);
+	/* attributes */
+	/* blen, vlen */
+	*attr = &(packet->snmp.usm.priv_params.attr);
+	break;
+    default:
+	*state = IN_NONE;
+	break;
+    }
+    return NODE_NEXT;
+}
+
+/*
+ * Decode the text of the current element according to the parser
+ * state. The value is a NUL terminated string.
  */
+
 static void
-process_node(xmlTextReaderPtr reader, snmp_packet_t* packet,
-	     snmp_varbind_t** varbind, snmp_callback func, void *user_data) {
+process_text(xml_state_t state, snmp_packet_t *packet,
+	     snmp_varbind_t *varbind, const xmlChar *value)
+{
+    switch (state) {
+    case IN_TIME_SEC:
+	process_snmp_uint32(value, &(packet->time_sec));
+	break;
+    case IN_TIME_USEC:
+	process_snmp_uint32(value, &(packet->time_usec));
+	break;
+    case IN_SRC_IP:
+	process_snmp_ipaddr(value, &(packet->src_addr));
+	if (! (packet->src_addr.attr.flags & SNMP_FLAG_VALUE)) {
+	    process_snmp_ip6addr(value, &(packet->src_addr6));
+	}
+	break;
+    case IN_SRC_PORT:
+	process_snmp_uint32(value, &(packet->src_port));
+	break;
+    case IN_DST_IP:
+	process_snmp_ipaddr(value, &(packet->dst_addr));
+	if (! (packet->dst_addr.attr.flags & SNMP_FLAG_VALUE)) {
+	    process_snmp_ip6addr(value, &(packet->dst_addr6));
+	}
+	break;
+    case IN_DST_PORT:
+	process_snmp_uint32(value, &(packet->dst_port));
+	break;
+    case IN_VERSION:
+	process_snmp_int32(value, &packet->snmp.version);
+	if (packet->snmp.version.attr.flags & SNMP_FLAG_VALUE) {
+	    if (packet->snmp.version.value <0
+		|| packet->snmp.version.value >3) {
+		ERROR("warning: invalid SNMP version %d\n",
+		      packet->snmp.version.value);
+		//packet->snmp.version.attr.flags &= !SNMP_FLAG_VALUE;
+	    }
+	}
+	break;
+    case IN_COMMUNITY:
+	if (skip & SNMP_SKIP_COMMUNITY) break;
+	process_snmp_octs(value, &(packet->snmp.community));
+	break;
+    case IN_ENTERPRISE:
+	if (skip & SNMP_SKIP_ENTERPRISE) break;
+	process_snmp_oid(value, &(packet->snmp.scoped_pdu.pdu.enterprise));
+	break;
+    case IN_AGENT_ADDR:
+	process_snmp_ipaddr(value, &packet->snmp.scoped_pdu.pdu.agent_addr);
+		break;
+    case IN_GENERIC_TRAP:
+	process_snmp_int32(value, &(packet->snmp.scoped_pdu.pdu.generic_trap));
+	break;
+    case IN_SPECIFIC_TRAP:
+	process_snmp_int32(value, &(packet->snmp.scoped_pdu.pdu.specific_trap));
+	break;
+    case IN_TIME_STAMP:
+	process_snmp_int32(value, &(packet->snmp.scoped_pdu.pdu.time_stamp));
+	break;
+    case IN_REQUEST_ID:
+	process_snmp_int32(value, &(packet->snmp.scoped_pdu.pdu.req_id));
+	break;
+    case IN_ERROR_STATUS:
+	process_snmp_int32(value, &(packet->snmp.scoped_pdu.pdu.err_status));
+	break;
+    case IN_ERROR_INDEX:
+	process_snmp_int32(value, &(packet->snmp.scoped_pdu.pdu.err_index));
+	break;
+    /* varbind */
+    case IN_NAME:
+	assert(varbind);
+	if (skip & SNMP_SKIP_NAMES) break;
+	process_snmp_oid(value, &(varbind->name));
+	break;
+    case IN_INTEGER32:
+	assert(varbind);
+	assert(varbind->type == SNMP_TYPE_INT32);
+	process_snmp_int32(value, &(varbind->value.i32));
+	break;
+    case IN_UNSIGNED32:
+	assert(varbind);
+	assert(varbind->type == SNMP_TYPE_UINT32);
+	process_snmp_uint32(value, &(varbind->value.u32));
+	break;
+    case IN_COUNTER32:
+	assert(varbind);
+	assert(varbind->type == SNMP_TYPE_COUNTER32);
+	process_snmp_uint32(value, &(varbind->value.u32));
+	break;
+    case IN_TIMETICKS:
+	assert(varbind);
+	assert(varbind->type == SNMP_TYPE_TIMETICKS);
+	process_snmp_uint32(value, &(varbind->value.u32));
+	break;
+    case IN_COUNTER64:
+	assert(varbind);
+	assert(varbind->type == SNMP_TYPE_COUNTER64);
+	process_snmp_uint64(value, &(varbind->value.u64));
+	break;
+    case IN_IPADDRESS:
+	assert(varbind);
+	assert(varbind->type == SNMP_TYPE_IPADDR);
+	process_snmp_ipaddr(value, &(varbind->value.ip));
+	break;
+    case IN_OCTET_STRING:
+	assert(varbind);
+	assert(varbind->type == SNMP_TYPE_OCTS);
+	if (snmp_skip_value(skip, varbind->type)) break;
+	process_snmp_octs(value, &(varbind->value.octs));
+	break;
+    case IN_OBJECT_IDENTIFIER:
+	assert(varbind);
+	assert(varbind->type == SNMP_TYPE_OID);
+	if (snmp_skip_value(skip, varbind->type)) break;
+	process_snmp_oid(value, &(varbind->value.oid));
+	break;
+    case IN_OPAQUE:
+	assert(varbind);
+	assert(varbind->type == SNMP_TYPE_OPAQUE);
+	if (snmp_skip_value(skip, varbind->type)) break;
+	process_snmp_octs(value, &(varbind->value.octs));
+	break;
+    /* snmpv3 */
+    case IN_MSG_ID:
+	process_snmp_uint32(value, &(packet->snmp.message.msg_id));
+	break;
+    case IN_MAX_SIZE:
+	process_snmp_uint32(value, &(packet->snmp.message.msg_max_size));
+	break;
+    case IN_FLAGS:
+	process_snmp_octs(value, &(packet->snmp.message.msg_flags));
+	break;
+    case IN_SEC_MODEL:
+	process_snmp_uint32(value, &(packet->snmp.message.msg_sec_model));
+	break;
+    case IN_AUTH_ENGINE_ID:
+	process_snmp_octs(value, &(packet->snmp.usm.
+				    auth_engine_id));
+	break;
+    case IN_AUTH_ENGINE_BOOTS:
+	process_snmp_uint32(value, &(packet->snmp.usm.
+				      auth_engine_boots));
+	break;
+    case IN_AUTH_ENGINE_TIME:
+	process_snmp_uint32(value, &(packet->snmp.usm.
+				auth_engine_time));
+	break;
+    case IN_USER:
+	process_snmp_octs(value, &(packet->snmp.usm.user));
+	break;
+    case IN_AUTH_PARAMS:
+	process_snmp_octs(value, &(packet->snmp.usm.
+				    auth_params));
+	break;
+    case IN_PRIV_PARAMS:
+	process_snmp_octs(value, &(packet->snmp.usm.
+				    priv_params));
+	break;
+    case IN_CONTEXT_ENGINE_ID:
+	process_snmp_octs(value, &(packet->snmp.scoped_pdu.
+				context_engine_id));
+	break;
+    case IN_CONTEXT_NAME:
+	process_snmp_octs(value, &(packet->snmp.scoped_pdu.
+				context_name));
+	break;
+    }
+}
+
+/*
+ * process node currently in reader by filling in snmp_packet_t structure
+ * initializes the snmp_packet_t when new "packet" xml node is reached
+ * returns NODE_SKIP if the subtree of the current node should be skipped
+ * and NODE_PACKET when the end of "packet" xml node is reached
+ */
+
+static int
+process_node(xmlTextReaderPtr reader, xml_state_t *state,
+	     snmp_packet_t* packet, snmp_varbind_t** varbind) {
     const xmlChar *name, *value;
+    snmp_attr_t *attr;
+    int rc;
 
     assert(packet);
     /* 1, 3, 8, 14, 15 */
     switch (xmlTextReaderNodeType(reader)) {
     case XML_READER_TYPE_ELEMENT:
-	/*
-	 * check what node we have:
-	 * first has to come snmptrace
-	 * node packet - allocate new snmp_msg_t
-	 * other nodes - allocate respective storage part within
-	 *		 current snmp_msg_t and fill in data
-	 */
 	name = xmlTextReaderConstName(reader);
-	if (name == NULL)
-	    name = BAD_CAST "--";
-	/* packet */
-	if (name && xmlStrcmp(name, BAD_CAST("packet")) == 0) {
-	    DEBUG("in PACKET\n");
-	    set_state(IN_PACKET);
-	    memset(packet, 0, sizeof(snmp_packet_t));
-	    *varbind = NULL;
-	    /* no attributes */
-	    packet->attr.flags |= SNMP_FLAG_VALUE;
-	/* time-sec */
-	} else if (name && xmlStrcmp(name, BAD_CAST("time-sec")) == 0) {
-	    DEBUG("in TIME-SEC\n");
-	    set_state(IN_TIME_SEC);
-	    /* no attributes */
-	/* time-usec */
-	} else if (name && xmlStrcmp(name, BAD_CAST("time-usec")) == 0) {
-	    DEBUG("in TIME-USEC\n");
-	    set_state(IN_TIME_USEC);
-	    /* no attributes */
-	/* src-ip */
-	} else if (name && xmlStrcmp(name, BAD_CAST("src-ip")) == 0) {
-	    DEBUG("in SRC-IP\n");
-	    set_state(IN_SRC_IP);
-	    /* no attributes */
-	/* src-port */
-	} else if (name && xmlStrcmp(name, BAD_CAST("src-port")) == 0) {
-	    DEBUG("in SRC-PORT\n");
-	    set_state(IN_SRC_PORT);
-	    /* no attributes */
-	/* dst-ip */
-	} else if (name && xmlStrcmp(name, BAD_CAST("dst-ip")) == 0) {
-	    DEBUG("in DST-IP\n");
-	    set_state(IN_DST_IP);
-	    /* no attributes */
-	/* dst-port */
-	} else if (name && xmlStrcmp(name, BAD_CAST("dst-port")) == 0) {
-	    DEBUG("in DST-PORT\n");
-	    set_state(IN_DST_PORT);
-	    /* no attributes */
-	/* snmp */
-	} else if (name && xmlStrcmp(name, BAD_CAST("snmp")) == 0) {
-	    DEBUG("in SNMP\n");
-	    //assert(state == IN_PACKET);
-	    set_state(IN_SNMP);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &(packet->snmp.attr));
-	    packet->snmp.attr.flags |= SNMP_FLAG_VALUE;
-	/* version */
-	} else if (name && xmlStrcmp(name, BAD_CAST("version")) == 0) {
-	    assert(state == IN_SNMP);
-	    set_state(IN_VERSION);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &(packet->snmp.version.attr));
-	/* community */
-	} else if (name && xmlStrcmp(name, BAD_CAST("community")) == 0) {
-	    set_state(IN_COMMUNITY);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &(packet->snmp.community.attr));
-	/* trap */
-	} else if (name && xmlStrcmp(name, BAD_CAST("trap")) == 0) {
-	    set_state(IN_TRAP);
-	    packet->snmp.scoped_pdu.pdu.type = SNMP_PDU_TRAP1;
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &(packet->snmp.scoped_pdu.pdu.attr));
-	    packet->snmp.scoped_pdu.pdu.attr.flags |= SNMP_FLAG_VALUE;
-	/* enterprise */
-	} else if (name && xmlStrcmp(name, BAD_CAST("enterprise")) == 0) {
-	    set_state(IN_ENTERPRISE);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &(packet->snmp.scoped_pdu.pdu.enterprise.attr));
-	/* agent-addr */
-	} else if (name && xmlStrcmp(name, BAD_CAST("agent-addr")) == 0) {
-	    set_state(IN_AGENT_ADDR);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &(packet->snmp.scoped_pdu.pdu.agent_addr.attr));
-	/* generic-trap */
-	} else if (name && xmlStrcmp(name, BAD_CAST("generic-trap")) == 0) {
-	    set_state(IN_GENERIC_TRAP);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader,
-			    &(packet->snmp.scoped_pdu.pdu.generic_trap.attr));
-	/* specific-trap */
-	} else if (name && xmlStrcmp(name, BAD_CAST("specific-trap")) == 0) {
-	    set_state(IN_SPECIFIC_TRAP);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader,
-			    &(packet->snmp.scoped_pdu.pdu.specific_trap.attr));
-	/* time-stamp */
-	} else if (name && xmlStrcmp(name, BAD_CAST("time-stamp")) == 0) {
-	    set_state(IN_TIME_STAMP);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader,
-			    &(packet->snmp.scoped_pdu.pdu.time_stamp.attr));
-	/*
-	 * get-request | get-next-request | get-bulk-request |
-         * set-request | inform-request | snmpV2-trap | response | report
-	 */
-	} else if (name &&
-		   (xmlStrcmp(name, BAD_CAST("get-request")) == 0
-		    || xmlStrcmp(name, BAD_CAST("get-next-request")) == 0
-		    || xmlStrcmp(name, BAD_CAST("get-bulk-request")) == 0
-		    || xmlStrcmp(name, BAD_CAST("set-request")) == 0
-		    || xmlStrcmp(name, BAD_CAST("inform")) == 0
-		    || xmlStrcmp(name, BAD_CAST("inform-request")) == 0
-		    || xmlStrcmp(name, BAD_CAST("trap2")) == 0
-		    || xmlStrcmp(name, BAD_CAST("snmpV2-trap")) == 0
-		    || xmlStrcmp(name, BAD_CAST("response")) == 0
-		    || xmlStrcmp(name, BAD_CAST("report")) == 0
-		    )) {
-	    /* state */
-	    if (xmlStrcmp(name, BAD_CAST("get-request")) == 0) {
-		set_state(IN_GET_REQUEST);
-		packet->snmp.scoped_pdu.pdu.type = SNMP_PDU_GET;
-	    } else if (xmlStrcmp(name, BAD_CAST("get-next-request")) == 0) {
-		set_state(IN_GET_NEXT_REQUEST);
-		packet->snmp.scoped_pdu.pdu.type = SNMP_PDU_GETNEXT;
-	    } else if (xmlStrcmp(name, BAD_CAST("get-bulk-request")) == 0) {
-		set_state(IN_GET_BULK_REQUEST);
-		packet->snmp.scoped_pdu.pdu.type = SNMP_PDU_GETBULK;
-	    } else if (xmlStrcmp(name, BAD_CAST("set-request")) == 0) {
-		set_state(IN_SET_REQUEST);
-		packet->snmp.scoped_pdu.pdu.type = SNMP_PDU_SET;
-	    } else if (xmlStrcmp(name, BAD_CAST("inform")) == 0
-		|| xmlStrcmp(name, BAD_CAST("inform-request")) == 0) {
-		set_state(IN_INFORM);
-		packet->snmp.scoped_pdu.pdu.type = SNMP_PDU_INFORM;
-	    } else if (xmlStrcmp(name, BAD_CAST("trap2")) == 0
-		|| xmlStrcmp(name, BAD_CAST("snmpV2-trap")) == 0) {
-		set_state(IN_TRAP2);
-		packet->snmp.scoped_pdu.pdu.type = SNMP_PDU_TRAP2;
-	    } else if (xmlStrcmp(name, BAD_CAST("response")) == 0) {
-		set_state(IN_RESPONSE);
-		packet->snmp.scoped_pdu.pdu.type = SNMP_PDU_RESPONSE;
-	    } else if (xmlStrcmp(name, BAD_CAST("report")) == 0) {
-		set_state(IN_REPORT);
-		packet->snmp.scoped_pdu.pdu.type = SNMP_PDU_REPORT;
-	    }
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader,
-			    &(packet->snmp.scoped_pdu.pdu.attr));
-	    packet->snmp.scoped_pdu.pdu.attr.flags |= SNMP_FLAG_VALUE;
-	/* request-id */
-	} else if (name && xmlStrcmp(name, BAD_CAST("request-id")) == 0) {
-	    set_state(IN_REQUEST_ID);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader,
-			    &(packet->snmp.scoped_pdu.pdu.req_id.attr));
-	/* error-status */
-	} else if (name && xmlStrcmp(name, BAD_CAST("error-status")) == 0) {
-	    set_state(IN_ERROR_STATUS);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader,
-			    &(packet->snmp.scoped_pdu.pdu.err_status.attr));
-	/* error-index */
-	} else if (name && xmlStrcmp(name, BAD_CAST("error-index")) == 0) {
-	    set_state(IN_ERROR_INDEX);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader,
-			    &(packet->snmp.scoped_pdu.pdu.err_index.attr));
-	/* variable-bindings */
-	} else if (name
-		   && xmlStrcmp(name, BAD_CAST("variable-bindings")) == 0) {
-	    set_state(IN_VARIABLE_BINDINGS);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader,
-			    &(packet->snmp.scoped_pdu.pdu.varbindings.attr));
-	    packet->snmp.scoped_pdu.pdu.varbindings.attr.flags
-		|= SNMP_FLAG_VALUE;
-	/* varbind */
-	} else if (name && xmlStrcmp(name, BAD_CAST("varbind")) == 0) {
-	    set_state(IN_VARBIND);
-	    if (*varbind != NULL) {
-		(*varbind)->next =
-		    (snmp_varbind_t*) malloc(sizeof(snmp_varbind_t));
-		*varbind = (*varbind)->next;
-	    } else {
-		*varbind = (snmp_varbind_t*) malloc(sizeof(snmp_varbind_t));
-		packet->snmp.scoped_pdu.pdu.varbindings.varbind = *varbind;
-	    }
-	    assert(*varbind);
-	    memset(*varbind,0,sizeof(snmp_varbind_t));
-	    //DEBUG("malloc... *varbind: %x\n", *varbind);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &(*varbind)->attr);
-	/* varbind - name */
-	} else if (name && xmlStrcmp(name, BAD_CAST("name")) == 0) {
-	    assert(state == IN_VARBIND);
-	    set_state(IN_NAME);
-	    assert(*varbind);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &((*varbind)->name.attr));
-	/* varbind (- value) - null */
-	} else if (name && xmlStrcmp(name, BAD_CAST("null")) == 0) {
-	    assert(state == IN_NAME); /* maybe not needed/wanted */
-	    /* we should also check if parrent is varbind */
-	    set_state(IN_NULL); 
-	    assert(*varbind);
-	    (*varbind)->type = SNMP_TYPE_NULL;
-	    (*varbind)->attr.flags |= SNMP_FLAG_VALUE;
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &((*varbind)->value.null.attr));
-	/* varbind (- value) - integer32 */
-	} else if (name && xmlStrcmp(name, BAD_CAST("integer32")) == 0) {
-	    DEBUG("in INTEGER32\n");
-	    assert(state == IN_NAME); /* maybe not needed/wanted */
-	    /* we should also check if parrent is varbind */
-	    set_state(IN_INTEGER32); 
-	    assert(*varbind);
-	    (*varbind)->type = SNMP_TYPE_INT32;
-	    (*varbind)->attr.flags |= SNMP_FLAG_VALUE;
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &((*varbind)->value.i32.attr));
-	/* varbind (- value) - unsigned32 */
-	} else if (name && xmlStrcmp(name, BAD_CAST("unsigned32")) == 0) {
-	    DEBUG("in UNSIGNED32\n");
-	    assert(state == IN_NAME); /* maybe not needed/wanted */
-	    /* we should also check if parrent is varbind */
-	    set_state(IN_UNSIGNED32); 
-	    assert(*varbind);
-	    (*varbind)->type = SNMP_TYPE_UINT32;
-	    (*varbind)->attr.flags |= SNMP_FLAG_VALUE;
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &((*varbind)->value.u32.attr));
-	/* varbind (- value) - counter32 */
-	} else if (name && xmlStrcmp(name, BAD_CAST("counter32")) == 0) {
-	    DEBUG("in COUNTER32\n");
-	    assert(state == IN_NAME); /* maybe not needed/wanted */
-	    /* we should also check if parrent is varbind */
-	    set_state(IN_COUNTER32); 
-	    assert(*varbind);
-	    (*varbind)->type = SNMP_TYPE_COUNTER32;
-	    (*varbind)->attr.flags |= SNMP_FLAG_VALUE;
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &((*varbind)->value.u32.attr));
-	/* varbind (- value) - timeticks */
-	} else if (name && xmlStrcmp(name, BAD_CAST("timeticks")) == 0) {
-	    DEBUG("in TIMETICKS\n");
-	    assert(state == IN_NAME); /* maybe not needed/wanted */
-	    /* we should also check if parrent is varbind */
-	    set_state(IN_TIMETICKS); 
-	    assert(*varbind);
-	    (*varbind)->type = SNMP_TYPE_TIMETICKS;
-	    (*varbind)->attr.flags |= SNMP_FLAG_VALUE;
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &((*varbind)->value.u32.attr));
-	/* varbind (- value) - counter64 */
-	} else if (name && (xmlStrcmp(name, BAD_CAST("counter64")) == 0
-		       || xmlStrcmp(name, BAD_CAST("unsigned64")) == 0)) {
-	    DEBUG("in COUNTER64\n");
-	    assert(state == IN_NAME); /* maybe not needed/wanted */
-	    /* we should also check if parrent is varbind */
-	    set_state(IN_COUNTER64); 
-	    assert(*varbind);
-	    (*varbind)->type = SNMP_TYPE_COUNTER64;
-	    (*varbind)->attr.flags |= SNMP_FLAG_VALUE;
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &((*varbind)->value.u64.attr));
-	/* varbind (- value) - ipaddress */
-	} else if (name && xmlStrcmp(name, BAD_CAST("ipaddress")) == 0) {
-	    DEBUG("in IPADDRESS\n");
-	    assert(state == IN_NAME); /* maybe not needed/wanted */
-	    /* we should also check if parrent is varbind */
-	    set_state(IN_IPADDRESS); 
-	    assert(*varbind);
-	    (*varbind)->type = SNMP_TYPE_IPADDR;
-	    (*varbind)->attr.flags |= SNMP_FLAG_VALUE;
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &((*varbind)->value.ip.attr));
-	/* varbind (- value) - octet-string */
-	} else if (name && xmlStrcmp(name, BAD_CAST("octet-string")) == 0) {
-	    DEBUG("in OCTET-STRING\n");
-	    assert(state == IN_NAME); /* maybe not needed/wanted */
-	    /* we should also check if parrent is varbind */
-	    set_state(IN_OCTET_STRING); 
-	    assert(*varbind);
-	    (*varbind)->type = SNMP_TYPE_OCTS;
-	    (*varbind)->attr.flags |= SNMP_FLAG_VALUE;
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &((*varbind)->value.octs.attr));
-	/* varbind (- value) - object-identifier */
-	} else if (name &&
-		   xmlStrcmp(name, BAD_CAST("object-identifier")) == 0) {
-	    DEBUG("in OBJECT-IDENTIFIER\n");
-	    assert(state == IN_NAME); /* maybe not needed/wanted */
-	    /* we should also check if parrent is varbind */
-	    set_state(IN_OBJECT_IDENTIFIER); 
-	    assert(*varbind);
-	    (*varbind)->type = SNMP_TYPE_OID;
-	    (*varbind)->attr.flags |= SNMP_FLAG_VALUE;
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &((*varbind)->value.oid.attr));
-	} else if (name && xmlStrcmp(name, BAD_CAST("opaque")) == 0) {
-	    DEBUG("in OPAQUE\n");
-	    assert(state == IN_NAME); /* maybe not needed/wanted */
-	    /* we should also check if parrent is varbind */
-	    set_state(IN_OPAQUE); 
-	    assert(*varbind);
-	    (*varbind)->type = SNMP_TYPE_OPAQUE;
-	    (*varbind)->attr.flags |= SNMP_FLAG_VALUE;
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &((*varbind)->value.octs.attr));
-	/* varbind (- value) - no-such-object */
-	} else if (name && xmlStrcmp(name, BAD_CAST("no-such-object")) == 0) {
-	    assert(state == IN_NAME); /* maybe not needed/wanted */
-	    /* we should also check if parrent is varbind */
-	    set_state(IN_NO_SUCH_OBJECT); 
-	    assert(*varbind);
-	    (*varbind)->type = SNMP_TYPE_NO_SUCH_OBJ;
-	    (*varbind)->attr.flags |= SNMP_FLAG_VALUE;
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &((*varbind)->value.null.attr));
-	/* varbind (- value) - no-such-instance */
-	} else if (name && xmlStrcmp(name, BAD_CAST("no-such-instance")) == 0){
-	    assert(state == IN_NAME); /* maybe not needed/wanted */
-	    /* we should also check if parrent is varbind */
-	    set_state(IN_NO_SUCH_INSTANCE); 
-	    assert(*varbind);
-	    (*varbind)->type = SNMP_TYPE_NO_SUCH_INST;
-	    (*varbind)->attr.flags |= SNMP_FLAG_VALUE;
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &((*varbind)->value.null.attr));
-	/* varbind (- value) - end-of-mib-view */
-	} else if (name && xmlStrcmp(name, BAD_CAST("end-of-mib-view")) == 0) {
-	    assert(state == IN_NAME); /* maybe not needed/wanted */
-	    /* we should also check if parrent is varbind */
-	    set_state(IN_END_OF_MIB_VIEW); 
-	    assert(*varbind);
-	    (*varbind)->type = SNMP_TYPE_END_MIB_VIEW;
-	    (*varbind)->attr.flags |= SNMP_FLAG_VALUE;
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &((*varbind)->value.null.attr));
-	/* varbind (- value) - value */
-	} else if (name && xmlStrcmp(name, BAD_CAST("value")) == 0) {
-	    if (state != IN_NAME) {
-		ERROR("varbind value before name\n");
-	    }
-	    /* we should also check if parrent is a varbind */
-	    set_state(IN_VALUE); 
-	    assert(*varbind);
-	    (*varbind)->type = SNMP_TYPE_VALUE;
-	    (*varbind)->attr.flags |= SNMP_FLAG_VALUE;
-	    /* should be empty */
-	/* SNMPv3 msg */
-	} else if (name && xmlStrcmp(name, BAD_CAST("message")) == 0) {
-	    DEBUG("in MESSAGE\n");
-	    set_state(IN_MESSAGE);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &packet->snmp.message.attr);
-	    packet->snmp.message.attr.flags |= SNMP_FLAG_VALUE;
-	/* msg-id */
-	} else if (name && xmlStrcmp(name, BAD_CAST("msg-id")) == 0) {
-	    set_state(IN_MSG_ID);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &(packet->snmp.message.msg_id.attr));
-	/* max-size */
-	} else if (name && xmlStrcmp(name, BAD_CAST("max-size")) == 0) {
-	    set_state(IN_MAX_SIZE);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader,
-			      &(packet->snmp.message.msg_max_size.attr));
-	/* flags */
-	} else if (name && xmlStrcmp(name, BAD_CAST("flags")) == 0) {
-	    set_state(IN_FLAGS);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &(packet->snmp.message.msg_flags.attr));
-	/* security-model */
-	} else if (name && xmlStrcmp(name, BAD_CAST("security-model")) == 0) {
-	    set_state(IN_SEC_MODEL);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader,
-			      &(packet->snmp.message.msg_sec_model.attr));
-	/* usm */
-	} else if (name && xmlStrcmp(name, BAD_CAST("usm")) == 0) {
-	    set_state(IN_USM);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &(packet->snmp.usm.attr));
-	    packet->snmp.usm.attr.flags |= SNMP_FLAG_VALUE;
-	/* scoped-pdu */
-	} else if (name && xmlStrcmp(name, BAD_CAST("scoped-pdu")) == 0) {
-	    set_state(IN_SCOPED_PDU);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &(packet->snmp.scoped_pdu.attr));
-	    packet->snmp.scoped_pdu.attr.flags |= SNMP_FLAG_VALUE;
-	/* context-engine-id */
-	} else if (name
-		   && xmlStrcmp(name, BAD_CAST("context-engine-id")) == 0) {
-	    set_state(IN_CONTEXT_ENGINE_ID);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &(packet->snmp.scoped_pdu.
-					context_engine_id.attr));
-	/* context-name */
-	} else if (name && xmlStrcmp(name, BAD_CAST("context-name")) == 0) {
-	    set_state(IN_CONTEXT_NAME);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &(packet->snmp.scoped_pdu.
-					context_name.attr));
-	/* auth-engine-id */
-	} else if (name && xmlStrcmp(name, BAD_CAST("auth-engine-id")) == 0) {
-	    set_state(IN_AUTH_ENGINE_ID);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &(packet->snmp.usm.
-					auth_engine_id.attr));
-	/* auth-engine-boots */
-	} else if (name 
-		   && xmlStrcmp(name, BAD_CAST("auth-engine-boots")) == 0) {
-	    set_state(IN_AUTH_ENGINE_BOOTS);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &(packet->snmp.usm.
-					auth_engine_boots.attr));
-	/* auth-engine-time */
-	} else if (name
-		   && xmlStrcmp(name, BAD_CAST("auth-engine-time")) == 0) {
-	    set_state(IN_AUTH_ENGINE_TIME);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &(packet->snmp.usm.
-					auth_engine_time.attr));
-	/* user */
-	} else if (name && xmlStrcmp(name, BAD_CAST("user")) == 0) {
-	    set_state(IN_USER);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &(packet->snmp.usm.
-					user.attr));
-	/* auth-params */
-	} else if (name && xmlStrcmp(name, BAD_CAST("auth-params")) == 0) {
-	    set_state(IN_AUTH_PARAMS);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &(packet->snmp.usm.
-					auth_params.attr));
-	/* priv-params */
-	} else if (name && xmlStrcmp(name, BAD_CAST("priv-params")) == 0) {
-	    set_state(IN_PRIV_PARAMS);
-	    /* attributes */
-	    /* blen, vlen */
-	    process_snmp_attr(reader, &(packet->snmp.usm.
-					priv_params.attr));
-	} else {
-	    state = IN_NONE;
+	attr = NULL;
+	rc = process_element(element_lookup(name, xmlStrlen(name)),
+			     state, packet, varbind, &attr);
+	if (attr) {
+	    process_snmp_attr(reader, attr);
+	}
+	if (rc != NODE_NEXT) {
+	    return rc;
 	}
 	break;
     case XML_READER_TYPE_TEXT:
-	value = xmlTextReaderConstValue(reader);
-	//xmlStrlen(value)
-	//printf(" %s\n", value);
-	switch (state) {
-	case IN_TIME_SEC:
-	    process_snmp_uint32(reader, &(packet->time_sec));
-	    break;
-	case IN_TIME_USEC:
-	    process_snmp_uint32(reader, &(packet->time_usec));
-	    break;
-	case IN_SRC_IP:
-	    process_snmp_ipaddr(reader, &(packet->src_addr));
-	    break;
-	case IN_SRC_PORT:
-	    process_snmp_uint32(reader, &(packet->src_port));
-	    break;
-	case IN_DST_IP:
-	    process_snmp_ipaddr(reader, &(packet->dst_addr));
-	    break;
-	case IN_DST_PORT:
-	    process_snmp_uint32(reader,  &(packet->dst_port));
-	    break;
-	case IN_VERSION:
-	    process_snmp_int32(reader,  &packet->snmp.version);
-	    if (packet->snmp.version.attr.flags & SNMP_FLAG_VALUE) {
-		if (packet->snmp.version.value <0
-		    || packet->snmp.version.value >3) {
-		    ERROR("warning: invalid SNMP version %d\n",
-			  packet->snmp.version.value);
-		    //packet->snmp.version.attr.flags &= !SNMP_FLAG_VALUE;
-		}
-	    }
-	    break;
-	case IN_COMMUNITY:
-	    process_snmp_octs(reader, &(packet->snmp.community));
-	    break;
-	case IN_ENTERPRISE:
-	    process_snmp_oid(reader, &(packet->snmp.scoped_pdu.pdu.enterprise));
-	    break;
-	case IN_AGENT_ADDR:
-	    process_snmp_ipaddr(reader,
-				&packet->snmp.scoped_pdu.pdu.agent_addr);
-	    	    break;
-	case IN_GENERIC_TRAP:
-	    process_snmp_int32(reader, &(packet->snmp.scoped_pdu.pdu.generic_trap));
-	    break;
-	case IN_SPECIFIC_TRAP:
-	    process_snmp_int32(reader, &(packet->snmp.scoped_pdu.pdu.specific_trap));
-	    break;
-	case IN_TIME_STAMP:
-	    process_snmp_int32(reader, &(packet->snmp.scoped_pdu.pdu.time_stamp));
-	    break;
-	case IN_REQUEST_ID:
-	    process_snmp_int32(reader, &(packet->snmp.scoped_pdu.pdu.req_id));
-	    break;
-	case IN_ERROR_STATUS:
-	    process_snmp_int32(reader, &(packet->snmp.scoped_pdu.pdu.err_status));
-	    break;
-	case IN_ERROR_INDEX:
-	    process_snmp_int32(reader, &(packet->snmp.scoped_pdu.pdu.err_index));
-	    break;
-	/* varbind */
-	case IN_NAME:
-	    assert(*varbind);
-	    process_snmp_oid(reader, &((*varbind)->name));
-	    break;
-	case IN_INTEGER32:
-	    assert(*varbind);
-	    assert((*varbind)->type == SNMP_TYPE_INT32);
-	    process_snmp_int32(reader, &((*varbind)->value.i32));
-	    break;
-	case IN_UNSIGNED32:
-	    assert(*varbind);
-	    assert((*varbind)->type == SNMP_TYPE_UINT32);
-	    process_snmp_uint32(reader, &((*varbind)->value.u32));
-	    break;
-	case IN_COUNTER32:
-	    assert(*varbind);
-	    assert((*varbind)->type == SNMP_TYPE_COUNTER32);
-	    process_snmp_uint32(reader, &((*varbind)->value.u32));
-	    break;
-	case IN_TIMETICKS:
-	    assert(*varbind);
-	    assert((*varbind)->type == SNMP_TYPE_TIMETICKS);
-	    process_snmp_uint32(reader, &((*varbind)->value.u32));
-	    break;
-	case IN_COUNTER64:
-	    assert(*varbind);
-	    assert((*varbind)->type == SNMP_TYPE_COUNTER64);
-	    process_snmp_uint64(reader, &((*varbind)->value.u64));
-	    break;
-	case IN_IPADDRESS:
-	    assert(*varbind);
-	    assert((*varbind)->type == SNMP_TYPE_IPADDR);
-	    process_snmp_ipaddr(reader, &((*varbind)->value.ip));
-	    break;
-	case IN_OCTET_STRING:
-	    assert(*varbind);
-	    assert((*varbind)->type == SNMP_TYPE_OCTS);
-	    process_snmp_octs(reader, &((*varbind)->value.octs));
-	    break;
-	case IN_OBJECT_IDENTIFIER:
-	    assert(*varbind);
-	    assert((*varbind)->type == SNMP_TYPE_OID);
-	    process_snmp_oid(reader, &((*varbind)->value.oid));
-	    break;
-	case IN_OPAQUE:
-	    assert(*varbind);
-	    assert((*varbind)->type == SNMP_TYPE_OPAQUE);
-	    process_snmp_octs(reader, &((*varbind)->value.octs));
-	    break;
-	/* snmpv3 */
-	case IN_MSG_ID:
-	    process_snmp_uint32(reader, &(packet->snmp.message.msg_id));
-	    break;
-	case IN_MAX_SIZE:
-	    process_snmp_uint32(reader, &(packet->snmp.message.msg_max_size));
-	    break;
-	case IN_FLAGS:
-	    process_snmp_octs(reader, &(packet->snmp.message.msg_flags));
-	    break;
-	case IN_SEC_MODEL:
-	    process_snmp_uint32(reader, &(packet->snmp.message.msg_sec_model));
-	    break;
-	case IN_AUTH_ENGINE_ID:
-	    process_snmp_octs(reader, &(packet->snmp.usm.
-					auth_engine_id));
-	    break;
-	case IN_AUTH_ENGINE_BOOTS:
-	    process_snmp_uint32(reader, &(packet->snmp.usm.
-					  auth_engine_boots));
-	    break;
-	case IN_AUTH_ENGINE_TIME:
-	    process_snmp_uint32(reader, &(packet->snmp.usm.
-				    auth_engine_time));
-	    break;
-	case IN_USER:
-	    process_snmp_octs(reader, &(packet->snmp.usm.user));
-	    break;
-	case IN_AUTH_PARAMS:
-	    process_snmp_octs(reader, &(packet->snmp.usm.
-					auth_params));
-	    break;
-	case IN_PRIV_PARAMS:
-	    process_snmp_octs(reader, &(packet->snmp.usm.
-					priv_params));
-	    break;
-	case IN_CONTEXT_ENGINE_ID:
-	    process_snmp_octs(reader, &(packet->snmp.scoped_pdu.
-				    context_engine_id));
-	    break;
-	case IN_CONTEXT_NAME:
-	    process_snmp_octs(reader, &(packet->snmp.scoped_pdu.
-				    context_name));
-	    break;
-	}
+	process_text(*state, packet, *varbind,
+		     xmlTextReaderConstValue(reader));
 	break;
     case XML_READER_TYPE_COMMENT:
-	return;
+	return NODE_NEXT;
     case XML_READER_TYPE_SIGNIFICANT_WHITESPACE:
-	return;
+	return NODE_NEXT;
     case XML_READER_TYPE_END_ELEMENT:
 	name = xmlTextReaderConstName(reader);
 	if (name == NULL)
 	    name = BAD_CAST "--";
 	/* packet */
 	if (name && xmlStrcmp(name, BAD_CAST("packet")) == 0) {
-	    // call calback function and give it filled-in snmp_packet_t object
 	    DEBUG("out PACKET\n");
-	    func(packet, user_data);
-	    snmp_packet_free(packet);
+	    return NODE_PACKET;
 	}
 	break;
     default:
@@ -1091,20 +1187,71 @@ process_node(xmlTextReaderPtr reader, snmp_packet_t* packet,
             printf(" %s\n", value);
     }
     #endif
+    return NODE_NEXT;
 }
 
 
+/*
+ * pass a batch of complete packets to the batch callback and release
+ * them afterwards
+ */
 static void
-process_reader(xmlTextReaderPtr reader, snmp_callback func, void *user_data)
+process_batch(snmp_packet_t* packets, size_t n,
+	      snmp_batch_callback func, void *user_data) {
+    snmp_packet_t *pkts[SNMP_BATCH_SIZE];
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+	pkts[i] = &packets[i];
+    }
+    func(pkts, n, user_data);
+    for (i = 0; i < n; i++) {
+	snmp_packet_free(&packets[i]);
+    }
+}
+
+/*
+ * read all nodes and pass complete packets either one at a time to
+ * func or in batches to batch_func
+ */
+static void
+process_reader(xmlTextReaderPtr reader, snmp_callback func,
+	       snmp_batch_callback batch_func, void *user_data)
 {
-    snmp_packet_t packet;
+    xml_state_t state = IN_NONE;
+    snmp_packet_t _packet, *packets = &_packet;
     snmp_varbind_t *varbind = NULL;
-    int ret;
+    size_t n = 0;
+    int ret, rc;
+
+    if (batch_func) {
+	packets = malloc(SNMP_BATCH_SIZE * sizeof(snmp_packet_t));
+	assert(packets);
+    }
 	
     ret = xmlTextReaderRead(reader);
     while (ret == 1) {
-	process_node(reader, &packet, &varbind, func, user_data);
-	ret = xmlTextReaderRead(reader);
+	rc = process_node(reader, &state, &packets[n], &varbind);
+	if (rc == NODE_PACKET) {
+	    if (! batch_func) {
+		func(packets, user_data);
+		snmp_packet_free(packets);
+	    } else if (++n == SNMP_BATCH_SIZE) {
+		process_batch(packets, n, batch_func, user_data);
+		n = 0;
+	    }
+	}
+	if (rc == NODE_SKIP) {
+	    ret = xmlTextReaderNext(reader);
+	} else {
+	    ret = xmlTextReaderRead(reader);
+	}
+    }
+    if (n) {
+	process_batch(packets, n, batch_func, user_data);
+    }
+    if (batch_func) {
+	free(packets);
     }
     xmlFreeTextReader(reader);
     if (ret != 0) {
@@ -1114,30 +1261,417 @@ process_reader(xmlTextReaderPtr reader, snmp_callback func, void *user_data)
 
 }
 
-void
-snmp_xml_read_file(const char *file, snmp_callback func, void *user_data)
+/*
+ * The snmptrace scanner is a small pull parser for the XML documents
+ * written by snmpdump. It reads the input in large chunks and decodes
+ * element text and attributes in place, which avoids the node objects
+ * and string copies of the libxml2 reader. It understands elements,
+ * attributes, comments and processing instructions, but no DOCTYPE,
+ * CDATA sections or entity references, and it does not check whether
+ * the document is well-formed. The libxml2 reader remains the default
+ * and should be used for documents from other sources.
+ */
+
+#define SCAN_CHUNK	(1024 * 1024)
+
+typedef struct _scan_input {
+    FILE	*stream;
+    char	*buf;
+    size_t	size;		/* size of the buffer */
+    size_t	len;		/* number of bytes in the buffer */
+    size_t	pos;		/* start of the next token */
+    size_t	offset;		/* input offset of the buffer */
+    int		eof;
+} scan_input_t;
+
+static int scanner = 0;		/* use the scanner instead of libxml2 */
+static unsigned jobs = 1;		/* threads scanning a file */
+
+/*
+ * Move the unparsed rest of the buffer to the front and append more
+ * input. The buffer grows if a single token does not fit. Returns 0
+ * at the end of the input.
+ */
+
+static int
+scan_fill(scan_input_t *in)
 {
-    xmlTextReaderPtr reader;
+    size_t n;
 
-    assert(file);
-    
-    reader = xmlNewTextReaderFilename(file);
-    if (! reader) {
-	fprintf(stderr, "%s: failed to open XML file '%s'\n",
-		progname, file);
-	return;
+    if (in->eof) {
+	return 0;
+    }
+    if (in->pos) {
+	memmove(in->buf, in->buf + in->pos, in->len - in->pos);
+	in->offset += in->pos;
+	in->len -= in->pos;
+	in->pos = 0;
+    }
+    if (in->len > in->size / 2) {
+	in->size *= 2;
+	in->buf = realloc(in->buf, in->size);
+	assert(in->buf);
+    }
+    n = fread(in->buf + in->len, 1, in->size - in->len, in->stream);
+    if (n == 0) {
+	in->eof = 1;
+	return 0;
+    }
+    in->len += n;
+    return 1;
+}
+
+static inline int
+scan_space(int c)
+{
+    return (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+}
+
+/*
+ * Return the '>' which closes the tag starting at p, or NULL if the
+ * tag is not complete. Quoted attribute values may contain a '>'.
+ */
+
+static char*
+scan_tag_end(char *p, char *end)
+{
+    char quote = 0;
+
+    for (; p < end; p++) {
+	if (quote) {
+	    if (*p == quote) {
+		quote = 0;
+	    }
+	} else if (*p == '"' || *p == '\'') {
+	    quote = *p;
+	} else if (*p == '>') {
+	    return p;
+	}
+    }
+    return NULL;
+}
+
+/*
+ * Return the '>' which closes the comment starting at p, or NULL if
+ * the comment is not complete.
+ */
+
+static char*
+scan_comment_end(char *p, char *end)
+{
+    for (p += 4; p + 2 < end; p++) {
+	if (p[0] == '-' && p[1] == '-' && p[2] == '>') {
+	    return p + 2;
+	}
     }
+    return NULL;
+}
+
+/*
+ * Parse the blen and vlen attributes between p and end. The numbers
+ * are converted right in the buffer; atoi() stops at the quote.
+ */
+
+static void
+scan_attr(const char *p, const char *end, snmp_attr_t *attr)
+{
+    const char *name;
+    size_t len;
+    char quote;
 
-    process_reader(reader, func, user_data);
+    while (p < end) {
+	while (p < end && scan_space(*p)) {
+	    p++;
+	}
+	name = p;
+	while (p < end && *p != '=' && ! scan_space(*p)) {
+	    p++;
+	}
+	len = p - name;
+	while (p < end && *p != '"' && *p != '\'') {
+	    p++;
+	}
+	if (p == end) {
+	    break;
+	}
+	quote = *p++;
+	if (len == 4 && memcmp(name, "blen", 4) == 0) {
+	    attr->blen = atoi(p);
+	    attr->flags |= SNMP_FLAG_BLEN;
+	} else if (len == 4 && memcmp(name, "vlen", 4) == 0) {
+	    attr->vlen = atoi(p);
+	    attr->flags |= SNMP_FLAG_VLEN;
+	}
+	while (p < end && *p != quote) {
+	    p++;
+	}
+	p++;
+    }
 }
 
+/*
+ * Read all tokens and pass complete packets either one at a time to
+ * func or in batches to batch_func, just like process_reader() does
+ * for the libxml2 reader. If keep is set, func takes over the memory
+ * of the packets.
+ */
+
+static void
+scan_input(scan_input_t *in, snmp_callback func,
+	   snmp_batch_callback batch_func, void *user_data, int keep)
+{
+    xml_state_t state = IN_NONE, elem;
+    snmp_packet_t _packet, *packets = &_packet;
+    snmp_varbind_t *varbind = NULL;
+    snmp_attr_t *attr;
+    const char *error = NULL;
+    char *p, *q, *end, *name, c;
+    int depth = 0, skip_depth = 0, open = 0, empty, rc;
+    size_t n = 0;
+
+    if (batch_func) {
+	packets = malloc(SNMP_BATCH_SIZE * sizeof(snmp_packet_t));
+	assert(packets);
+    }
+
+    while (! error) {
+	p = in->buf + in->pos;
+	end = in->buf + in->len;
+
+	if (p == end) {
+	    if (! scan_fill(in)) {
+		break;
+	    }
+	    continue;
+	}
+
+	/* character data, which runs up to the next tag */
+	if (*p != '<') {
+	    q = memchr(p, '<', end - p);
+	    if (! q) {
+		if (scan_fill(in)) {
+		    continue;
+		}
+		p = in->buf + in->pos;
+		q = end = in->buf + in->len;
+	    }
+	    in->pos = q - in->buf;
+	    if (skip_depth) {
+		continue;
+	    }
+	    for (name = p; name < q && scan_space(*name); name++) ;
+	    if (name == q) {
+		continue;
+	    }
+	    if (q == end) {
+		error = "unexpected end of input";
+		break;
+	    }
+	    if (memchr(name, '&', q - name)) {
+		error = "entity references are not supported";
+		break;
+	    }
+	    c = *q;
+	    *q = '\0';
+	    process_text(state, &packets[n], varbind, BAD_CAST(p));
+	    *q = c;
+	    continue;
+	}
+
+	/* comments, processing instructions and declarations */
+	if (end - p < 4 && ! in->eof) {
+	    scan_fill(in);
+	    continue;
+	}
+	if (end - p >= 4 && memcmp(p, "<!--", 4) == 0) {
+	    q = scan_comment_end(p, end);
+	} else {
+	    q = scan_tag_end(p, end);
+	}
+	if (! q) {
+	    if (scan_fill(in)) {
+		continue;
+	    }
+	    error = "unexpected end of input";
+	    break;
+	}
+	in->pos = q + 1 - in->buf;
+	if (p[1] == '?' || (p[1] == '!' && p[2] == '-')) {
+	    continue;
+	}
+	if (p[1] == '!') {
+	    error = "DOCTYPE and CDATA sections are not supported";
+	    break;
+	}
+
+	/* end tags */
+	if (p[1] == '/') {
+	    depth--;
+	    if (skip_depth) {
+		if (depth < skip_depth) {
+		    skip_depth = 0;
+		}
+		continue;
+	    }
+	    for (name = p + 2; name < q && ! scan_space(*name); name++) ;
+	    if (name - p == 8 && memcmp(p + 2, "packet", 6) == 0 && open) {
+		open = 0;
+		if (! batch_func) {
+		    func(packets, user_data);
+		    if (! keep) {
+			snmp_packet_free(packets);
+		    }
+		} else if (++n == SNMP_BATCH_SIZE) {
+		    process_batch(packets, n, batch_func, user_data);
+		    n = 0;
+		}
+	    }
+	    continue;
+	}
+
+	/* start tags and empty element tags */
+	empty = (q[-1] == '/');
+	if (skip_depth) {
+	    depth += ! empty;
+	    continue;
+	}
+	name = p + 1;
+	for (p = name; p < q && ! scan_space(*p) && *p != '/'; p++) ;
+	elem = element_lookup(BAD_CAST(name), p - name);
+	attr = NULL;
+	rc = process_element(elem, &state, &packets[n], &varbind, &attr);
+	if (elem == IN_PACKET) {
+	    open = 1;
+	}
+	if (attr) {
+	    scan_attr(p, empty ? q - 1 : q, attr);
+	}
+	if (! empty) {
+	    depth++;
+	    if (rc == NODE_SKIP) {
+		skip_depth = depth;
+	    }
+	}
+    }
+
+    if (n) {
+	process_batch(packets, n, batch_func, user_data);
+    }
+    if (open) {
+	snmp_packet_free(&packets[n]);
+    }
+    if (batch_func) {
+	free(packets);
+    }
+    if (error) {
+	fprintf(stderr, "%s: failed to parse XML input at offset %lu: %s\n",
+		progname, (unsigned long) (in->offset + in->pos), error);
+    }
+}
+
+static void
+scan_stream(FILE *stream, snmp_callback func,
+	    snmp_batch_callback batch_func, void *user_data)
+{
+    scan_input_t in;
+
+    memset(&in, 0, sizeof(in));
+    in.stream = stream;
+    in.size = SCAN_CHUNK;
+    in.buf = malloc(in.size);
+    assert(in.buf);
+
+    scan_input(&in, func, batch_func, user_data, 0);
+
+    free(in.buf);
+}
+
+/*
+ * The chunk reader functions. Chunks start with a packet element, so
+ * that every chunk can be scanned on its own.
+ */
+
+static char*
+scan_chunk_split(char *p, char *end)
+{
+    for (; (p = memchr(p, '<', end - p)) != NULL; p++) {
+	if (end - p > 7 && memcmp(p + 1, "packet", 6) == 0
+	    && (p[7] == '>' || scan_space(p[7]))) {
+	    return p;
+	}
+    }
+    return end;
+}
+
+static void
+scan_chunk_parse(char *data, size_t len, size_t offset,
+		 snmp_callback func, void *user_data)
+{
+    scan_input_t in;
+
+    memset(&in, 0, sizeof(in));
+    in.buf = data;
+    in.size = in.len = len;
+    in.offset = offset;
+    in.eof = 1;
+
+    scan_input(&in, func, NULL, user_data, 1);
+}
+
+static const snmp_chunk_format_t scan_chunk_format = {
+    scan_chunk_split, scan_chunk_parse, snmp_packet_free
+};
+
+/*
+ * Set how much of a message is decoded by subsequent calls of the
+ * reader functions.
+ */
+
 void
-snmp_xml_read_stream(FILE *stream, snmp_callback func, void *user_data)
+snmp_xml_set_decode(snmp_decode_t decode)
 {
+    skip = decode;
+}
+
+/*
+ * Select the snmptrace scanner instead of the libxml2 reader for
+ * subsequent calls of the reader functions.
+ */
+
+void
+snmp_xml_set_scanner(int on)
+{
+    scanner = on;
+}
+
+/*
+ * Parse files in chunks using the given number of threads. This is
+ * only done by the snmptrace scanner.
+ */
+
+void
+snmp_xml_set_jobs(unsigned n)
+{
+    jobs = n;
+}
+
+static void
+xml_read_stream(FILE *stream, snmp_callback func,
+		snmp_batch_callback batch_func, void *user_data)
+{
+    static pthread_once_t init = PTHREAD_ONCE_INIT;
     xmlTextReaderPtr reader;
     xmlParserInputBufferPtr input;
 
     assert(stream);
+
+    if (scanner) {
+	scan_stream(stream, func, batch_func, user_data);
+	return;
+    }
+
+    /* libxml2 must be initialized once before it is used by threads */
+    pthread_once(&init, xmlInitParser);
 	
     input = xmlParserInputBufferCreateFile(stream, XML_CHAR_ENCODING_NONE);
     if (! input) {
@@ -1151,6 +1685,60 @@ snmp_xml_read_stream(FILE *stream, snmp_callback func, void *user_data)
 	return;
     }
     
-    process_reader(reader, func, user_data);
+    process_reader(reader, func, batch_func, user_data);
+
+    /* the reader does not take over the input buffer */
+    xmlFreeParserInputBuffer(input);
+}
+
+static void
+xml_read_file(const char *file, snmp_callback func,
+	      snmp_batch_callback batch_func, void *user_data)
+{
+    FILE *stream;
+
+    assert(file);
+
+    if (scanner && jobs > 1
+	&& snmp_chunk_read_file(file, jobs, &scan_chunk_format,
+				func, batch_func, user_data) == 0) {
+	return;
+    }
+
+    stream = snmp_zio_open(file);
+    if (! stream) {
+	return;
+    }
+
+    xml_read_stream(stream, func, batch_func, user_data);
+
+    fclose(stream);
+}
+
+void
+snmp_xml_read_file(const char *file, snmp_callback func, void *user_data)
+{
+    xml_read_file(file, func, NULL, user_data);
 }
 
+void
+snmp_xml_read_stream(FILE *stream, snmp_callback func, void *user_data)
+{
+    xml_read_stream(stream, func, NULL, user_data);
+}
+
+void
+snmp_xml_read_file_batch(const char *file,
+			 snmp_batch_callback func, void *user_data)
+{
+    assert(func);
+    xml_read_file(file, NULL, func, user_data);
+}
+
+void
+snmp_xml_read_stream_batch(FILE *stream,
+			   snmp_batch_callback func, void *user_data)
+{
+    assert(func);
+    xml_read_stream(stream, NULL, func, user_data);
+}
@@ -121,13 +121,9 @@ xml_write_ip6addr(FILE *stream, const char *name, snmp_ip6addr_t *v)
 static void
 xml_write_octs(FILE *stream, const char *name, snmp_octs_t *v)
 {
-    int i;
-
     xml_write_open(stream, name, &v->attr);
     if (v->attr.flags & SNMP_FLAG_VALUE) {
-	for (i = 0; i < v->len; i++) {
-	    fprintf(stream, "%.2x", v->value[i]);
-	}
+	snmp_hex_write(stream, v->value, v->len);
     }
     xml_write_close(stream, name);
 }
@@ -400,6 +396,21 @@ snmp_xml_write_stream_pkt(FILE *stream, snmp_packet_t *pkt)
 }
 
 
+/*
+ * Write a batch of packets.
+ */
+
+void
+snmp_xml_write_stream_pkts(FILE *stream, snmp_packet_t **pkts, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+	snmp_xml_write_stream_pkt(stream, pkts[i]);
+    }
+}
+
+
 void
 snmp_xml_write_stream_new(FILE *stream)
 {
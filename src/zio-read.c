@@ -0,0 +1,555 @@
+/*
+ * zio-read.c --
+ *
+ * Input streams which transparently decompress gzip, zstd and xz
+ * compressed files. The compression format is detected from the
+ * magic bytes at the start of the file. Decompression runs on a
+ * separate thread which fills a small ring of chunks so that it
+ * overlaps with decoding on the reading thread.
+ *
+ * $Id$
+ */
+
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include "snmp.h"
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+#define ZIO_GZIP
+#include <zlib.h>
+#endif
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+#define ZIO_ZSTD
+#include <zstd.h>
+#endif
+#if defined(HAVE_LZMA_H) && defined(HAVE_LIBLZMA)
+#define ZIO_XZ
+#include <lzma.h>
+#endif
+
+#define ZIO_MAGIC_SIZE	6
+#define ZIO_PREFIX_SIZE	32
+#define ZIO_IN_SIZE	(128 * 1024)
+#define ZIO_CHUNK_SIZE	(256 * 1024)
+#define ZIO_CHUNKS	4
+
+typedef enum {
+    ZIO_NONE,
+    ZIO_FORMAT_GZIP,
+    ZIO_FORMAT_ZSTD,
+    ZIO_FORMAT_XZ
+} zio_format_t;
+
+static const char *zio_names[] = { "plain", "gzip", "zstd", "xz" };
+
+typedef struct {
+    size_t	len;
+    char	data[ZIO_CHUNK_SIZE];
+} zio_chunk_t;
+
+/*
+ * An underlying file together with the bytes we already consumed
+ * from it and have to replay first. This is all that is needed to
+ * deliver plain input, so it also serves as the stream cookie for
+ * uncompressed pipes and for snmp_zio_unread().
+ */
+
+typedef struct {
+    FILE	   *file;		/* underlying (compressed) file */
+    int		    own;		/* close file when we are closed */
+    unsigned char   magic[ZIO_PREFIX_SIZE];
+    size_t	    magic_len;		/* magic bytes not yet consumed */
+    size_t	    magic_pos;
+} zio_raw_t;
+
+typedef struct {
+    zio_raw_t	    raw;
+    const char	   *name;		/* file name for error messages */
+    zio_format_t    format;
+
+    unsigned char   in[ZIO_IN_SIZE];	/* compressed input buffer */
+    size_t	    in_len;
+    size_t	    in_pos;
+#ifdef ZIO_GZIP
+    z_stream	    gz;
+#endif
+#ifdef ZIO_ZSTD
+    ZSTD_DStream   *zstd;
+    size_t	    zstd_hint;		/* non-zero inside a frame */
+#endif
+#ifdef ZIO_XZ
+    lzma_stream	    xz;
+#endif
+
+    pthread_t	    thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    zio_chunk_t	    chunks[ZIO_CHUNKS];
+    unsigned	    head;		/* next chunk to read */
+    unsigned	    count;		/* number of filled chunks */
+    size_t	    pos;		/* read position in the head chunk */
+    int		    eof;		/* producer has finished */
+    int		    error;		/* input is corrupt or unreadable */
+    int		    stop;		/* consumer has closed the stream */
+} zio_t;
+
+/*
+ * Read raw bytes from the underlying file, replaying the magic bytes
+ * we consumed for format detection first.
+ */
+
+static size_t
+zio_raw_read(zio_raw_t *r, void *buf, size_t size)
+{
+    size_t n = 0;
+
+    if (r->magic_len) {
+	n = size < r->magic_len ? size : r->magic_len;
+	memcpy(buf, r->magic + r->magic_pos, n);
+	r->magic_pos += n;
+	r->magic_len -= n;
+	if (n == size) {
+	    return n;
+	}
+    }
+    return n + fread((char *) buf + n, 1, size - n, r->file);
+}
+
+/*
+ * Make sure there is compressed input available. Returns 0 at the
+ * end of the underlying file.
+ */
+
+static size_t
+zio_fill(zio_t *z)
+{
+    if (z->in_pos == z->in_len) {
+	z->in_pos = 0;
+	z->in_len = zio_raw_read(&z->raw, z->in, sizeof(z->in));
+    }
+    return z->in_len - z->in_pos;
+}
+
+/*
+ * Decompress up to size bytes into buf. Returns the number of bytes
+ * produced, which is less than size at the end of the input or if the
+ * input is corrupt. Concatenated gzip members and zstd/xz frames are
+ * decoded as one stream.
+ */
+
+static size_t
+zio_inflate(zio_t *z, char *buf, size_t size)
+{
+    size_t done = 0;
+
+    while (done < size) {
+	size_t avail = zio_fill(z);
+
+	switch (z->format) {
+#ifdef ZIO_GZIP
+	case ZIO_FORMAT_GZIP: {
+	    int rc;
+
+	    if (! avail) {
+		z->error = (z->gz.total_in != 0);
+		return done;
+	    }
+	    z->gz.next_in = z->in + z->in_pos;
+	    z->gz.avail_in = avail;
+	    z->gz.next_out = (Bytef *) buf + done;
+	    z->gz.avail_out = size - done;
+	    rc = inflate(&z->gz, Z_NO_FLUSH);
+	    z->in_pos += avail - z->gz.avail_in;
+	    done = size - z->gz.avail_out;
+	    if (rc == Z_STREAM_END) {
+		inflateReset(&z->gz);
+		if (! zio_fill(z)) {
+		    return done;
+		}
+	    } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+		z->error = 1;
+		return done;
+	    }
+	    break;
+	}
+#endif
+#ifdef ZIO_ZSTD
+	case ZIO_FORMAT_ZSTD: {
+	    ZSTD_inBuffer in = { z->in + z->in_pos, avail, 0 };
+	    ZSTD_outBuffer out = { buf + done, size - done, 0 };
+	    size_t rc;
+
+	    if (! avail) {
+		z->error = (z->zstd_hint != 0);
+		return done;
+	    }
+	    rc = ZSTD_decompressStream(z->zstd, &out, &in);
+	    if (ZSTD_isError(rc)) {
+		z->error = 1;
+		return done;
+	    }
+	    z->zstd_hint = rc;
+	    z->in_pos += in.pos;
+	    done += out.pos;
+	    break;
+	}
+#endif
+#ifdef ZIO_XZ
+	case ZIO_FORMAT_XZ: {
+	    lzma_ret rc;
+
+	    z->xz.next_in = z->in + z->in_pos;
+	    z->xz.avail_in = avail;
+	    z->xz.next_out = (uint8_t *) buf + done;
+	    z->xz.avail_out = size - done;
+	    rc = lzma_code(&z->xz, avail ? LZMA_RUN : LZMA_FINISH);
+	    z->in_pos += avail - z->xz.avail_in;
+	    done = size - z->xz.avail_out;
+	    if (rc == LZMA_STREAM_END) {
+		return done;
+	    }
+	    if (rc != LZMA_OK) {
+		z->error = 1;
+		return done;
+	    }
+	    break;
+	}
+#endif
+	default:
+	    z->error = 1;
+	    return done;
+	}
+    }
+    return done;
+}
+
+/*
+ * Decompression thread: fill free chunks until the input is
+ * exhausted, an error occurs or the consumer closes the stream.
+ */
+
+static void*
+zio_main(void *arg)
+{
+    zio_t *z = (zio_t *) arg;
+    zio_chunk_t *chunk;
+    size_t n;
+    int done = 0;
+
+    while (! done) {
+	pthread_mutex_lock(&z->lock);
+	while (z->count == ZIO_CHUNKS && ! z->stop) {
+	    pthread_cond_wait(&z->cond, &z->lock);
+	}
+	if (z->stop) {
+	    pthread_mutex_unlock(&z->lock);
+	    break;
+	}
+	chunk = &z->chunks[(z->head + z->count) % ZIO_CHUNKS];
+	pthread_mutex_unlock(&z->lock);
+
+	n = zio_inflate(z, chunk->data, sizeof(chunk->data));
+	if (ferror(z->raw.file)) {
+	    z->error = 1;
+	}
+	if (z->error) {
+	    fprintf(stderr, "%s: %s: corrupt %s compressed input\n",
+		    progname, z->name, zio_names[z->format]);
+	}
+
+	pthread_mutex_lock(&z->lock);
+	if (n > 0) {
+	    chunk->len = n;
+	    z->count++;
+	}
+	if (n < sizeof(chunk->data) || z->error) {
+	    z->eof = 1;
+	    done = 1;
+	}
+	pthread_cond_broadcast(&z->cond);
+	pthread_mutex_unlock(&z->lock);
+    }
+    return NULL;
+}
+
+/*
+ * Stream functions for compressed input.
+ */
+
+static ssize_t
+zio_read(void *cookie, char *buf, size_t size)
+{
+    zio_t *z = (zio_t *) cookie;
+    zio_chunk_t *chunk;
+    size_t n;
+
+    pthread_mutex_lock(&z->lock);
+    while (! z->count && ! z->eof) {
+	pthread_cond_wait(&z->cond, &z->lock);
+    }
+    if (! z->count) {
+	pthread_mutex_unlock(&z->lock);
+	return z->error ? -1 : 0;
+    }
+    chunk = &z->chunks[z->head];
+    pthread_mutex_unlock(&z->lock);
+
+    n = chunk->len - z->pos;
+    if (n > size) {
+	n = size;
+    }
+    memcpy(buf, chunk->data + z->pos, n);
+    z->pos += n;
+
+    if (z->pos == chunk->len) {
+	pthread_mutex_lock(&z->lock);
+	z->head = (z->head + 1) % ZIO_CHUNKS;
+	z->count--;
+	z->pos = 0;
+	pthread_cond_broadcast(&z->cond);
+	pthread_mutex_unlock(&z->lock);
+    }
+    return n;
+}
+
+static int
+zio_close(void *cookie)
+{
+    zio_t *z = (zio_t *) cookie;
+
+    pthread_mutex_lock(&z->lock);
+    z->stop = 1;
+    pthread_cond_broadcast(&z->cond);
+    pthread_mutex_unlock(&z->lock);
+    pthread_join(z->thread, NULL);
+
+    switch (z->format) {
+#ifdef ZIO_GZIP
+    case ZIO_FORMAT_GZIP:
+	inflateEnd(&z->gz);
+	break;
+#endif
+#ifdef ZIO_ZSTD
+    case ZIO_FORMAT_ZSTD:
+	ZSTD_freeDStream(z->zstd);
+	break;
+#endif
+#ifdef ZIO_XZ
+    case ZIO_FORMAT_XZ:
+	lzma_end(&z->xz);
+	break;
+#endif
+    default:
+	break;
+    }
+
+    pthread_cond_destroy(&z->cond);
+    pthread_mutex_destroy(&z->lock);
+    fclose(z->raw.file);
+    free(z);
+    return 0;
+}
+
+/*
+ * Stream functions for plain input on files which are not seekable
+ * (pipes, FIFOs) where the magic bytes must be replayed.
+ */
+
+static ssize_t
+zio_plain_read(void *cookie, char *buf, size_t size)
+{
+    zio_raw_t *r = (zio_raw_t *) cookie;
+    size_t n;
+
+    n = zio_raw_read(r, buf, size);
+    return (n == 0 && ferror(r->file)) ? -1 : (ssize_t) n;
+}
+
+static int
+zio_plain_close(void *cookie)
+{
+    zio_raw_t *r = (zio_raw_t *) cookie;
+
+    if (r->own) {
+	fclose(r->file);
+    }
+    free(r);
+    return 0;
+}
+
+/*
+ * Create a plain input cookie which replays len bytes from buf before
+ * reading from the underlying file.
+ */
+
+static zio_raw_t*
+zio_raw_new(FILE *file, int own, const void *buf, size_t len)
+{
+    zio_raw_t *r;
+
+    r = calloc(1, sizeof(zio_raw_t));
+    if (! r) {
+	abort();
+    }
+    r->file = file;
+    r->own = own;
+    memcpy(r->magic, buf, len);
+    r->magic_len = len;
+    return r;
+}
+
+static zio_format_t
+zio_detect(const unsigned char *m, size_t len)
+{
+    if (len >= 2 && m[0] == 0x1f && m[1] == 0x8b) {
+	return ZIO_FORMAT_GZIP;
+    }
+    if (len >= 4 && m[0] == 0x28 && m[1] == 0xb5
+	&& m[2] == 0x2f && m[3] == 0xfd) {
+	return ZIO_FORMAT_ZSTD;
+    }
+    if (len >= 6 && memcmp(m, "\xfd" "7zXZ\0", 6) == 0) {
+	return ZIO_FORMAT_XZ;
+    }
+    return ZIO_NONE;
+}
+
+/*
+ * Tell whether a buffer starts with the magic of a compression format,
+ * whether or not we can decompress it.
+ */
+
+int
+snmp_zio_compressed(const void *buf, size_t len)
+{
+    return zio_detect(buf, len) != ZIO_NONE;
+}
+
+/*
+ * Set up the decoder for the detected format. Returns -1 if support
+ * for the format is not compiled in or initialization failed.
+ */
+
+static int
+zio_init(zio_t *z)
+{
+    switch (z->format) {
+#ifdef ZIO_GZIP
+    case ZIO_FORMAT_GZIP:
+	return inflateInit2(&z->gz, 15 + 32) == Z_OK ? 0 : -1;
+#endif
+#ifdef ZIO_ZSTD
+    case ZIO_FORMAT_ZSTD:
+	z->zstd = ZSTD_createDStream();
+	return z->zstd ? 0 : -1;
+#endif
+#ifdef ZIO_XZ
+    case ZIO_FORMAT_XZ:
+	return lzma_stream_decoder(&z->xz, UINT64_MAX,
+				   LZMA_CONCATENATED) == LZMA_OK ? 0 : -1;
+#endif
+    default:
+	return -1;
+    }
+}
+
+/*
+ * Open a file for reading and transparently decompress it if it
+ * starts with a gzip, zstd or xz magic. Returns NULL and reports the
+ * problem on stderr if the file cannot be opened or is compressed in
+ * a format we do not support.
+ */
+
+FILE*
+snmp_zio_open(const char *file)
+{
+    cookie_io_functions_t funcs;
+    unsigned char magic[ZIO_MAGIC_SIZE];
+    zio_format_t format;
+    FILE *stream;
+    size_t len;
+    zio_t *z;
+
+    assert(file);
+
+    stream = fopen(file, "r");
+    if (! stream) {
+	fprintf(stderr, "%s: failed to open '%s': %s\n",
+		progname, file, strerror(errno));
+	return NULL;
+    }
+
+    len = fread(magic, 1, sizeof(magic), stream);
+    format = zio_detect(magic, len);
+    if (format == ZIO_NONE && fseek(stream, 0, SEEK_SET) == 0) {
+	return stream;
+    }
+
+    memset(&funcs, 0, sizeof(funcs));
+    if (format == ZIO_NONE) {
+	funcs.read = zio_plain_read;
+	funcs.close = zio_plain_close;
+	return fopencookie(zio_raw_new(stream, 1, magic, len), "r", funcs);
+    }
+
+    z = calloc(1, sizeof(zio_t));
+    if (! z) {
+	abort();
+    }
+    z->raw.file = stream;
+    z->raw.own = 1;
+    memcpy(z->raw.magic, magic, len);
+    z->raw.magic_len = len;
+    z->name = file;
+    z->format = format;
+
+    if (zio_init(z) == -1) {
+	fprintf(stderr, "%s: %s: %s compressed input is not supported\n",
+		progname, file, zio_names[format]);
+	fclose(stream);
+	free(z);
+	return NULL;
+    }
+
+    pthread_mutex_init(&z->lock, NULL);
+    pthread_cond_init(&z->cond, NULL);
+    if (pthread_create(&z->thread, NULL, zio_main, z) != 0) {
+	fprintf(stderr, "%s: failed to create decompression thread\n",
+		progname);
+	exit(1);
+    }
+
+    funcs.read = zio_read;
+    funcs.close = zio_close;
+    return fopencookie(z, "r", funcs);
+}
+
+/*
+ * Push back bytes which have already been read from a stream. The
+ * returned stream delivers the len bytes in buf followed by the rest
+ * of the original stream. Closing it leaves the original stream open.
+ */
+
+FILE*
+snmp_zio_unread(FILE *stream, const void *buf, size_t len)
+{
+    cookie_io_functions_t funcs;
+
+    assert(stream && len <= ZIO_PREFIX_SIZE);
+
+    memset(&funcs, 0, sizeof(funcs));
+    funcs.read = zio_plain_read;
+    funcs.close = zio_plain_close;
+    return fopencookie(zio_raw_new(stream, 0, buf, len), "r", funcs);
+}
@@ -0,0 +1,89 @@
+/*
+ * hextest.c --
+ *
+ * Check the hex conversion functions against a simple reference
+ * implementation with random octet strings. Decoding is checked with
+ * mixed case digits, with invalid characters and in place.
+ *
+ * $Id$
+ */
+
+#include "hex.c"
+
+#include <stdlib.h>
+
+const char *progname = "hextest";
+
+#define MAX_LEN	200
+
+static int
+ref_value(int c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static int
+check_one(unsigned i)
+{
+    unsigned char src[MAX_LEN] = { 0 }, dst[MAX_LEN];
+    char hex[2 * MAX_LEN], ref[2 * MAX_LEN + 1];
+    size_t len, k;
+    int bad = -1, rc;
+
+    len = rand() % MAX_LEN;
+    for (k = 0; k < len; k++) {
+	src[k] = rand();
+	snprintf(ref + 2 * k, 3, "%02x", src[k]);
+    }
+
+    snmp_hex_encode(hex, src, len);
+    if (memcmp(hex, ref, 2 * len) != 0) {
+	fprintf(stderr, "%s: encoding %u differs\n", progname, i);
+	return 1;
+    }
+
+    for (k = 0; k < 2 * len; k++) {
+	if (rand() % 2 && hex[k] >= 'a') {
+	    hex[k] -= 'a' - 'A';
+	}
+    }
+    if (len && rand() % 3 == 0) {
+	bad = rand() % (2 * len);
+	do {
+	    hex[bad] = rand();
+	} while (ref_value((unsigned char) hex[bad]) >= 0);
+    }
+
+    rc = snmp_hex_decode(dst, hex, len);
+    if (rc != (bad >= 0 ? -1 : 0) || (rc == 0 && memcmp(dst, src, len))) {
+	fprintf(stderr, "%s: decoding %u differs\n", progname, i);
+	return 1;
+    }
+
+    rc = snmp_hex_decode((unsigned char *) hex, hex, len);
+    if (rc != (bad >= 0 ? -1 : 0) || (rc == 0 && memcmp(hex, src, len))) {
+	fprintf(stderr, "%s: decoding %u in place differs\n", progname, i);
+	return 1;
+    }
+
+    return 0;
+}
+
+int
+main(void)
+{
+    const unsigned count = 1000000;
+    unsigned i;
+
+    srand(4711);
+    for (i = 0; i < count; i++) {
+	if (check_one(i)) {
+	    return 1;
+	}
+    }
+    printf("%s: %u strings converted correctly\n", progname, count);
+    return 0;
+}
@@ -0,0 +1,185 @@
+/*
+ * oidtest.c --
+ *
+ * Check that the vectorized OID decoder returns the same results as
+ * the scalar decoder for random and truncated BER encoded OIDs. With
+ * -b, measure how long both decoders take for a few typical OIDs.
+ *
+ * $Id$
+ */
+
+#include "oid.c"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+const char *progname = "oidtest";
+
+#define MAX_LEN	256
+
+/*
+ * Append the BER encoding of a sub-identifier to buf and return the
+ * number of bytes written.
+ */
+
+static unsigned
+encode_subid(unsigned char *buf, uint32_t v)
+{
+    unsigned char tmp[5];
+    unsigned i = 0, n = 0;
+
+    do {
+	tmp[i++] = v & 0x7f;
+	v >>= 7;
+    } while (v);
+    while (i > 1) {
+	buf[n++] = tmp[--i] | OID_MORE;
+    }
+    buf[n++] = tmp[0];
+    return n;
+}
+
+/*
+ * Fill buf with a random OID. Most sub-identifiers are small like in
+ * real traffic. Some inputs are random bytes, which yields arbitrary
+ * continuation bits, and some are cut off in the middle of a
+ * sub-identifier.
+ */
+
+static unsigned
+random_oid(unsigned char *buf)
+{
+    unsigned len = 0, max = 1 + rand() % MAX_LEN;
+    uint32_t v;
+
+    if (rand() % 8 == 0) {
+	for (len = 0; len < max; len++) {
+	    buf[len] = rand();
+	}
+	return len;
+    }
+
+    while (len + 5 <= max) {
+	switch (rand() % 8) {
+	case 0:
+	    v = rand() % 16384;
+	    break;
+	case 1:
+	    v = ((uint32_t) rand() << 16) ^ rand();
+	    break;
+	default:
+	    v = rand() % 128;
+	    break;
+	}
+	len += encode_subid(buf + len, v);
+    }
+    if (len && rand() % 4 == 0) {
+	len -= rand() % (len < 5 ? len : 5);
+    }
+    return len;
+}
+
+static int
+check(unsigned count)
+{
+    unsigned char buf[MAX_LEN];
+    uint32_t *a, *b;
+    unsigned i, len, na, nb;
+
+    for (i = 0; i < count; i++) {
+	len = random_oid(buf);
+	/* exact sizes so that memory checkers catch overruns */
+	a = malloc((len + 1) * sizeof(uint32_t));
+	b = malloc((len + 1) * sizeof(uint32_t));
+	if (! a || ! b) {
+	    abort();
+	}
+	na = oid_decode_scalar(a, buf, len, 1);
+	nb = snmp_oid_decode(b, buf, len);
+	if (na != nb || memcmp(a, b, na * sizeof(uint32_t)) != 0) {
+	    fprintf(stderr, "%s: decoders differ for input %u "
+		    "(%u bytes)\n", progname, i, len);
+	    return 1;
+	}
+	free(a);
+	free(b);
+    }
+    printf("%s: %u OIDs decoded identically\n", progname, count);
+    return 0;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+bench_oid(const char *name, const uint32_t *subids, unsigned count)
+{
+    unsigned char buf[MAX_LEN];
+    uint32_t out[MAX_LEN + 1];
+    unsigned i, len = 0, n = 0;
+    const unsigned rounds = 10000000;
+    double t0, t1, t2;
+
+    len = encode_subid(buf, subids[0] * OIDMUX + subids[1]);
+    for (i = 2; i < count; i++) {
+	len += encode_subid(buf + len, subids[i]);
+    }
+
+    t0 = now();
+    for (i = 0; i < rounds; i++) {
+	n += oid_decode_scalar(out, buf, len, 1);
+	__asm__ __volatile__("" : : "r" (out) : "memory");
+    }
+    t1 = now();
+    for (i = 0; i < rounds; i++) {
+	n += snmp_oid_decode(out, buf, len);
+	__asm__ __volatile__("" : : "r" (out) : "memory");
+    }
+    t2 = now();
+
+    printf("%-24s %3u bytes  scalar %6.1f ns  default %6.1f ns\n",
+	   name, len, (t1 - t0) * 1e9 / rounds, (t2 - t1) * 1e9 / rounds);
+}
+
+static void
+bench(void)
+{
+    static const uint32_t sysDescr[] = { 1, 3, 6, 1, 2, 1, 1, 1, 0 };
+    static const uint32_t ifHCInOctets[] = {
+	1, 3, 6, 1, 2, 1, 31, 1, 1, 1, 6, 10101
+    };
+    static const uint32_t vacmAccess[] = {
+	1, 3, 6, 1, 6, 3, 16, 1, 4, 1, 4, 14, 118, 105, 101, 119, 45,
+	97, 108, 108, 45, 103, 114, 111, 117, 112, 0, 3, 1
+    };
+    static const uint32_t ipNetToMedia[] = {
+	1, 3, 6, 1, 2, 1, 4, 35, 1, 4, 3, 2, 16, 254, 128, 0, 0, 0, 0,
+	0, 0, 2, 16, 62, 255, 254, 1, 35, 69
+    };
+
+#define BENCH(x) bench_oid(#x, x, sizeof(x) / sizeof(x[0]))
+    BENCH(sysDescr);
+    BENCH(ifHCInOctets);
+    BENCH(vacmAccess);
+    BENCH(ipNetToMedia);
+#undef BENCH
+}
+
+int
+main(int argc, char **argv)
+{
+    srand(4711);
+
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+	bench();
+	return 0;
+    }
+    return check(1000000);
+}
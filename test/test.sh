@@ -62,6 +62,33 @@ test_xml_reader_csv_writer()
     done
 }
 
+test_xml_scanner_xml_writer()
+{
+    for file in *.xml; do
+	$SNMPDUMP -X -i xml -o xml $file \
+	    | xmllint --format - \
+	    | diff -u $file -
+	if [ $? == 0 ]; then
+	    echo "$FUNCNAME: $file: PASSED"
+	else
+	    echo "$FUNCNAME: $file: FAILED"
+	fi
+    done
+}
+
+test_xml_scanner_csv_writer()
+{
+    for file in *.xml; do
+	$SNMPDUMP -X -i xml -o csv $file \
+	    | diff -u `basename $file .xml`.csv -
+	if [ $? == 0 ]; then
+	    echo "$FUNCNAME: $file: PASSED"
+	else
+	    echo "$FUNCNAME: $file: FAILED"
+	fi
+    done
+}
+
 test_csv_reader_xml_writer()
 {
     echo "CSV contains less information than XML, so testing"
@@ -92,6 +119,127 @@ test_csv_reader_csv_writer()
     done
 }
 
+# Concatenate all files written by the flow/slice writers into a
+# single stream that can be compared against the *.flows and *.slices
+# reference files.
+
+run_split_writer()
+{
+    dir=`mktemp -d`
+    $SNMPDUMP -i csv -o csv $1 -C $dir $2 > /dev/null
+    (cd $dir && for f in *; do echo "==> $f <=="; cat "$f"; done)
+    rm -rf $dir
+}
+
+test_flow_writer()
+{
+    for file in *.flows; do
+	run_split_writer -F `basename $file .flows`.csv \
+	    | diff -u $file -
+	if [ $? == 0 ]; then
+	    echo "$FUNCNAME: $file: PASSED"
+	else
+	    echo "$FUNCNAME: $file: FAILED"
+	fi
+    done
+}
+
+test_slice_writer()
+{
+    for file in *.slices; do
+	run_split_writer -S `basename $file .slices`.csv \
+	    | diff -u $file -
+	if [ $? == 0 ]; then
+	    echo "$FUNCNAME: $file: PASSED"
+	else
+	    echo "$FUNCNAME: $file: FAILED"
+	fi
+    done
+}
+
+# Compressed input is decompressed transparently, so reading gzip and
+# xz compressed copies of the test files must produce the same output
+# as reading the files themselves. The last case reads the plain file
+# through a pipe, which cannot be rewound after format detection.
+
+test_compressed_reader()
+{
+    dir=`mktemp -d`
+    for file in *.pcap *.xml *.csv; do
+	format=${file##*.}
+	gzip -c $file > $dir/$file.gz
+	xz -c $file > $dir/$file.xz
+	for input in $file.gz $file.xz; do
+	    $SNMPDUMP -i $format -o csv $dir/$input \
+		| diff -u <($SNMPDUMP -i $format -o csv $file) -
+	    if [ $? == 0 ]; then
+		echo "$FUNCNAME: $input: PASSED"
+	    else
+		echo "$FUNCNAME: $input: FAILED"
+	    fi
+	done
+	$SNMPDUMP -i $format -o csv <(cat $file) \
+	    | diff -u <($SNMPDUMP -i $format -o csv $file) -
+	if [ $? == 0 ]; then
+	    echo "$FUNCNAME: $file (pipe): PASSED"
+	else
+	    echo "$FUNCNAME: $file (pipe): FAILED"
+	fi
+    done
+    rm -rf $dir
+}
+
+# Split time ordered CSV files into two interleaved files and into two
+# consecutive halves. Merging the parts must give the original file,
+# also when the halves are read one after the other by a single
+# merge reader.
+
+test_merge_reader()
+{
+    dir=`mktemp -d`
+    for file in scli.csv misc.csv; do
+	awk "NR % 2 { print > \"$dir/odd.csv\"; next } \
+	     { print > \"$dir/even.csv\" }" $file
+	half=$((`wc -l < $file` / 2))
+	head -n $half $file > $dir/head.csv
+	tail -n +$((half + 1)) $file > $dir/tail.csv
+	$SNMPDUMP -M -i csv -o csv $dir/odd.csv $dir/even.csv \
+	    | diff -u $file -
+	if [ $? == 0 ]; then
+	    echo "$FUNCNAME: $file (interleaved): PASSED"
+	else
+	    echo "$FUNCNAME: $file (interleaved): FAILED"
+	fi
+	$SNMPDUMP -M -N 1 -i csv -o csv $dir/head.csv $dir/tail.csv \
+	    | diff -u $file -
+	if [ $? == 0 ]; then
+	    echo "$FUNCNAME: $file (consecutive): PASSED"
+	else
+	    echo "$FUNCNAME: $file (consecutive): FAILED"
+	fi
+    done
+    rm -rf $dir
+}
+
+# Parse the CSV and XML files with several threads in chunks of a
+# few hundred bytes, so that many records end up at chunk boundaries,
+# and compare against reading the files sequentially.
+
+test_chunk_reader()
+{
+    for file in *.csv *.xml; do
+	format=${file##*.}
+	scan=`[ $format == xml ] && echo -X`
+	SNMPDUMP_CHUNK_SIZE=300 $SNMPDUMP $scan -R 4 -i $format -o csv $file \
+	    | diff -u <($SNMPDUMP $scan -i $format -o csv $file) -
+	if [ $? == 0 ]; then
+	    echo "$FUNCNAME: $file: PASSED"
+	else
+	    echo "$FUNCNAME: $file: FAILED"
+	fi
+    done
+}
+
 test_pcap_reader_xml_writer
 echo ""
 test_pcap_reader_csv_writer
@@ -100,8 +248,21 @@ test_xml_reader_xml_writer
 echo ""
 test_xml_reader_csv_writer
 echo ""
+test_xml_scanner_xml_writer
+echo ""
+test_xml_scanner_csv_writer
+echo ""
 #test_csv_reader_xml_writer
 #echo ""
 test_csv_reader_csv_writer
 echo ""
-
+test_flow_writer
+echo ""
+test_slice_writer
+echo ""
+test_compressed_reader
+echo ""
+test_merge_reader
+echo ""
+test_chunk_reader
+echo ""